@@ -0,0 +1,290 @@
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+#include "ActivityGate.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+/****************
+ *	   GATE		*
+ ****************/
+
+ActivityGate::ActivityGate(const ActivitySettings& settings, SamplingRate_t samplingRate, StartHandler onStart, DataHandler onData, EndHandler onEnd)
+	: _settings(settings)
+	, _windowSamples((std::max)(size_t(samplingRate) * size_t(settings.windowMs) / 1000, size_t(16)))
+	, _window(_windowSamples)
+	, _windowFill(0)
+	, _preRoll(size_t(samplingRate) * size_t(settings.preRollMs) / 1000)
+	, _preRollHead(0)
+	, _preRollFill(0)
+	, _postRollSamples(size_t(samplingRate) * size_t(settings.postRollMs) / 1000)
+	, _quietSamples(0)
+	, _active(false)
+	, _captureSample(0)
+	, _startPower(32768.0 * 32768.0 * std::pow(10.0, settings.startDb / 10.0))
+	, _stopPower(32768.0 * 32768.0 * std::pow(10.0, (std::min)(settings.stopDb, settings.startDb) / 10.0))
+	, _onStart(std::move(onStart))
+	, _onData(std::move(onData))
+	, _onEnd(std::move(onEnd))
+{
+}
+
+void ActivityGate::Process(const WaveSample16_t* samples, size_t count)
+{
+	PROFILE_ZONE("ActivityGate");
+	while (count)
+	{
+		size_t chunk = (std::min)(count, _windowSamples - _windowFill);
+		memcpy(_window.data() + _windowFill, samples, chunk * sizeof(WaveSample16_t));
+		_windowFill += chunk;
+		samples += chunk;
+		count -= chunk;
+		if (_windowFill == _windowSamples)
+			_judgeWindow();
+	}
+}
+
+void ActivityGate::_judgeWindow()
+{
+	const size_t n = _windowFill;
+	if (n == 0)
+		return;
+
+	// Two straight passes the compiler vectorizes: the mean, then power and crossings around it
+	const int16_t* s = reinterpret_cast<const int16_t*>(_window.data());
+	float sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += float(s[i]);
+	const float mean = sum / float(n);
+
+	float sumSquares = 0;
+	unsigned crossings = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		float x = float(s[i]) - mean;
+		sumSquares += x * x;
+	}
+	for (size_t i = 1; i < n; i++)
+		crossings += (float(s[i - 1]) < mean) != (float(s[i]) < mean);
+
+	const double power = double(sumSquares) / double(n);
+	const double zcr = double(crossings) / double(n);
+	const bool loud = power >= (_active ? _stopPower : _startPower) && zcr <= _settings.maxZcr;
+
+	if (!_active)
+	{
+		if (loud)
+		{
+			_active = true;
+			_quietSamples = 0;
+			_onStart(_captureSample - _preRollFill);
+			_flushPreRoll();
+			_onData(_window.data(), n);
+		}
+		else
+			_pushPreRoll(_window.data(), n);
+	}
+	else
+	{
+		_onData(_window.data(), n);
+		if (loud)
+			_quietSamples = 0;
+		else
+		{
+			_quietSamples += n;
+			if (_quietSamples >= _postRollSamples)
+			{
+				_active = false;
+				_onEnd(_captureSample + n);
+			}
+		}
+	}
+
+	_captureSample += n;
+	_windowFill = 0;
+}
+
+void ActivityGate::_pushPreRoll(const WaveSample16_t* samples, size_t count)
+{
+	const size_t capacity = _preRoll.size();
+	if (capacity == 0)
+		return;
+
+	if (count > capacity)
+	{
+		samples += count - capacity;
+		count = capacity;
+	}
+	size_t first = (std::min)(count, capacity - _preRollHead);
+	memcpy(_preRoll.data() + _preRollHead, samples, first * sizeof(WaveSample16_t));
+	memcpy(_preRoll.data(), samples + first, (count - first) * sizeof(WaveSample16_t));
+	_preRollHead = (_preRollHead + count) % capacity;
+	_preRollFill = (std::min)(capacity, _preRollFill + count);
+}
+
+void ActivityGate::_flushPreRoll()
+{
+	const size_t capacity = _preRoll.size();
+	if (_preRollFill == 0)
+		return;
+
+	size_t oldest = (_preRollHead + capacity - _preRollFill) % capacity;
+	size_t first = (std::min)(_preRollFill, capacity - oldest);
+	_onData(_preRoll.data() + oldest, first);
+	if (_preRollFill > first)
+		_onData(_preRoll.data(), _preRollFill - first);
+	_preRollFill = 0;
+}
+
+void ActivityGate::Finish()
+{
+	_judgeWindow();
+	if (_active)
+	{
+		_active = false;
+		_onEnd(_captureSample);
+	}
+}
+
+bool ActivityGate::IsActive() const
+{
+	return _active;
+}
+
+/****************
+ *	 RECORDER	*
+ ****************/
+
+ActivityRecorder::ActivityRecorder(const ActivitySettings& settings, const std::string& fileName, SamplingRate_t samplingRate, WORD channels, WORD bps, WaveBuffer_t& buffer)
+	: _settings(settings)
+	, _fileName(fileName)
+	, _samplingRate(samplingRate)
+	, _channels(channels)
+	, _bps(bps)
+	, _buffer(buffer)
+	, _outputSamples(0)
+	, _captureSamples(0)
+	, _gate(settings, samplingRate,
+		[this](uint64_t captureSample)
+		{
+			_regions.push_back({ captureSample, _outputSamples, 0 });
+			if (_eventsMode())
+				_openEvent();
+		},
+		[this](const WaveSample16_t* samples, size_t count)
+		{
+			_regions.back().samples += count;
+			_outputSamples += count;
+			if (_eventsMode())
+				_event.Write(samples, count * sizeof(WaveSample16_t));
+			else
+				_buffer.append(samples, count * sizeof(WaveSample16_t));
+		},
+		[this](uint64_t)
+		{
+			const Region& region = _regions.back();
+			appLog(Debug) << "Activity region " << _regions.size() << " at " << double(region.captureSample) / _samplingRate
+				<< " s, " << double(region.samples) / _samplingRate << " s long";
+			if (_eventsMode())
+				_event.Close();
+		})
+{
+	// Allocated up front so realtime capture does not allocate per region
+	_regions.reserve(1024);
+	appLog(Info) << "Activity gate: " << _settings.mode << " mode, open at " << _settings.startDb << " dBFS, close below "
+		<< _settings.stopDb << " dBFS, pre-roll " << _settings.preRollMs << " ms, post-roll " << _settings.postRollMs << " ms";
+}
+
+ActivityRecorder::~ActivityRecorder()
+{
+	_event.Close();
+}
+
+bool ActivityRecorder::_eventsMode() const
+{
+	return _settings.mode == "Events";
+}
+
+bool ActivityRecorder::WritesMainFile() const
+{
+	return !_eventsMode();
+}
+
+void ActivityRecorder::Process(const WaveSample16_t* samples, size_t count)
+{
+	_captureSamples += count;
+	_gate.Process(samples, count);
+}
+
+void ActivityRecorder::Finish()
+{
+	_gate.Finish();
+	_writeIndex();
+
+	double captured = double(_captureSamples) / _samplingRate;
+	double kept = double(_outputSamples) / _samplingRate;
+	appLog(Info) << "Activity gate: " << _regions.size() << " regions, kept " << kept << " s of " << captured << " s ("
+		<< (captured > 0 ? 100.0 * kept / captured : 0.0) << "%)";
+}
+
+std::string ActivityRecorder::_eventFileName(size_t index) const
+{
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "_%04u", unsigned(index));
+	size_t dot = _fileName.find_last_of('.');
+	size_t slash = _fileName.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return _fileName + suffix + ".wav";
+	return _fileName.substr(0, dot) + suffix + _fileName.substr(dot);
+}
+
+void ActivityRecorder::_openEvent()
+{
+	std::string name = _eventFileName(_regions.size());
+	if (!_event.Open(name, _channels, _samplingRate, _bps))
+		appLog(Warning) << "Activity gate: cannot create " << name;
+}
+
+void ActivityRecorder::AppendCues(WaveBuffer_t& wave) const
+{
+	if (_regions.empty() || wave.size() < WaveFileWriter::HEADER_SIZE)
+		return;
+
+	// One cue point per region at its first sample in the data chunk
+	wave.append((const byte*)"cue ", 4);
+	wave.append<uint32_t>(uint32_t(4 + 24 * _regions.size()));
+	wave.append<uint32_t>(uint32_t(_regions.size()));
+	for (size_t i = 0; i < _regions.size(); i++)
+	{
+		wave.append<uint32_t>(uint32_t(i + 1));
+		wave.append<uint32_t>(uint32_t(_regions[i].outputSample));
+		wave.append((const byte*)"data", 4);
+		wave.append<uint32_t>(0);
+		wave.append<uint32_t>(0);
+		wave.append<uint32_t>(uint32_t(_regions[i].outputSample));
+	}
+	uint32_t riffSize = uint32_t(wave.size() - 8);
+	memcpy(wave.data() + 4, &riffSize, sizeof(riffSize));
+}
+
+void ActivityRecorder::_writeIndex() const
+{
+	std::string indexFile = _fileName + ".regions.csv";
+	std::ofstream out(indexFile, std::ios::trunc);
+	if (!out)
+	{
+		appLog(Warning) << "Activity gate: cannot write " << indexFile;
+		return;
+	}
+
+	out << "region,file,output_sample,capture_sample,capture_sec,samples,duration_sec\n";
+	for (size_t i = 0; i < _regions.size(); i++)
+	{
+		const Region& r = _regions[i];
+		out << i + 1 << "," << (_eventsMode() ? _eventFileName(i + 1) : _fileName) << "," << (_eventsMode() ? 0 : r.outputSample) << ","
+			<< r.captureSample << "," << double(r.captureSample) / _samplingRate << "," << r.samples << "," << double(r.samples) / _samplingRate << "\n";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include <Windows.h>
+
+#include "WaveStream.h"
+
+struct ActivitySettings
+{
+	bool			enabled;
+	std::string		mode;			// "Cues": one file of active audio with a cue per region, "Events": one file per region
+	double			startDb;		// Window level (dBFS, DC removed) that opens a region
+	double			stopDb;			// Level that keeps it open, below startDb for hysteresis
+	double			maxZcr;			// Windows crossing zero more often (per sample) are treated as noise, 1 = off
+	int				windowMs;
+	int				preRollMs;		// Audio kept from before the region opened
+	int				postRollMs;		// Audio kept after the level fell below stopDb
+};
+
+// Energy / zero-crossing activity detector with hysteresis, pre-roll and post-roll.
+// Samples are judged one window at a time, so output lags input by at most one window.
+class ActivityGate
+{
+public:
+	using StartHandler = std::function<void(uint64_t captureSample)>;
+	using DataHandler = std::function<void(const WaveSample16_t* samples, size_t count)>;
+	using EndHandler = std::function<void(uint64_t captureSample)>;
+
+private:
+	ActivitySettings			_settings;
+	size_t						_windowSamples;
+	std::vector<WaveSample16_t>	_window;
+	size_t						_windowFill;
+	std::vector<WaveSample16_t>	_preRoll;		// Ring of the last preRollMs of inactive audio
+	size_t						_preRollHead;
+	size_t						_preRollFill;
+	size_t						_postRollSamples;
+	size_t						_quietSamples;	// Active, below stopDb since this many samples
+	bool						_active;
+	uint64_t					_captureSample;	// Index of the first sample in _window
+	double						_startPower;
+	double						_stopPower;
+
+	StartHandler				_onStart;
+	DataHandler					_onData;
+	EndHandler					_onEnd;
+
+	void _judgeWindow();
+	void _pushPreRoll(const WaveSample16_t* samples, size_t count);
+	void _flushPreRoll();
+
+public:
+	ActivityGate(const ActivitySettings& settings, SamplingRate_t samplingRate, StartHandler onStart, DataHandler onData, EndHandler onEnd);
+
+	void Process(const WaveSample16_t* samples, size_t count);
+	void Finish();	// Ends an open region, the partial last window is judged as is
+	bool IsActive() const;
+};
+
+// Gated file output for SerialAudioSampler's file mode
+class ActivityRecorder
+{
+private:
+	struct Region
+	{
+		uint64_t	captureSample;	// Where the region starts in the capture, pre-roll included
+		uint64_t	outputSample;	// Where it starts in the cue file
+		uint64_t	samples;
+	};
+
+	ActivitySettings		_settings;
+	std::string				_fileName;
+	SamplingRate_t			_samplingRate;
+	WORD					_channels;
+	WORD					_bps;
+	WaveBuffer_t&			_buffer;		// Cue mode output, saved by the sampler
+	std::vector<Region>		_regions;
+	uint64_t				_outputSamples;
+	uint64_t				_captureSamples;
+	WaveFileWriter			_event;			// Events mode: the open region's file
+	ActivityGate			_gate;
+
+	bool _eventsMode() const;
+	std::string _eventFileName(size_t index) const;
+	void _openEvent();
+	void _writeIndex() const;
+
+	ActivityRecorder(const ActivityRecorder&) = delete;
+	ActivityRecorder& operator=(const ActivityRecorder&) = delete;
+
+public:
+	ActivityRecorder(const ActivitySettings& settings, const std::string& fileName, SamplingRate_t samplingRate, WORD channels, WORD bps, WaveBuffer_t& buffer);
+	~ActivityRecorder();
+
+	void Process(const WaveSample16_t* samples, size_t count);
+	void Finish();
+
+	bool WritesMainFile() const;			// Cues mode fills the sampler's buffer
+	void AppendCues(WaveBuffer_t& wave) const;	// Adds a RIFF cue chunk to a finished wave, Finish() writes the <file>.regions.csv index
+};
\ No newline at end of file
@@ -0,0 +1,358 @@
+#include "Benchmark.h"
+
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "WaveStream.h"
+#include "ConfigMgr.h"
+#include "Serial.h"
+#include "Utils.h"
+#include "Logger.h"
+#include "Clock.h"
+
+namespace Benchmark
+{
+	// Keeps results observable so the optimizer cannot drop the benchmarked call
+	static volatile uint64_t g_sink = 0;
+
+	static int64_t nowNs()
+	{
+		return int64_t(Clock::NowNs());
+	}
+
+	Timer::Timer()
+		: _started(0), _elapsed(0)
+	{
+	}
+
+	void Timer::Start()
+	{
+		_started = nowNs();
+	}
+
+	void Timer::Stop()
+	{
+		_elapsed += nowNs() - _started;
+	}
+
+	int64_t Timer::GetElapsedNs() const
+	{
+		return _elapsed;
+	}
+
+	static void addWaveBufferCases(std::vector<Case>& cases)
+	{
+		constexpr size_t APPEND_BYTES = 1024 * 1024;
+		constexpr size_t APPEND_CHUNK = 4096;
+
+		cases.push_back({ "wavebuffer_append_per_byte", 20, APPEND_BYTES, [](Timer& t, uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				WaveBuffer_t buf;
+				t.Start();
+				for (size_t b = 0; b < APPEND_BYTES; b++)
+					buf.append<byte>(byte(b));
+				t.Stop();
+				g_sink += buf.size();
+			}
+		} });
+
+		cases.push_back({ "wavebuffer_append_bulk", 20, APPEND_BYTES, [](Timer& t, uint64_t iterations)
+		{
+			std::vector<byte> chunk(APPEND_CHUNK, 0x80);
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				WaveBuffer_t buf;
+				t.Start();
+				for (size_t b = 0; b < APPEND_BYTES; b += APPEND_CHUNK)
+					buf.append(chunk.data(), chunk.size());
+				t.Stop();
+				g_sink += buf.size();
+			}
+		} });
+
+		// 8 kHz 8-bit mono, 1 s / 1 min / 10 min of audio
+		for (size_t seconds : { 1, 60, 600 })
+		{
+			size_t bytes = 8000 * seconds;
+			cases.push_back({ "wavebuffer_makewave_" + std::to_string(seconds) + "s", seconds >= 600 ? 10u : 50u, bytes, [bytes](Timer& t, uint64_t iterations)
+			{
+				for (uint64_t i = 0; i < iterations; i++)
+				{
+					WaveBuffer_t buf;
+					buf.resize(bytes, 0x80);
+					t.Start();
+					buf.makeWave(1, 8000, 8);
+					t.Stop();
+					g_sink += buf.size();
+				}
+			} });
+		}
+	}
+
+	static void addUtilsCases(std::vector<Case>& cases)
+	{
+		// Calibration collects one measurement per interval, so realistic inputs are small
+		for (size_t count : { 50, 500, 5000 })
+		{
+			cases.push_back({ "utils_most_frequent_" + std::to_string(count), count >= 5000 ? 10u : 1000u, 0, [count](Timer& t, uint64_t iterations)
+			{
+				std::vector<SamplingRate_t> values(count);
+				for (size_t i = 0; i < count; i++)
+					values[i] = SamplingRate_t(800 + (i * 7919) % 13);
+
+				t.Start();
+				for (uint64_t i = 0; i < iterations; i++)
+					g_sink += Utils::findMostFrequentlyElement<SamplingRate_t>(values);
+				t.Stop();
+			} });
+		}
+	}
+
+	// The unfiltered cases log far more records than a thread queue holds. Under the Drop policy they
+	// would mostly time the drop path, so they wait for the writer instead and report any loss.
+	// The writer formats the records but discards them, the cases time the logging call and the
+	// formatting rather than the disk, and keep a million records out of app.log and its rotation.
+	class BenchmarkLogScope
+	{
+	private:
+		_____LOGGER::Logger::OverflowPolicy		_policy;
+		_____LOGGER::OutputInterface::Type		_output;
+		size_t									_dropped;
+
+	public:
+		BenchmarkLogScope()
+			: _policy(_____LOGGER::___Logger.overflowPolicy())
+			, _output(_____LOGGER::___Logger.outputType())
+			, _dropped(_____LOGGER::___Logger.GetDroppedRecords())
+		{
+			APP_LOG_OVERFLOW(Block);
+			_____LOGGER::___Logger.outputType(_____LOGGER::OutputInterface::Type::None);
+		}
+
+		~BenchmarkLogScope()
+		{
+			APP_LOG_FLUSH();
+			_____LOGGER::___Logger.outputType(_output);
+			_____LOGGER::___Logger.overflowPolicy(_policy);
+			size_t dropped = _____LOGGER::___Logger.GetDroppedRecords() - _dropped;
+			if (dropped)
+				std::cout << "  " << dropped << " log records dropped" << std::endl;
+		}
+	};
+
+	static void addLoggerCases(std::vector<Case>& cases)
+	{
+		cases.push_back({ "logger_filtered", 1000000, 0, [](Timer& t, uint64_t iterations)
+		{
+			APP_LOG_LEVEL(LOGLVL(Warning));
+			t.Start();
+			for (uint64_t i = 0; i < iterations; i++)
+				appLog(Debug) << "Filtered record " << i << " of " << iterations;
+			t.Stop();
+			APP_LOG_LEVEL(LOGLVL(Debug));
+		} });
+
+		cases.push_back({ "logger_unfiltered", 100000, 0, [](Timer& t, uint64_t iterations)
+		{
+			APP_LOG_LEVEL(LOGLVL(Debug));
+			BenchmarkLogScope scope;
+			t.Start();
+			for (uint64_t i = 0; i < iterations; i++)
+				appLog(Debug) << "Benchmark record " << i << " of " << iterations;
+			t.Stop();
+		} });
+
+		cases.push_back({ "logger_unfiltered_format", 100000, 0, [](Timer& t, uint64_t iterations)
+		{
+			APP_LOG_LEVEL(LOGLVL(Debug));
+			BenchmarkLogScope scope;
+			t.Start();
+			for (uint64_t i = 0; i < iterations; i++)
+				appLogf(Debug, "Benchmark record {} of {}", i, iterations);
+			t.Stop();
+		} });
+	}
+
+	static void addConfigCases(std::vector<Case>& cases)
+	{
+		static const std::string file = "benchmark.cfg";
+		static const char* sections[] = { "Audio", "Log", "Realtime", "SerialPort", "Trace" };
+		constexpr int KEYS_PER_SECTION = 8;
+
+		auto writeConfig = []()
+		{
+			std::ofstream out(file);
+			for (auto section : sections)
+			{
+				out << "[" << section << "]" << std::endl;
+				for (int k = 0; k < KEYS_PER_SECTION; k++)
+					out << "Key" << k << "=" << (k * 1000 + 7) << "\t;comment" << std::endl;
+				out << std::endl;
+			}
+		};
+
+		cases.push_back({ "configmgr_load", 2000, 0, [writeConfig](Timer& t, uint64_t iterations)
+		{
+			writeConfig();
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				CConfigMgr cmgr;
+				t.Start();
+				cmgr.Load(file);
+				t.Stop();
+			}
+			DeleteFileA(file.c_str());
+		} });
+
+		cases.push_back({ "configmgr_get_value_num", 1000000, 0, [writeConfig](Timer& t, uint64_t iterations)
+		{
+			writeConfig();
+			CConfigMgr cmgr;
+			cmgr.Load(file);
+			DeleteFileA(file.c_str());
+
+			std::vector<std::string> keys;
+			for (int k = 0; k < KEYS_PER_SECTION; k++)
+				keys.push_back("Key" + std::to_string(k));
+
+			t.Start();
+			for (uint64_t i = 0; i < iterations; i++)
+				g_sink += cmgr.GetValue_Num<int>(sections[i % 5], keys[i % KEYS_PER_SECTION], 0);
+			t.Stop();
+		} });
+	}
+
+	static void addSerialCases(std::vector<Case>& cases, const Options& options)
+	{
+		if (options.loopbackTx.empty() || options.loopbackRx.empty())
+			return;
+
+		constexpr unsigned int READ_BYTES = 256;
+		Options opt = options;
+		cases.push_back({ "serialmgr_read_bytes_" + std::to_string(READ_BYTES), 128, READ_BYTES, [opt](Timer& t, uint64_t iterations)
+		{
+			SerialMgr tx, rx;
+			if (tx.openDevice(opt.loopbackTx, opt.baudRate) != SerialMgr::errCode::Success
+				|| rx.openDevice(opt.loopbackRx, opt.baudRate) != SerialMgr::errCode::Success)
+				throw std::runtime_error("Cannot open loopback ports " + opt.loopbackTx + " / " + opt.loopbackRx);
+			rx.flushReceiver();
+
+			std::atomic<bool> stop = false;
+			std::thread writer([&]()
+			{
+				byte pattern[READ_BYTES];
+				for (unsigned int i = 0; i < READ_BYTES; i++)
+					pattern[i] = byte(i);
+				while (!stop)
+					tx.writeBytes(pattern, sizeof(pattern));
+			});
+
+			byte buffer[READ_BYTES];
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				unsigned int got = 0;
+				t.Start();
+				while (got < READ_BYTES)
+				{
+					int n = rx.readBytes(buffer + got, READ_BYTES - got, 1000);
+					if (n <= 0)
+						break;
+					got += n;
+				}
+				t.Stop();
+				g_sink += got;
+			}
+
+			stop = true;
+			writer.join();
+		} });
+	}
+
+	static Result runCase(const Case& c, int repeats)
+	{
+		// Warm caches and allocator with one short pass
+		Timer warmup;
+		c.run(warmup, (std::max)(c.iterations / 10, uint64_t(1)));
+
+		std::vector<double> nsPerOp;
+		for (int r = 0; r < repeats; r++)
+		{
+			Timer timer;
+			c.run(timer, c.iterations);
+			nsPerOp.push_back(double(timer.GetElapsedNs()) / c.iterations);
+		}
+		std::sort(nsPerOp.begin(), nsPerOp.end());
+
+		Result res;
+		res.name = c.name;
+		res.iterations = c.iterations;
+		res.repeats = repeats;
+		res.nsPerOpMin = nsPerOp.front();
+		res.nsPerOpMedian = nsPerOp[nsPerOp.size() / 2];
+		res.bytesPerSec = (c.bytesPerIteration && res.nsPerOpMedian > 0) ? c.bytesPerIteration * 1e9 / res.nsPerOpMedian : 0;
+		return res;
+	}
+
+	bool Run(const Options& options)
+	{
+		std::vector<Case> cases;
+		addWaveBufferCases(cases);
+		addUtilsCases(cases);
+		addLoggerCases(cases);
+		addConfigCases(cases);
+		addSerialCases(cases, options);
+
+		std::vector<Result> results;
+		for (auto& c : cases)
+		{
+			if (!options.filter.empty() && c.name.find(options.filter) == std::string::npos)
+				continue;
+
+			try
+			{
+				Result res = runCase(c, options.repeats);
+				std::cout << res.name << ": " << res.nsPerOpMedian << " ns/op (min " << res.nsPerOpMin << ")" << std::endl;
+				results.push_back(res);
+			}
+			catch (const std::exception& ex)
+			{
+				std::cout << c.name << ": skipped, " << ex.what() << std::endl;
+			}
+		}
+
+		return SaveResults(options.outputFile, results);
+	}
+
+	bool SaveResults(const std::string& file, const std::vector<Result>& results)
+	{
+		std::ofstream out(file);
+		if (!out)
+			return false;
+
+		bool csv = file.size() >= 4 && file.compare(file.size() - 4, 4, ".csv") == 0;
+		if (csv)
+		{
+			out << "name,iterations,repeats,ns_per_op_min,ns_per_op_median,bytes_per_sec" << std::endl;
+			for (auto& r : results)
+				out << r.name << "," << r.iterations << "," << r.repeats << "," << r.nsPerOpMin << "," << r.nsPerOpMedian << "," << r.bytesPerSec << std::endl;
+		}
+		else
+		{
+			out << "{" << std::endl << "  \"benchmarks\": [" << std::endl;
+			for (size_t i = 0; i < results.size(); i++)
+			{
+				auto& r = results[i];
+				out << "    { \"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"repeats\": " << r.repeats
+					<< ", \"ns_per_op_min\": " << r.nsPerOpMin << ", \"ns_per_op_median\": " << r.nsPerOpMedian
+					<< ", \"bytes_per_sec\": " << r.bytesPerSec << " }" << (i + 1 < results.size() ? "," : "") << std::endl;
+			}
+			out << "  ]" << std::endl << "}" << std::endl;
+		}
+		return bool(out);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// Microbenchmarks for the hot functions the pipeline depends on.
+// Every case runs a fixed number of iterations (no time-based scaling), so results
+// are comparable between releases. Output is JSON, or CSV when the file ends with .csv.
+namespace Benchmark
+{
+	struct Options
+	{
+		std::string		outputFile;
+		std::string		filter;			// Run only cases whose name contains this, empty = all
+		std::string		loopbackTx;		// Port pair connected with a null-modem cable or com0com
+		std::string		loopbackRx;		// for SerialMgr::readBytes, empty = serial cases skipped
+		unsigned int	baudRate;
+		int				repeats;
+	};
+
+	struct Result
+	{
+		std::string		name;
+		uint64_t		iterations;
+		int				repeats;
+		double			nsPerOpMin;
+		double			nsPerOpMedian;
+		double			bytesPerSec;	// Throughput of the median run, 0 if not applicable
+	};
+
+	// Accumulates time only between Start() and Stop(), so a case can exclude per-iteration setup
+	class Timer
+	{
+	private:
+		int64_t		_started;
+		int64_t		_elapsed;
+
+	public:
+		Timer();
+		void Start();
+		void Stop();
+		int64_t GetElapsedNs() const;
+	};
+
+	struct Case
+	{
+		std::string								name;
+		uint64_t								iterations;
+		uint64_t								bytesPerIteration;
+		std::function<void(Timer&, uint64_t)>	run;
+	};
+
+	bool Run(const Options& options);
+	bool SaveResults(const std::string& file, const std::vector<Result>& results);
+}
\ No newline at end of file
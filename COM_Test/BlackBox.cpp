@@ -0,0 +1,412 @@
+#include <cstring>
+#include <cstddef>
+#include <fstream>
+#include <algorithm>
+
+#include <Windows.h>
+
+#include "BlackBox.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "Clock.h"
+#include "Utils.h"
+
+constexpr char BlackBoxRecorder::MAGIC[8];
+
+/****************
+ *	  WRITER	*
+ ****************/
+
+BlackBoxRecorder::BlackBoxRecorder()
+	: _firstPushNs(0)
+	, _firstPushUnixMs(0)
+	, _firstPushSamples(0)
+	, _settings({ false, "", 0.0, 0 })
+	, _header({})
+	, _file(INVALID_HANDLE_VALUE)
+	, _used(0)
+	, _framesWritten(0)
+	, _lastCommitNs(0)
+	, _failed(false)
+	, _running(false)
+{
+}
+
+BlackBoxRecorder::~BlackBoxRecorder()
+{
+	Stop();
+}
+
+uint64_t BlackBoxRecorder::Checksum(const BlackBoxHeader& header)
+{
+	const byte* p = reinterpret_cast<const byte*>(&header);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < offsetof(BlackBoxHeader, checksum); i++)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	return hash;
+}
+
+bool BlackBoxRecorder::SelectHeader(const BlackBoxHeader (&slots)[2], BlackBoxHeader& header)
+{
+	const BlackBoxHeader* best = nullptr;
+	for (auto& slot : slots)
+	{
+		if (memcmp(slot.magic, MAGIC, sizeof(MAGIC)) != 0 || slot.version != VERSION || slot.checksum != Checksum(slot)
+			|| slot.epochCount > MAX_EPOCHS || slot.capacityFrames == 0)
+			continue;
+		if (!best || slot.sequence > best->sequence)
+			best = &slot;
+	}
+	if (best)
+		header = *best;
+	return best != nullptr;
+}
+
+bool BlackBoxRecorder::_writeAt(uint64_t offset, const void* data, size_t size)
+{
+	LARGE_INTEGER pos;
+	pos.QuadPart = LONGLONG(offset);
+	DWORD written = 0;
+	if (!SetFilePointerEx(_file, pos, NULL, FILE_BEGIN) || !WriteFile(_file, data, DWORD(size), &written, NULL) || written != size)
+	{
+		if (!_failed)
+			appLog(Warning) << "Black box: write failed, error " << GetLastError();
+		_failed = true;
+		return false;
+	}
+	return true;
+}
+
+bool BlackBoxRecorder::_openFile(SamplingRate_t samplingRate, WORD channels)
+{
+	_file = CreateFileA(_settings.file.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		appLog(Warning) << "Black box: cannot open " << _settings.file;
+		return false;
+	}
+
+	const uint64_t frameBytes = uint64_t(channels) * sizeof(int16_t);
+	const uint64_t capacity = uint64_t(_settings.hours * 3600.0 * samplingRate);
+	BlackBoxHeader slots[2] = {};
+	DWORD read = 0;
+	ReadFile(_file, &slots[0], sizeof(BlackBoxHeader), &read, NULL);
+	LARGE_INTEGER pos;
+	pos.QuadPart = LONGLONG(HEADER_SLOT);
+	if (SetFilePointerEx(_file, pos, NULL, FILE_BEGIN))
+		ReadFile(_file, &slots[1], sizeof(BlackBoxHeader), &read, NULL);
+
+	// Keep the recorded history unless the format changed or the size is off by more than calibration jitter
+	BlackBoxHeader existing;
+	if (SelectHeader(slots, existing) && existing.channels == channels && existing.bps == sizeof(int16_t) * 8
+		&& existing.capacityFrames >= capacity - capacity / 100 && existing.capacityFrames <= capacity + capacity / 100)
+	{
+		_header = existing;
+		appLog(Info) << "Black box: continuing " << _settings.file << " at frame " << _header.headFrame
+			<< ", " << _header.epochCount << " earlier runs";
+	}
+	else
+	{
+		_header = {};
+		memcpy(_header.magic, MAGIC, sizeof(MAGIC));
+		_header.version = VERSION;
+		_header.channels = channels;
+		_header.bps = sizeof(int16_t) * 8;
+		_header.capacityFrames = capacity;
+
+		// Sized once; NTFS extends the valid data as the first lap writes, so nothing is zero-filled up front
+		pos.QuadPart = LONGLONG(DATA_OFFSET + capacity * frameBytes);
+		if (!SetFilePointerEx(_file, pos, NULL, FILE_BEGIN) || !SetEndOfFile(_file))
+		{
+			appLog(Warning) << "Black box: cannot size " << _settings.file << " to " << (pos.QuadPart >> 20) << " MB, error " << GetLastError();
+			CloseHandle(_file);
+			_file = INVALID_HANDLE_VALUE;
+			return false;
+		}
+		appLog(Info) << "Black box: initialized " << _settings.file << ", " << (pos.QuadPart >> 20) << " MB for " << _settings.hours << " h";
+	}
+
+	// Frames written ahead of the committed head overwrite the oldest ones, readers must skip those
+	_header.guardFrames = uint64_t(_settings.flushSec + RING_SEC) * samplingRate + WRITE_BLOCK / frameBytes;
+	if (_header.guardFrames * 2 > _header.capacityFrames)
+	{
+		appLog(Warning) << "Black box: " << _settings.hours << " h is too short for FlushSec " << _settings.flushSec;
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	// Forget runs that were overwritten, reuse the last one if it never got any audio
+	uint64_t oldest = _header.headFrame + _header.guardFrames > _header.capacityFrames
+		? _header.headFrame + _header.guardFrames - _header.capacityFrames : 0;
+	uint32_t keepFrom = 0;
+	while (keepFrom + 1 < _header.epochCount && _header.epochs[keepFrom + 1].firstFrame <= oldest)
+		keepFrom++;
+	if (_header.epochCount == MAX_EPOCHS && keepFrom == 0)
+		keepFrom = 1;
+	memmove(_header.epochs, _header.epochs + keepFrom, (_header.epochCount - keepFrom) * sizeof(BlackBoxEpoch));
+	_header.epochCount -= keepFrom;
+	if (_header.epochCount && _header.epochs[_header.epochCount - 1].firstFrame == _header.headFrame)
+		_header.epochCount--;
+
+	BlackBoxEpoch& epoch = _header.epochs[_header.epochCount++];
+	epoch = {};
+	epoch.firstFrame = _header.headFrame;
+	epoch.startUnixMs = Utils::getTimeMs();
+	epoch.samplingRate = samplingRate;
+	return true;
+}
+
+bool BlackBoxRecorder::Start(const BlackBoxSettings& settings, SamplingRate_t samplingRate, WORD channels)
+{
+	if (_running.load() || !settings.enabled || samplingRate == 0)
+		return false;
+
+	_settings = settings;
+	_failed = false;
+	if (!_openFile(samplingRate, channels))
+		return false;
+
+	_ring.Reset(size_t(samplingRate) * channels * RING_SEC, channels);
+	_firstPushNs = 0;
+
+	const size_t frameBytes = size_t(channels) * sizeof(int16_t);
+	_buffer.assign(WRITE_BLOCK - WRITE_BLOCK % frameBytes, 0);
+	_used = 0;
+	_framesWritten = _header.headFrame;
+	_commit();
+
+	_running = true;
+	_writer = std::thread(&BlackBoxRecorder::_loop, this);
+	appLog(Info) << "Black box: recording the last " << double(_header.capacityFrames) / samplingRate / 3600.0 << " h to " << settings.file;
+	return true;
+}
+
+void BlackBoxRecorder::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	if (_writer.joinable())
+		_writer.join();
+	CloseHandle(_file);
+	_file = INVALID_HANDLE_VALUE;
+	if (_ring.GetDroppedSamples())
+		appLog(Warning) << "Black box writer fell behind and skipped " << _ring.GetDroppedSamples() << " samples";
+	appLog(Info) << "Black box: head at frame " << _header.headFrame << " of " << _settings.file;
+}
+
+void BlackBoxRecorder::Push(const WaveSample16_t* samples, size_t count)
+{
+	if (_firstPushNs.load(std::memory_order_relaxed) == 0)
+	{
+		// The run's time base: when its first block arrived
+		_firstPushUnixMs = Utils::getTimeMs();
+		_firstPushSamples = count;
+		_firstPushNs.store(Clock::NowNs(), std::memory_order_release);
+	}
+
+	_ring.Push(reinterpret_cast<const int16_t*>(samples), count);
+}
+
+void BlackBoxRecorder::_loop()
+{
+	PROFILE_THREAD("BlackBoxWriter");
+	const uint64_t commitNs = uint64_t(_settings.flushSec) * 1000000000ULL;
+	const size_t channels = _header.channels;
+	while (true)
+	{
+		bool running = _running.load();
+
+		// Whole frames only, so the buffer always maps onto frame slots of the file
+		size_t count = (std::min)(_ring.Available(), (_buffer.size() - _used) / sizeof(int16_t));
+		count -= count % channels;
+		if (count)
+		{
+			_ring.Read(reinterpret_cast<int16_t*>(_buffer.data() + _used), count);
+			_used += count * sizeof(int16_t);
+			if (_used == _buffer.size())
+				_writeBuffer();
+		}
+
+		if (Clock::NowNs() - _lastCommitNs >= commitNs)
+		{
+			_writeBuffer();
+			_commit();
+		}
+
+		if (!count)
+		{
+			if (!running)
+				break;
+			Sleep(POLL_MS);
+		}
+	}
+
+	_writeBuffer();
+	_commit();
+}
+
+void BlackBoxRecorder::_writeBuffer()
+{
+	if (_used == 0)
+		return;
+
+	PROFILE_ZONE("BlackBoxWrite");
+	const size_t frameBytes = size_t(_header.channels) * sizeof(int16_t);
+	uint64_t frames = _used / frameBytes;
+	uint64_t slot = _framesWritten % _header.capacityFrames;
+	uint64_t first = (std::min)(frames, _header.capacityFrames - slot);
+	_writeAt(DATA_OFFSET + slot * frameBytes, _buffer.data(), size_t(first * frameBytes));
+	if (frames > first)
+		_writeAt(DATA_OFFSET, _buffer.data() + first * frameBytes, size_t((frames - first) * frameBytes));
+	_framesWritten += frames;
+	_used = 0;
+}
+
+void BlackBoxRecorder::_commit()
+{
+	PROFILE_ZONE("BlackBoxCommit");
+
+	// Data before header, so a committed head never points past data that is not on disk
+	FlushFileBuffers(_file);
+
+	BlackBoxEpoch& epoch = _header.epochs[_header.epochCount - 1];
+	uint64_t firstNs = _firstPushNs.load(std::memory_order_acquire);
+	if (firstNs)
+	{
+		// Measured rate over the whole run: frames written so far against the time since the first block
+		uint64_t now = Clock::NowNs();
+		uint64_t firstFrames = _firstPushSamples / _header.channels;
+		uint64_t leadNs = firstFrames * 1000000000ULL / epoch.samplingRate;
+		uint64_t pending = _ring.Available() / _header.channels;
+		epoch.startUnixMs = _firstPushUnixMs - int64_t(leadNs / 1000000);
+		epoch.frames = _framesWritten + pending - epoch.firstFrame;
+		epoch.elapsedNs = now - firstNs + leadNs;
+	}
+
+	_header.headFrame = _framesWritten;
+	_header.sequence++;
+	_header.checksum = Checksum(_header);
+	_writeAt((_header.sequence & 1) * HEADER_SLOT, &_header, sizeof(_header));
+	FlushFileBuffers(_file);
+	_lastCommitNs = Clock::NowNs();
+}
+
+/****************
+ *	  READER	*
+ ****************/
+
+bool BlackBoxReader::Open(const std::string& fileName)
+{
+	_fileName = fileName;
+	BlackBoxHeader slots[2] = {};
+	std::ifstream in(fileName, std::ios::binary);
+	in.read(reinterpret_cast<char*>(&slots[0]), sizeof(BlackBoxHeader));
+	in.seekg(std::streamoff(BlackBoxRecorder::HEADER_SLOT));
+	in.read(reinterpret_cast<char*>(&slots[1]), sizeof(BlackBoxHeader));
+	if (!BlackBoxRecorder::SelectHeader(slots, _header) || _header.epochCount == 0)
+	{
+		appLog(Warning) << "Black box: " << fileName << " has no valid header";
+		return false;
+	}
+	return true;
+}
+
+uint64_t BlackBoxReader::OldestFrame() const
+{
+	uint64_t oldest = _header.headFrame + _header.guardFrames > _header.capacityFrames
+		? _header.headFrame + _header.guardFrames - _header.capacityFrames : 0;
+	return (std::max)(oldest, _header.epochs[0].firstFrame);
+}
+
+uint64_t BlackBoxReader::NewestFrame() const
+{
+	return _header.headFrame;
+}
+
+const BlackBoxEpoch& BlackBoxReader::_epochOfFrame(uint64_t frame) const
+{
+	uint32_t i = _header.epochCount - 1;
+	while (i > 0 && _header.epochs[i].firstFrame > frame)
+		i--;
+	return _header.epochs[i];
+}
+
+static double FramesPerMs(const BlackBoxEpoch& epoch)
+{
+	return epoch.frames && epoch.elapsedNs ? double(epoch.frames) * 1e6 / double(epoch.elapsedNs) : epoch.samplingRate / 1000.0;
+}
+
+int64_t BlackBoxReader::UnixMsOfFrame(uint64_t frame) const
+{
+	const BlackBoxEpoch& epoch = _epochOfFrame(frame);
+	return epoch.startUnixMs + int64_t(double(frame - epoch.firstFrame) / FramesPerMs(epoch));
+}
+
+uint64_t BlackBoxReader::FrameOfUnixMs(int64_t unixMs) const
+{
+	// Latest run that started before unixMs; times in a gap between runs map to the end of the earlier run
+	for (uint32_t i = _header.epochCount; i-- > 0;)
+	{
+		const BlackBoxEpoch& epoch = _header.epochs[i];
+		if (unixMs < epoch.startUnixMs)
+			continue;
+		uint64_t end = i + 1 < _header.epochCount ? _header.epochs[i + 1].firstFrame : _header.headFrame;
+		uint64_t frame = epoch.firstFrame + uint64_t(double(unixMs - epoch.startUnixMs) * FramesPerMs(epoch));
+		return (std::min)(frame, end);
+	}
+	return OldestFrame();
+}
+
+bool BlackBoxReader::Export(int64_t fromUnixMs, int64_t toUnixMs, const std::string& outFile) const
+{
+	uint64_t from = (std::max)(FrameOfUnixMs(fromUnixMs), OldestFrame());
+	uint64_t to = toUnixMs >= UnixMsOfFrame(NewestFrame()) ? NewestFrame() : FrameOfUnixMs(toUnixMs);
+	if (to <= from)
+	{
+		appLog(Warning) << "Black box: nothing recorded in that window, " << _fileName << " covers "
+			<< UnixMsOfFrame(OldestFrame()) / 1000 << " to " << UnixMsOfFrame(NewestFrame()) / 1000 << " (Unix s)";
+		return false;
+	}
+
+	std::ifstream in(_fileName, std::ios::binary);
+	WaveFileWriter out;
+	if (!in || !out.Open(outFile, _header.channels, _epochOfFrame(from).samplingRate, _header.bps))
+	{
+		appLog(Warning) << "Black box: cannot create " << outFile;
+		return false;
+	}
+
+	// Linearize: read up to the end of the data area, then continue from its start
+	const size_t frameBytes = size_t(_header.channels) * (_header.bps / 8);
+	std::vector<byte> buffer(WaveFileWriter::BUFFER_SIZE - WaveFileWriter::BUFFER_SIZE % frameBytes);
+	for (uint64_t frame = from; frame < to;)
+	{
+		uint64_t slot = frame % _header.capacityFrames;
+		uint64_t count = (std::min)({ to - frame, _header.capacityFrames - slot, uint64_t(buffer.size() / frameBytes) });
+		in.seekg(std::streamoff(BlackBoxRecorder::DATA_OFFSET + slot * frameBytes));
+		if (!in.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(count * frameBytes)))
+		{
+			appLog(Warning) << "Black box: " << _fileName << " is short";
+			break;
+		}
+		out.Write(buffer.data(), size_t(count * frameBytes));
+		frame += count;
+	}
+
+	uint32_t runs = 1;
+	for (uint32_t i = 0; i < _header.epochCount; i++)
+		runs += _header.epochs[i].firstFrame > from && _header.epochs[i].firstFrame < to ? 1 : 0;
+
+	uint64_t frames = out.GetDataBytes() / frameBytes;
+	bool ok = out.Close();
+	appLog(Info) << "Black box: exported " << double(frames) / _epochOfFrame(from).samplingRate << " s from "
+		<< runs << (runs == 1 ? " run" : " runs") << " to " << outFile;
+	return ok && frames > 0;
+}
+
+const BlackBoxHeader& BlackBoxReader::GetHeader() const
+{
+	return _header;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "WaveStream.h"
+#include "SampleRing.h"
+
+struct BlackBoxSettings
+{
+	bool			enabled;
+	std::string		file;
+	double			hours;		// Audio kept, sets the file size when it is created
+	int				flushSec;	// Data is flushed and the head committed this often, the most lost on power failure
+};
+
+// One run of the capturing process. Frames keep counting across runs, so the file can hold several;
+// frame f of a run was captured at startUnixMs + (f - firstFrame) / rate, with the rate measured over the run.
+struct BlackBoxEpoch
+{
+	uint64_t	firstFrame;
+	int64_t		startUnixMs;	// Wall clock of firstFrame
+	uint64_t	frames;			// Frames captured in elapsedNs, the measured rate; 0 = use samplingRate
+	uint64_t	elapsedNs;
+	uint32_t	samplingRate;	// Calibrated rate of the run
+	uint32_t	reserved;
+};
+
+// Black box layout: two header slots of HEADER_SLOT bytes written alternately, then capacityFrames frames
+// used circularly; frame f is stored at DATA_OFFSET + (f % capacityFrames) * frame size.
+// The slot with the larger sequence and a valid checksum is current, so a torn header write loses one commit.
+struct BlackBoxHeader
+{
+	char			magic[8];
+	uint32_t		version;
+	uint16_t		channels;
+	uint16_t		bps;
+	uint64_t		capacityFrames;
+	uint64_t		sequence;
+	uint64_t		headFrame;		// Frames committed in total, the next frame is written at headFrame % capacityFrames
+	uint64_t		guardFrames;	// Frames past the head that may be written before the next commit
+	uint32_t		epochCount;
+	uint32_t		reserved;
+	BlackBoxEpoch	epochs[32];		// Oldest first
+	uint64_t		checksum;		// FNV-1a of the bytes above
+};
+
+// Black box sink: the capture thread copies samples into a lock-free ring, a writer thread
+// writes them circularly into the preallocated file. Disk usage is fixed; the file is created once
+// and then only overwritten, restarts continue after the committed head.
+class BlackBoxRecorder
+{
+private:
+	SampleRing				_ring;
+	std::atomic<uint64_t>	_firstPushNs;		// Arrival of the run's first block, set once by the capture thread
+	int64_t					_firstPushUnixMs;
+	uint64_t				_firstPushSamples;
+
+	BlackBoxSettings		_settings;
+	BlackBoxHeader			_header;
+	HANDLE					_file;
+	std::vector<byte>		_buffer;
+	size_t					_used;
+	uint64_t				_bufferFrame;		// Absolute frame of the first buffered frame
+	uint64_t				_framesWritten;
+	uint64_t				_runFirstFrame;
+	uint64_t				_lastCommitNs;
+	bool					_failed;
+
+	std::atomic<bool>		_running;
+	std::thread				_writer;
+
+	bool _openFile(SamplingRate_t samplingRate, WORD channels);
+	void _loop();
+	void _writeBuffer();
+	void _commit();
+	bool _writeAt(uint64_t offset, const void* data, size_t size);
+
+	static constexpr int POLL_MS = 20;
+	static constexpr int RING_SEC = 4;
+	static constexpr size_t WRITE_BLOCK = 64 * 1024;
+
+	BlackBoxRecorder(const BlackBoxRecorder&) = delete;
+	BlackBoxRecorder& operator=(const BlackBoxRecorder&) = delete;
+
+public:
+	static constexpr char		MAGIC[8] = { 'S', 'A', 'S', 'B', 'B', 'O', 'X', 0 };
+	static constexpr uint32_t	VERSION = 1;
+	static constexpr uint64_t	HEADER_SLOT = 4096;
+	static constexpr uint64_t	DATA_OFFSET = 2 * HEADER_SLOT;
+	static constexpr uint32_t	MAX_EPOCHS = sizeof(BlackBoxHeader::epochs) / sizeof(BlackBoxEpoch);
+
+	BlackBoxRecorder();
+	~BlackBoxRecorder();
+
+	bool Start(const BlackBoxSettings& settings, SamplingRate_t samplingRate, WORD channels);
+	void Stop();	// Writes what is left in the ring and commits the head
+
+	void Push(const WaveSample16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+
+	static uint64_t Checksum(const BlackBoxHeader& header);
+	static bool SelectHeader(const BlackBoxHeader (&slots)[2], BlackBoxHeader& header);	// The current slot, false if neither is valid
+};
+
+// Linearizes a time window of a black box file into a normal WAV
+class BlackBoxReader
+{
+private:
+	std::string		_fileName;
+	BlackBoxHeader	_header;
+
+	const BlackBoxEpoch& _epochOfFrame(uint64_t frame) const;
+
+public:
+	bool Open(const std::string& fileName);
+
+	// Copies the frames captured in [fromUnixMs, toUnixMs) into a WAV, runs are joined without gaps
+	bool Export(int64_t fromUnixMs, int64_t toUnixMs, const std::string& outFile) const;
+
+	uint64_t OldestFrame() const;
+	uint64_t NewestFrame() const;	// One past the last committed frame
+	int64_t UnixMsOfFrame(uint64_t frame) const;
+	uint64_t FrameOfUnixMs(int64_t unixMs) const;
+	const BlackBoxHeader& GetHeader() const;
+};
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+
+#include <Windows.h>
+
+#include "CaptureArchive.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "Clock.h"
+#include "Utils.h"
+
+constexpr char CaptureArchive::MAGIC[8];
+
+/****************
+ *	  WRITER	*
+ ****************/
+
+CaptureArchive::CaptureArchive()
+	: _checkpointSeq(0)
+	, _checkpointSamples(0)
+	, _checkpointNs(0)
+	, _settings({ false, "", 0 })
+	, _header({})
+	, _index(INVALID_HANDLE_VALUE)
+	, _segmentNumber(0)
+	, _segmentFirstFrame(0)
+	, _segmentFrames(0)
+	, _segmentStartNs(0)
+	, _framesPerSegment(0)
+	, _framesWritten(0)
+	, _running(false)
+{
+}
+
+CaptureArchive::~CaptureArchive()
+{
+	Stop();
+}
+
+std::string CaptureArchive::SegmentName(uint32_t segment)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "seg_%06u.wav", segment);
+	return name;
+}
+
+bool CaptureArchive::Start(const ArchiveSettings& settings, SamplingRate_t samplingRate, WORD channels)
+{
+	if (_running.load() || !settings.enabled || samplingRate == 0)
+		return false;
+
+	time_t now = time(0);
+	tm local;
+	localtime_s(&local, &now);
+	char runName[32];
+	strftime(runName, sizeof(runName), "%Y%m%d_%H%M%S", &local);
+
+	CreateDirectoryA(settings.directory.c_str(), NULL);
+	_runDir = settings.directory + "\\" + runName;
+	if (!CreateDirectoryA(_runDir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		appLog(Warning) << "Archive: cannot create " << _runDir;
+		return false;
+	}
+
+	std::string indexPath = _runDir + "\\" + INDEX_FILE;
+	_index = CreateFileA(indexPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_index == INVALID_HANDLE_VALUE)
+	{
+		appLog(Warning) << "Archive: cannot create " << indexPath;
+		return false;
+	}
+
+	_settings = settings;
+	_header = {};
+	memcpy(_header.magic, MAGIC, sizeof(MAGIC));
+	_header.version = VERSION;
+	_header.samplingRate = samplingRate;
+	_header.channels = channels;
+	_header.bps = sizeof(WaveSample16_t) * 8;
+	_header.segmentSec = uint32_t(settings.segmentSec);
+	_header.startMonoNs = Clock::NowNs();
+	_header.startUnixMs = Utils::getTimeMs();
+	DWORD written = 0;
+	WriteFile(_index, &_header, sizeof(_header), &written, NULL);
+	FlushFileBuffers(_index);
+
+	_ring.Reset(size_t(samplingRate) * channels * RING_SEC, channels);
+	_checkpointSamples = 0;
+	_checkpointNs = _header.startMonoNs;
+
+	_segmentNumber = 0;
+	_segmentFrames = 0;
+	_framesWritten = 0;
+	_framesPerSegment = uint64_t(samplingRate) * uint64_t(settings.segmentSec);
+
+	_running = true;
+	_writer = std::thread(&CaptureArchive::_loop, this);
+	appLog(Info) << "Archive: recording to " << _runDir << " in " << settings.segmentSec << " s segments";
+	return true;
+}
+
+void CaptureArchive::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	if (_writer.joinable())
+		_writer.join();
+	CloseHandle(_index);
+	_index = INVALID_HANDLE_VALUE;
+	if (_ring.GetDroppedSamples())
+		appLog(Warning) << "Archive writer fell behind and skipped " << _ring.GetDroppedSamples() << " samples";
+	appLog(Info) << "Archive: " << _segmentNumber << " segments, " << double(_framesWritten) / _header.samplingRate << " s in " << _runDir;
+}
+
+void CaptureArchive::Push(const WaveSample16_t* samples, size_t count)
+{
+	_ring.Push(reinterpret_cast<const int16_t*>(samples), count);
+
+	// The block's last sample arrived about now
+	uint32_t seq = _checkpointSeq.load(std::memory_order_relaxed);
+	_checkpointSeq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_checkpointSamples.store(_ring.GetWritePos(), std::memory_order_relaxed);
+	_checkpointNs.store(Clock::NowNs(), std::memory_order_relaxed);
+	_checkpointSeq.store(seq + 2, std::memory_order_release);
+}
+
+uint64_t CaptureArchive::_timeOfFrame(uint64_t frame) const
+{
+	uint64_t samples, ns;
+	uint32_t seq;
+	do
+	{
+		seq = _checkpointSeq.load(std::memory_order_acquire);
+		samples = _checkpointSamples.load(std::memory_order_relaxed);
+		ns = _checkpointNs.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != _checkpointSeq.load(std::memory_order_relaxed));
+
+	// Extrapolate from the checkpoint at the calibrated rate, it is at most a ring's length away
+	int64_t framesAhead = int64_t(frame) - int64_t(samples / _header.channels);
+	return uint64_t(int64_t(ns) + framesAhead * 1000000000LL / int64_t(_header.samplingRate));
+}
+
+int64_t CaptureArchive::_unixMs(uint64_t monoNs) const
+{
+	return _header.startUnixMs + (int64_t(monoNs) - int64_t(_header.startMonoNs)) / 1000000;
+}
+
+void CaptureArchive::_loop()
+{
+	PROFILE_THREAD("ArchiveWriter");
+	while (true)
+	{
+		bool running = _running.load();
+		const int16_t* samples = nullptr;
+		size_t count = _ring.Peek(samples);
+		if (count == 0)
+		{
+			if (!running)
+				break;
+			Sleep(POLL_MS);
+			continue;
+		}
+
+		_append(samples, count);
+		_ring.Consume(count);
+	}
+
+	if (_segment.IsOpen())
+		_finalizeSegment();
+}
+
+void CaptureArchive::_append(const int16_t* samples, size_t count)
+{
+	const size_t channels = _header.channels;
+	size_t frames = count / channels;
+	while (frames)
+	{
+		if (!_segment.IsOpen())
+			_openSegment();
+
+		size_t take = size_t((std::min<uint64_t>)(frames, _framesPerSegment - _segmentFrames));
+		_segment.Write(samples, take * channels * sizeof(int16_t));
+		_segmentFrames += take;
+		_framesWritten += take;
+		samples += take * channels;
+		frames -= take;
+
+		if (_segmentFrames == _framesPerSegment)
+			_finalizeSegment();
+	}
+}
+
+void CaptureArchive::_openSegment()
+{
+	std::string path = _runDir + "\\" + SegmentName(_segmentNumber);
+	if (!_segment.Open(path, _header.channels, _header.samplingRate, _header.bps))
+		appLog(Warning) << "Archive: cannot create " << path;
+	_segmentFirstFrame = _framesWritten;
+	_segmentFrames = 0;
+	_segmentStartNs = _timeOfFrame(_framesWritten);
+}
+
+void CaptureArchive::_finalizeSegment()
+{
+	PROFILE_ZONE("FinalizeSegment");
+	if (!_segment.Close())
+		appLog(Warning) << "Archive: writing " << SegmentName(_segmentNumber) << " failed";
+
+	ArchiveIndexRecord record = {};
+	record.segment = _segmentNumber;
+	record.firstFrame = _segmentFirstFrame;
+	record.frames = _segmentFrames;
+	record.startMonoNs = _segmentStartNs;
+	record.endMonoNs = _timeOfFrame(_framesWritten);
+	record.startUnixMs = _unixMs(record.startMonoNs);
+	record.endUnixMs = _unixMs(record.endMonoNs);
+
+	DWORD written = 0;
+	if (!WriteFile(_index, &record, sizeof(record), &written, NULL) || written != sizeof(record))
+		appLog(Warning) << "Archive: cannot append to the index, error " << GetLastError();
+	FlushFileBuffers(_index);
+
+	appLog(Debug) << "Archive: " << SegmentName(_segmentNumber) << " finalized, " << _segmentFrames << " frames";
+	_segmentNumber++;
+	_segmentFrames = 0;
+}
+
+/****************
+ *	  READER	*
+ ****************/
+
+bool ArchiveReader::Open(const std::string& runDir)
+{
+	_runDir = runDir;
+	_records.clear();
+
+	std::ifstream in(runDir + "\\" + CaptureArchive::INDEX_FILE, std::ios::binary);
+	if (!in || !in.read(reinterpret_cast<char*>(&_header), sizeof(_header))
+		|| memcmp(_header.magic, CaptureArchive::MAGIC, sizeof(CaptureArchive::MAGIC)) != 0
+		|| _header.version != CaptureArchive::VERSION)
+	{
+		appLog(Warning) << "Archive: " << runDir << " has no valid " << CaptureArchive::INDEX_FILE;
+		return false;
+	}
+
+	ArchiveIndexRecord record;
+	while (in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+		_records.push_back(record);
+	return true;
+}
+
+uint64_t ArchiveReader::MonoFromUnixMs(int64_t unixMs) const
+{
+	int64_t ns = int64_t(_header.startMonoNs) + (unixMs - _header.startUnixMs) * 1000000;
+	return uint64_t((std::max<int64_t>)(ns, 0));
+}
+
+uint64_t ArchiveReader::MonoFromOffsetSec(double sec) const
+{
+	return _header.startMonoNs + uint64_t((std::max)(sec, 0.0) * 1e9);
+}
+
+bool ArchiveReader::Extract(uint64_t fromMonoNs, uint64_t toMonoNs, const std::string& outFile) const
+{
+	// Records are in time order, skip straight to the first one that ends after fromMonoNs
+	auto first = std::upper_bound(_records.begin(), _records.end(), fromMonoNs,
+		[](uint64_t t, const ArchiveIndexRecord& r) { return t < r.endMonoNs; });
+
+	WaveFileWriter out;
+	if (!out.Open(outFile, _header.channels, _header.samplingRate, _header.bps))
+	{
+		appLog(Warning) << "Archive: cannot create " << outFile;
+		return false;
+	}
+
+	const size_t frameBytes = size_t(_header.channels) * (_header.bps / 8);
+	std::vector<byte> buffer(WaveFileWriter::BUFFER_SIZE - WaveFileWriter::BUFFER_SIZE % frameBytes);
+	for (auto it = first; it != _records.end() && it->startMonoNs < toMonoNs; ++it)
+	{
+		// Frames are spread evenly over the segment's measured duration, which absorbs device clock drift
+		double framesPerNs = it->endMonoNs > it->startMonoNs ? double(it->frames) / double(it->endMonoNs - it->startMonoNs) : 0.0;
+		uint64_t from = fromMonoNs > it->startMonoNs ? uint64_t(double(fromMonoNs - it->startMonoNs) * framesPerNs) : 0;
+		uint64_t to = toMonoNs < it->endMonoNs ? uint64_t(double(toMonoNs - it->startMonoNs) * framesPerNs) : it->frames;
+		to = (std::min)(to, it->frames);
+		if (to <= from)
+			continue;
+
+		std::ifstream segment(_runDir + "\\" + CaptureArchive::SegmentName(it->segment), std::ios::binary);
+		if (!segment.seekg(std::streamoff(WaveFileWriter::HEADER_SIZE + from * frameBytes)))
+		{
+			appLog(Warning) << "Archive: " << CaptureArchive::SegmentName(it->segment) << " is missing or short";
+			continue;
+		}
+		uint64_t left = (to - from) * frameBytes;
+		while (left)
+		{
+			size_t chunk = size_t((std::min<uint64_t>)(left, buffer.size()));
+			if (!segment.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(chunk)))
+				break;
+			out.Write(buffer.data(), chunk);
+			left -= chunk;
+		}
+	}
+
+	uint64_t frames = out.GetDataBytes() / frameBytes;
+	bool ok = out.Close();
+	appLog(Info) << "Archive: extracted " << double(frames) / _header.samplingRate << " s to " << outFile;
+	return ok && frames > 0;
+}
+
+const ArchiveIndexHeader& ArchiveReader::GetHeader() const
+{
+	return _header;
+}
+
+const std::vector<ArchiveIndexRecord>& ArchiveReader::GetRecords() const
+{
+	return _records;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "WaveStream.h"
+#include "SampleRing.h"
+
+struct ArchiveSettings
+{
+	bool			enabled;
+	std::string		directory;		// Each run gets its own folder in here, named by its start time
+	int				segmentSec;		// Audio per segment file
+};
+
+// Archive layout: <run>/index.sai and <run>/seg_NNNNNN.wav.
+// index.sai is ArchiveIndexHeader followed by one ArchiveIndexRecord per finished segment.
+// Monotonic times are Clock::NowNs() of the capturing process; wall times are derived from
+// them and the wall clock read once at start, so an NTP step during capture does not skew the index.
+struct ArchiveIndexHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	samplingRate;
+	uint16_t	channels;
+	uint16_t	bps;
+	uint32_t	segmentSec;
+	int64_t		startUnixMs;
+	uint64_t	startMonoNs;
+};
+
+struct ArchiveIndexRecord
+{
+	uint32_t	segment;
+	uint32_t	reserved;
+	uint64_t	firstFrame;		// Frames recorded before this segment
+	uint64_t	frames;
+	uint64_t	startMonoNs;	// Time of the first frame
+	uint64_t	endMonoNs;		// Time just after the last frame
+	int64_t		startUnixMs;
+	int64_t		endUnixMs;
+};
+
+// Archive sink: the capture thread copies samples into a lock-free ring, a writer thread
+// appends them to the current segment and finalizes it (header, index record) at the boundary.
+class CaptureArchive
+{
+private:
+	SampleRing				_ring;
+
+	// Latest (samples pushed, time) pair, published by the capture thread under a sequence lock
+	std::atomic<uint32_t>	_checkpointSeq;
+	std::atomic<uint64_t>	_checkpointSamples;
+	std::atomic<uint64_t>	_checkpointNs;
+
+	ArchiveSettings			_settings;
+	std::string				_runDir;
+	ArchiveIndexHeader		_header;
+	HANDLE					_index;
+	WaveFileWriter			_segment;
+	uint32_t				_segmentNumber;
+	uint64_t				_segmentFirstFrame;
+	uint64_t				_segmentFrames;
+	uint64_t				_segmentStartNs;
+	uint64_t				_framesPerSegment;
+	uint64_t				_framesWritten;
+
+	std::atomic<bool>		_running;
+	std::thread				_writer;
+
+	void _loop();
+	void _append(const int16_t* samples, size_t count);
+	void _openSegment();
+	void _finalizeSegment();
+	uint64_t _timeOfFrame(uint64_t frame) const;
+	int64_t _unixMs(uint64_t monoNs) const;
+
+	static constexpr int POLL_MS = 20;
+	static constexpr int RING_SEC = 4;
+
+	CaptureArchive(const CaptureArchive&) = delete;
+	CaptureArchive& operator=(const CaptureArchive&) = delete;
+
+public:
+	static constexpr char		MAGIC[8] = { 'S', 'A', 'S', 'A', 'R', 'C', 'H', 0 };
+	static constexpr uint32_t	VERSION = 1;
+	static constexpr const char* INDEX_FILE = "index.sai";
+
+	CaptureArchive();
+	~CaptureArchive();
+
+	bool Start(const ArchiveSettings& settings, SamplingRate_t samplingRate, WORD channels);
+	void Stop();	// Writes what is left in the ring and finalizes the last segment
+
+	void Push(const WaveSample16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+
+	static std::string SegmentName(uint32_t segment);
+};
+
+// Random access to a finished archive run
+class ArchiveReader
+{
+private:
+	std::string							_runDir;
+	ArchiveIndexHeader					_header;
+	std::vector<ArchiveIndexRecord>		_records;
+
+public:
+	bool Open(const std::string& runDir);
+
+	// Copies [fromNs, toNs) of monotonic capture time into a WAV, reading only the segments and bytes in range
+	bool Extract(uint64_t fromMonoNs, uint64_t toMonoNs, const std::string& outFile) const;
+
+	uint64_t MonoFromUnixMs(int64_t unixMs) const;
+	uint64_t MonoFromOffsetSec(double sec) const;	// Seconds since the archive started
+	const ArchiveIndexHeader& GetHeader() const;
+	const std::vector<ArchiveIndexRecord>& GetRecords() const;
+};
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "Clock.h"
+
+namespace Clock
+{
+	constexpr uint64_t CALIBRATION_NS = 20000000;	// 20 ms against QPC gives the TSC rate to well under 0.01%
+	constexpr uint64_t MIN_TSC_HZ = 1000000000;		// Below 1 GHz the 32.32 multiplier would overflow
+
+	static uint64_t qpcNow()
+	{
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return uint64_t(counter.QuadPart);
+	}
+
+#ifdef APP_CLOCK_TSC
+	static bool hasInvariantTsc()
+	{
+		int regs[4] = {};
+		__cpuid(regs, 0x80000000);
+		if (unsigned(regs[0]) < 0x80000007)
+			return false;
+		__cpuid(regs, 0x80000007);
+		return (regs[3] & (1 << 8)) != 0;
+	}
+#endif
+
+	State Calibrate()
+	{
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+
+		State state = {};
+		state.qpcFrequency = uint64_t(freq.QuadPart);
+		state.baseTicks = qpcNow();
+
+#ifdef APP_CLOCK_TSC
+		if (!hasInvariantTsc())
+			return state;
+
+		// Busy-wait so both counters are read back to back at each end
+		uint64_t qpcStart = qpcNow();
+		uint64_t tscStart = __rdtsc();
+		uint64_t qpcEnd = qpcStart;
+		while ((qpcEnd - qpcStart) * 1000000000ULL / state.qpcFrequency < CALIBRATION_NS)
+			qpcEnd = qpcNow();
+		uint64_t tscEnd = __rdtsc();
+
+		double seconds = double(qpcEnd - qpcStart) / double(state.qpcFrequency);
+		double tscHz = double(tscEnd - tscStart) / seconds;
+		if (tscHz < MIN_TSC_HZ)
+			return state;
+
+		state.tsc = true;
+		state.mult = uint64_t(1e9 / tscHz * 4294967296.0);
+		state.baseTicks = tscStart;
+#endif
+		return state;
+	}
+
+	std::string Describe()
+	{
+		const State& s = GetState();
+		if (s.tsc)
+			return "invariant TSC at " + std::to_string(uint64_t(1e9 * 4294967296.0 / double(s.mult)) / 1000000) + " MHz";
+		return "QPC at " + std::to_string(s.qpcFrequency) + " Hz";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <Windows.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define APP_CLOCK_TSC
+#endif
+
+// Monotonic nanosecond clock for every interval measurement: calibration, segmentation, timeouts, latency, tracing.
+// Uses the invariant TSC scaled against QPC when the CPU has one, QPC otherwise. Never steps with NTP or wall clock changes.
+// Utils::getTimeMs() stays the wall clock and is only for timestamps shown to people.
+namespace Clock
+{
+	struct State
+	{
+		bool		tsc;
+		uint64_t	baseTicks;	// TSC or QPC ticks at calibration
+		uint64_t	mult;		// TSC: ns per tick in 32.32 fixed point
+		uint64_t	qpcFrequency;
+	};
+
+	State Calibrate();
+
+	inline const State& GetState()
+	{
+		static const State state = Calibrate();
+		return state;
+	}
+
+	// Nanoseconds since the clock was calibrated (first use in the process)
+	inline uint64_t NowNs()
+	{
+		const State& s = GetState();
+#ifdef APP_CLOCK_TSC
+		if (s.tsc)
+		{
+			uint64_t delta = __rdtsc() - s.baseTicks;
+			return (delta >> 32) * s.mult + (((delta & 0xFFFFFFFF) * s.mult) >> 32);
+		}
+#endif
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		uint64_t ticks = uint64_t(counter.QuadPart) - s.baseTicks;
+		return (ticks / s.qpcFrequency) * 1000000000ULL + (ticks % s.qpcFrequency) * 1000000000ULL / s.qpcFrequency;
+	}
+
+	inline int64_t NowMs()
+	{
+		return int64_t(NowNs() / 1000000);
+	}
+
+	std::string Describe();	// Clock source and resolution, for the log
+}
\ No newline at end of file
@@ -58,10 +58,14 @@ bool CConfigMgr::Load(const string& filename)
 			continue;
 		}
 
-		pos = line.find_first_of(';');
-		pos2 = line.find_first_of('#');
-		if ((pos != string::npos) && (pos2 != string::npos) && (pos > pos2)) pos = pos2;
-		if ((pos == string::npos) && (pos2 != string::npos)) pos = pos2;
+		// A comment starts at the first ';' or '#' outside a quoted value
+		pos = string::npos;
+		bool quoted = false;
+		for (pos2 = 0; pos2 < length && pos == string::npos; pos2++)
+		{
+			if (line[pos2] == '"') quoted = !quoted;
+			else if (!quoted && (line[pos2] == ';' || line[pos2] == '#')) pos = pos2;
+		}
 		if (pos != string::npos)
 		{
 			if (pos > 0)
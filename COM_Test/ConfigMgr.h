@@ -41,7 +41,8 @@ public:
 
 		T val;
 		std::istringstream iss(value);
-		iss >> val;
+		if (!(iss >> val))
+			return defaultValue;
 
 		return val;
 	}
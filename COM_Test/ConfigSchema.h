@@ -0,0 +1,246 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <type_traits>
+#include <algorithm>
+
+#include "ConfigMgr.h"
+
+// Declarative, typed config schema. Every section/key is bound once to a field of T with
+// its default and valid range; the file is parsed in a single pass straight into T, so the
+// pipeline reads plain fields and never does string lookups.
+template <class T>
+class ConfigSchema
+{
+private:
+	struct Field
+	{
+		std::string										section;
+		std::string										key;
+		std::function<bool(T&, const std::string&)>		parse;
+		std::function<std::string(const T&)>			format;
+		std::function<void(T&)>							reset;
+		std::string										expected;
+	};
+
+	std::vector<Field>							_fields;
+	std::unordered_map<std::string, size_t>		_index;		// "section.key" -> field
+
+	void _add(Field&& field)
+	{
+		_index[field.section + "." + field.key] = _fields.size();
+		_fields.push_back(std::move(field));
+	}
+
+	static std::string _trim(const std::string& str)
+	{
+		size_t begin = str.find_first_not_of(" \t\r\n");
+		if (begin == std::string::npos)
+			return "";
+		size_t end = str.find_last_not_of(" \t\r\n");
+		return str.substr(begin, end - begin + 1);
+	}
+
+	// ';' and '#' start a comment, except inside a quoted value such as File="rec#1.wav"
+	static void _stripComment(std::string& line)
+	{
+		bool quoted = false;
+		for (size_t i = 0; i < line.size(); i++)
+		{
+			if (line[i] == '"')
+				quoted = !quoted;
+			else if (!quoted && (line[i] == ';' || line[i] == '#'))
+			{
+				line.erase(i);
+				return;
+			}
+		}
+	}
+
+	template <class V>
+	static bool _parseNum(const std::string& text, V& val)
+	{
+		if constexpr (std::is_floating_point_v<V>)
+		{
+			char* end = nullptr;
+			double d = strtod(text.c_str(), &end);
+			if (text.empty() || *end != '\0')
+				return false;
+			val = V(d);
+			return true;
+		}
+		else
+		{
+			auto res = std::from_chars(text.data(), text.data() + text.size(), val);
+			return res.ec == std::errc() && res.ptr == text.data() + text.size();
+		}
+	}
+
+	template <class V>
+	static std::string _formatNum(V val)
+	{
+		std::ostringstream oss;
+		oss << val;
+		return oss.str();
+	}
+
+public:
+	template <class V>
+	ConfigSchema& Num(const char* section, const char* key, V T::* member, V def, V minVal, V maxVal)
+	{
+		Field f;
+		f.section = section;
+		f.key = key;
+		f.expected = "a number in [" + _formatNum(minVal) + ", " + _formatNum(maxVal) + "]";
+		f.parse = [member, minVal, maxVal](T& cfg, const std::string& text)
+		{
+			V val;
+			if (!_parseNum(text, val) || val < minVal || val > maxVal)
+				return false;
+			cfg.*member = val;
+			return true;
+		};
+		f.format = [member](const T& cfg) { return _formatNum(cfg.*member); };
+		f.reset = [member, def](T& cfg) { cfg.*member = def; };
+		_add(std::move(f));
+		return *this;
+	}
+
+	ConfigSchema& Bool(const char* section, const char* key, bool T::* member, bool def)
+	{
+		Field f;
+		f.section = section;
+		f.key = key;
+		f.expected = "TRUE or FALSE";
+		f.parse = [member](T& cfg, const std::string& text)
+		{
+			if (text == "TRUE" || text == "true")
+				cfg.*member = true;
+			else if (text == "FALSE" || text == "false")
+				cfg.*member = false;
+			else
+				return false;
+			return true;
+		};
+		f.format = [member](const T& cfg) { return std::string(cfg.*member ? "TRUE" : "FALSE"); };
+		f.reset = [member, def](T& cfg) { cfg.*member = def; };
+		_add(std::move(f));
+		return *this;
+	}
+
+	// Quoted string, optionally restricted to a set of choices
+	ConfigSchema& Str(const char* section, const char* key, std::string T::* member, const std::string& def, std::vector<std::string> choices = {})
+	{
+		Field f;
+		f.section = section;
+		f.key = key;
+		f.expected = "a quoted string";
+		if (!choices.empty())
+		{
+			f.expected = "one of";
+			for (auto& c : choices)
+				f.expected += " \"" + c + "\"";
+		}
+		f.parse = [member, choices](T& cfg, const std::string& text)
+		{
+			if (text.length() < 2 || text.front() != '\"' || text.back() != '\"')
+				return false;
+			std::string val = text.substr(1, text.length() - 2);
+			if (!choices.empty() && std::find(choices.begin(), choices.end(), val) == choices.end())
+				return false;
+			cfg.*member = val;
+			return true;
+		};
+		f.format = [member](const T& cfg) { return "\"" + cfg.*member + "\""; };
+		f.reset = [member, def](T& cfg) { cfg.*member = def; };
+		_add(std::move(f));
+		return *this;
+	}
+
+	void Defaults(T& cfg) const
+	{
+		for (auto& f : _fields)
+			f.reset(cfg);
+	}
+
+	// Parses the file in one pass. Every invalid value is reported in errors (with its line) and
+	// left at its default. missingKeys is set when the file lacks keys and should be written back.
+	bool Load(const std::string& fileName, T& cfg, std::vector<std::string>& errors, bool& missingKeys) const
+	{
+		Defaults(cfg);
+		missingKeys = false;
+
+		std::ifstream file(fileName);
+		if (!file)
+		{
+			errors.push_back("cannot open " + fileName);
+			missingKeys = true;
+			return false;
+		}
+
+		std::vector<bool> seen(_fields.size(), false);
+		std::string line;
+		std::string section;
+		int lineNo = 0;
+		while (std::getline(file, line))
+		{
+			lineNo++;
+			if (lineNo == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+				line.erase(0, 3);
+
+			_stripComment(line);
+			line = _trim(line);
+			if (line.empty())
+				continue;
+
+			if (line.front() == '[')
+			{
+				size_t end = line.find(']');
+				section = _trim(line.substr(1, end == std::string::npos ? std::string::npos : end - 1));
+				continue;
+			}
+
+			size_t eq = line.find('=');
+			if (eq == std::string::npos)
+				continue;
+
+			std::string key = _trim(line.substr(0, eq));
+			auto it = _index.find(section + "." + key);
+			if (it == _index.end())
+				continue;	// Unknown keys are kept in the file but ignored
+
+			const Field& f = _fields[it->second];
+			seen[it->second] = true;
+			std::string value = _trim(line.substr(eq + 1));
+			if (!f.parse(cfg, value))
+			{
+				errors.push_back(fileName + ":" + std::to_string(lineNo) + ": " + f.section + "." + f.key
+					+ " = " + value + " is invalid, expected " + f.expected);
+			}
+		}
+
+		for (bool s : seen)
+			missingKeys |= !s;
+		return errors.empty();
+	}
+
+	// Adds missing keys with their current values, keeping comments and unknown keys of an existing file
+	bool SaveMissing(const std::string& fileName, const T& cfg) const
+	{
+		CConfigMgr cmgr;
+		cmgr.Load(fileName);
+		const std::string missing = ";";
+		for (auto& f : _fields)
+		{
+			if (cmgr.GetValue(f.section, f.key, missing) == missing)
+				cmgr.SetValue(f.section, f.key, f.format(cfg));
+		}
+		return cmgr.SaveAs(fileName);
+	}
+};
\ No newline at end of file
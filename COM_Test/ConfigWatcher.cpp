@@ -0,0 +1,74 @@
+#include <stdexcept>
+
+#include "ConfigWatcher.h"
+#include "Logger.h"
+
+ConfigWatcher::ConfigWatcher(const std::string& path, std::function<void()> onChange)
+	: _path(path)
+	, _onChange(onChange)
+	, _stopEvent(NULL)
+	, _lastWrite({ 0, 0 })
+{
+	_stopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (!_stopEvent)
+		throw std::runtime_error("ConfigWatcher: cannot create stop event.");
+
+	_getWriteTime(_lastWrite);
+	_thread = std::thread(&ConfigWatcher::_watch, this);
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+	SetEvent(_stopEvent);
+	if (_thread.joinable())
+		_thread.join();
+	CloseHandle(_stopEvent);
+}
+
+bool ConfigWatcher::_getWriteTime(FILETIME& time) const
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(_path.c_str(), GetFileExInfoStandard, &data))
+		return false;
+	time = data.ftLastWriteTime;
+	return true;
+}
+
+void ConfigWatcher::_watch()
+{
+	std::string dir = ".";
+	size_t slash = _path.find_last_of("/\\");
+	if (slash != std::string::npos)
+		dir = _path.substr(0, slash);
+
+	HANDLE change = FindFirstChangeNotificationA(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (change == INVALID_HANDLE_VALUE)
+	{
+		change = NULL;
+		appLog(Warning) << "ConfigWatcher: change notifications unavailable for " << dir << ", polling " << _path;
+	}
+	else
+		appLog(Info) << "ConfigWatcher: watching " << _path;
+
+	HANDLE handles[2] = { _stopEvent, change };
+	while (true)
+	{
+		DWORD res = WaitForMultipleObjects(change ? 2 : 1, handles, FALSE, POLL_INTERVAL_MS);
+		if (res == WAIT_OBJECT_0)
+			break;
+		if (change && res == WAIT_OBJECT_0 + 1)
+			FindNextChangeNotification(change);
+
+		FILETIME time;
+		if (!_getWriteTime(time) || CompareFileTime(&time, &_lastWrite) == 0)
+			continue;
+
+		if (WaitForSingleObject(_stopEvent, DEBOUNCE_MS) == WAIT_OBJECT_0)
+			break;
+		_getWriteTime(_lastWrite);
+		_onChange();
+	}
+
+	if (change)
+		FindCloseChangeNotification(change);
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <functional>
+
+#include <Windows.h>
+
+// Watches a file for modifications with a directory change notification, falling back
+// to polling its last write time. onChange is called on the watcher thread.
+class ConfigWatcher
+{
+private:
+	std::string				_path;
+	std::function<void()>	_onChange;
+	HANDLE					_stopEvent;
+	FILETIME				_lastWrite;
+	std::thread				_thread;
+
+	bool _getWriteTime(FILETIME& time) const;
+	void _watch();
+
+	static constexpr DWORD POLL_INTERVAL_MS = 1000;
+	static constexpr DWORD DEBOUNCE_MS = 200;		// Let editors finish writing before reloading
+
+	ConfigWatcher(const ConfigWatcher&) = delete;
+	ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+public:
+	ConfigWatcher(const std::string& path, std::function<void()> onChange);
+	~ConfigWatcher();
+};
\ No newline at end of file
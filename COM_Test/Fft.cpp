@@ -0,0 +1,107 @@
+#include <stdexcept>
+#include <cmath>
+
+#include "Fft.h"
+
+#ifdef APP_FFT_SSE
+#include <xmmintrin.h>
+#endif
+
+Fft::Fft(size_t size)
+	: _size(size)
+	, _bitReverse(size)
+	, _twiddleRe(size - 1)
+	, _twiddleIm(size - 1)
+	, _re(size)
+	, _im(size)
+{
+	if (size < 8 || (size & (size - 1)) != 0)
+		throw std::invalid_argument("Fft: size must be a power of two, at least 8");
+
+	unsigned bits = 0;
+	while ((size_t(1) << bits) < size)
+		bits++;
+	for (size_t i = 0; i < size; i++)
+	{
+		uint32_t r = 0;
+		for (unsigned b = 0; b < bits; b++)
+			r |= uint32_t((i >> b) & 1) << (bits - 1 - b);
+		_bitReverse[i] = r;
+	}
+
+	const double pi = 3.14159265358979323846;
+	for (size_t half = 1; half < size; half <<= 1)
+	{
+		for (size_t j = 0; j < half; j++)
+		{
+			double angle = -pi * double(j) / double(half);
+			_twiddleRe[half - 1 + j] = float(std::cos(angle));
+			_twiddleIm[half - 1 + j] = float(std::sin(angle));
+		}
+	}
+}
+
+void Fft::_transform()
+{
+	float* re = _re.data();
+	float* im = _im.data();
+
+	for (size_t half = 1; half < _size; half <<= 1)
+	{
+		const float* wr = _twiddleRe.data() + half - 1;
+		const float* wi = _twiddleIm.data() + half - 1;
+		for (size_t group = 0; group < _size; group += half * 2)
+		{
+			float* ar = re + group;
+			float* ai = im + group;
+			float* br = ar + half;
+			float* bi = ai + half;
+			size_t j = 0;
+#ifdef APP_FFT_SSE
+			for (; j + 4 <= half; j += 4)
+			{
+				__m128 vwr = _mm_loadu_ps(wr + j);
+				__m128 vwi = _mm_loadu_ps(wi + j);
+				__m128 vbr = _mm_loadu_ps(br + j);
+				__m128 vbi = _mm_loadu_ps(bi + j);
+				__m128 tr = _mm_sub_ps(_mm_mul_ps(vbr, vwr), _mm_mul_ps(vbi, vwi));
+				__m128 ti = _mm_add_ps(_mm_mul_ps(vbr, vwi), _mm_mul_ps(vbi, vwr));
+				__m128 var = _mm_loadu_ps(ar + j);
+				__m128 vai = _mm_loadu_ps(ai + j);
+				_mm_storeu_ps(ar + j, _mm_add_ps(var, tr));
+				_mm_storeu_ps(ai + j, _mm_add_ps(vai, ti));
+				_mm_storeu_ps(br + j, _mm_sub_ps(var, tr));
+				_mm_storeu_ps(bi + j, _mm_sub_ps(vai, ti));
+			}
+#endif
+			for (; j < half; j++)
+			{
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+}
+
+void Fft::PowerSpectrum(const float* input, float* power)
+{
+	for (size_t i = 0; i < _size; i++)
+	{
+		_re[_bitReverse[i]] = input[i];
+		_im[i] = 0.0f;
+	}
+
+	_transform();
+
+	for (size_t k = 0; k <= _size / 2; k++)
+		power[k] = _re[k] * _re[k] + _im[k] * _im[k];
+}
+
+size_t Fft::GetSize() const
+{
+	return _size;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define APP_FFT_SSE
+#endif
+
+// Radix-2 complex FFT over split real/imaginary arrays. Every butterfly stage with 4 or more
+// butterflies per group runs 4 lanes at a time with SSE, the first two stages are scalar.
+class Fft
+{
+private:
+	size_t				_size;
+	std::vector<uint32_t> _bitReverse;
+	std::vector<float>	_twiddleRe;		// Stage with half size h starts at index h - 1
+	std::vector<float>	_twiddleIm;
+	std::vector<float>	_re;
+	std::vector<float>	_im;
+
+	void _transform();
+
+public:
+	explicit Fft(size_t size);	// size must be a power of two, at least 8
+
+	// Forward transform of size real samples, writes |X[k]|^2 for k in [0, size / 2]
+	void PowerSpectrum(const float* input, float* power);
+	size_t GetSize() const;
+};
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+uint64_t LatencyHistogram::_bucketUpperBound(size_t bucket)
+{
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	uint64_t shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+	uint64_t sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const
+{
+	uint64_t total = GetCount();
+	if (total == 0)
+		return 0;
+
+	p = (std::min)((std::max)(p, 0.0), 1.0);
+	uint64_t rank = (std::max<uint64_t>)(1, uint64_t(p * total + 0.5));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKETS; i++)
+	{
+		seen += _counts[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return (std::min)(_bucketUpperBound(i), GetMax());
+	}
+	return GetMax();
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+	return _total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetMax() const
+{
+	return _max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetSum() const
+{
+	return _sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetMean() const
+{
+	uint64_t total = GetCount();
+	return total ? GetSum() / total : 0;
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto& count : _counts)
+		count.store(0, std::memory_order_relaxed);
+	_total = 0;
+	_sum = 0;
+	_max = 0;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Lock-free HDR-style histogram of nanosecond values. Buckets are log-linear: every power of
+// two is split into 16 linear sub-buckets, so any recorded value is reported within 6.25%.
+// Record() is wait-free and may be called from any thread, including the waveOut callback.
+class LatencyHistogram
+{
+private:
+	static constexpr int		SUB_BUCKET_BITS = 4;
+	static constexpr uint64_t	SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+	static constexpr size_t		BUCKETS = size_t(SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS);
+
+	std::atomic<uint64_t>	_counts[BUCKETS];
+	std::atomic<uint64_t>	_total;
+	std::atomic<uint64_t>	_sum;
+	std::atomic<uint64_t>	_max;
+
+	static inline int _msb(uint64_t v)
+	{
+		int n = 0;
+		if (v >> 32) { v >>= 32; n += 32; }
+		if (v >> 16) { v >>= 16; n += 16; }
+		if (v >> 8) { v >>= 8; n += 8; }
+		if (v >> 4) { v >>= 4; n += 4; }
+		if (v >> 2) { v >>= 2; n += 2; }
+		if (v >> 1) { n += 1; }
+		return n;
+	}
+
+	static inline size_t _bucketOf(uint64_t v)
+	{
+		if (v < SUB_BUCKETS)
+			return size_t(v);
+		int shift = _msb(v) - SUB_BUCKET_BITS;
+		return size_t(SUB_BUCKETS + uint64_t(shift) * SUB_BUCKETS + ((v >> shift) - SUB_BUCKETS));
+	}
+
+	static uint64_t _bucketUpperBound(size_t bucket);
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+public:
+	LatencyHistogram();
+
+	inline void Record(uint64_t ns)
+	{
+		_counts[_bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+		_total.fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t max = _max.load(std::memory_order_relaxed);
+		while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+			;
+	}
+
+	// Value at or below which the fraction p (0..1) of recorded values fall, 0 if empty
+	uint64_t Percentile(double p) const;
+	uint64_t GetCount() const;
+	uint64_t GetMax() const;
+	uint64_t GetSum() const;
+	uint64_t GetMean() const;
+	void Reset();
+};
\ No newline at end of file
@@ -3,10 +3,12 @@
 #include <iostream>
 #include <exception>
 #include <time.h>
-#include <sstream>
 #include <memory>
+#include <chrono>
 #include "Logger.h"
 #include "Utils.h"
+#include "Clock.h"
+#include <winioctl.h>
 
 namespace _____LOGGER
 {
@@ -123,12 +125,14 @@ namespace _____LOGGER
 			break;
 
 		case Type::File:
-			WriteFile(*_file, &str[0], DWORD(str.length()), &dw, NULL);
+			if (_file)
+				WriteFile(*_file, &str[0], DWORD(str.length()), &dw, NULL);
 			break;
 
 		case Type::FileAndConsole:
 			std::cout << str;
-			WriteFile(*_file, &str[0], DWORD(str.length()), &dw, NULL);
+			if (_file)
+				WriteFile(*_file, &str[0], DWORD(str.length()), &dw, NULL);
 			break;
 		}
 	}
@@ -202,47 +206,108 @@ namespace _____LOGGER
 		_file.reset();
 	}
 
-	std::recursive_mutex Logger::Writer::_writeMutex;
+	/****************
+	 *  THREAD QUEUE	*
+	 ****************/
+
+	// Single producer (the owning thread), single consumer (whoever holds _drainMutex) ring of records
+	class Logger::ThreadQueue
+	{
+	public:
+		alignas(64) std::atomic<size_t>	head;		// Consumer position
+		alignas(64) std::atomic<size_t>	tail;		// Producer position
+		alignas(64) std::atomic<bool>	abandoned;	// Owning thread has exited
+		Record							records[QUEUE_CAPACITY];
+
+		ThreadQueue() : head(0), tail(0), abandoned(false) {}
+
+		size_t freeSlots() const
+		{
+			return QUEUE_CAPACITY - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+		}
+
+		bool empty() const
+		{
+			return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+		}
+	};
 
-	std::string _generateTimeStamp()
+	struct ThreadQueueHandle
 	{
-		char date[64];
-		time_t t = time(0);
-		struct tm tm;
+		Logger*					logger = nullptr;
+		Logger::ThreadQueue*	queue = nullptr;
 
-		gmtime_s(&tm, &t);
-		strftime(date, sizeof(date), "[%d.%m.%Y|%H:%M:%S]", &tm);
-		return date;
+		~ThreadQueueHandle()
+		{
+			if (queue)
+				queue->abandoned.store(true, std::memory_order_release);
+		}
+	};
+
+	static thread_local ThreadQueueHandle	tls_queue;
+
+	// Line buffers reused by Writers of this thread, indexed by nesting depth
+	static constexpr int					MAX_WRITER_DEPTH = 4;
+	static thread_local std::string			tls_lineBuffers[MAX_WRITER_DEPTH];
+	static thread_local int					tls_writerDepth = 0;
+
+	static const char* _baseName(const char* path)
+	{
+		const char* base = path;
+		for (const char* p = path; *p; p++)
+		{
+			if (*p == '/' || *p == '\\')
+				base = p + 1;
+		}
+		return base;
 	}
 
 	/****************
 	 *	  LOGGER	*
 	 ****************/
 
+	Logger* Logger::_instance = nullptr;
+	LPTOP_LEVEL_EXCEPTION_FILTER Logger::_prevExceptionFilter = nullptr;
+	std::terminate_handler Logger::_prevTerminate = nullptr;
+
 	Logger::Logger(OutputInterface::Type outType, std::string fileName) :
-		OutputInterface
-		(outType
-			, NewLineType::CRLF
-			, fileName
-		)
-		, _level(Level::Info)
+		OutputInterface(outType, NewLineType::CRLF, FileMode::CreateAlways)
 		, _minLevel(Level::Debug)
-		, _file("None")
-		, _line(0)
-		, _func("?")
-		, _buffer("")
+		, _overflowPolicy(OverflowPolicy::Drop)
 		, _logFileName(fileName)
-		, _doNotAppendSpaces(false)
+		, _dropped(0)
+		, _droppedReported(0)
+		, _stopWriter(false)
+		, _logOpened(false)
+		, _rotateFailed(false)
+		, _writerRunning(false)
+		, _lastDrainUs(0)
+		, _lastStampTime(0)
+		, _rotation({ 0, 0, DEFAULT_RETENTION, false })
+		, _fileBytes(0)
+		, _fileOpenedAt(time(0))
+		, _stopCompressor(false)
 	{
+		_instance = this;
+		_prevExceptionFilter = SetUnhandledExceptionFilter(&Logger::_crashFilter);
+		_prevTerminate = std::set_terminate(&Logger::_crashTerminate);
 	}
 
 	Logger::~Logger()
 	{
+		Stop();
+
+		if (_instance == this)
+		{
+			SetUnhandledExceptionFilter(_prevExceptionFilter);
+			std::set_terminate(_prevTerminate);
+			_instance = nullptr;
+		}
 	}
 
-	std::string Logger::_levelToString()
+	const char* Logger::_levelToString(Level level)
 	{
-		switch (_level)
+		switch (level)
 		{
 		case Level::Debug:
 			return "Debug";
@@ -264,25 +329,359 @@ namespace _____LOGGER
 		}
 	}
 
-	void Logger::_toOutput(const std::string& str)
+	Logger::ThreadQueue* Logger::_threadQueue()
+	{
+		if (tls_queue.logger == this)
+			return tls_queue.queue;
+
+		// First record of this thread (fast path assumes one logger per thread)
+		if (tls_queue.queue)
+			tls_queue.queue->abandoned.store(true, std::memory_order_release);
+
+		std::unique_ptr<ThreadQueue> queue(new ThreadQueue);
+		tls_queue.logger = this;
+		tls_queue.queue = queue.get();
+		std::lock_guard<std::mutex> lock(_queuesMutex);
+		_queues.push_back(std::move(queue));
+		return tls_queue.queue;
+	}
+
+	void Logger::_push(const Record& header, const std::string& text)
+	{
+		ThreadQueue* queue = _threadQueue();
+		size_t count = (text.length() + RECORD_TEXT_SIZE - 1) / RECORD_TEXT_SIZE;
+		if (count == 0)
+			count = 1;
+		if (count > QUEUE_CAPACITY)
+			count = QUEUE_CAPACITY;
+
+		bool mustDeliver = header.level >= Level::Critical || _overflowPolicy.load(std::memory_order_relaxed) == OverflowPolicy::Block;
+		while (queue->freeSlots() < count)
+		{
+			if (!mustDeliver)
+			{
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			// Without a writer, e.g. before Start, the thread makes room itself
+			if (!_writerRunning.load(std::memory_order_acquire) && _drainMutex.try_lock())
+			{
+				_drain();
+				_drainMutex.unlock();
+				continue;
+			}
+			_wake.notify_one();
+			std::this_thread::yield();
+		}
+
+		size_t tail = queue->tail.load(std::memory_order_relaxed);
+		size_t offset = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			Record& rec = queue->records[(tail + i) & (QUEUE_CAPACITY - 1)];
+			size_t len = text.length() - offset;
+			if (len > RECORD_TEXT_SIZE)
+				len = RECORD_TEXT_SIZE;
+
+			rec.time = header.time;
+			rec.file = header.file;
+			rec.func = header.func;
+			rec.line = header.line;
+			rec.level = header.level;
+			rec.length = uint16_t(len);
+			rec.continued = (i + 1 < count);
+			memcpy(rec.text, text.data() + offset, len);
+			offset += len;
+		}
+		queue->tail.store(tail + count, std::memory_order_release);
+
+		if (header.level >= Level::Critical)
+			Flush();
+	}
+
+	void Logger::_format(const Record& rec)
+	{
+		if (rec.time != _lastStampTime || _lastStamp.empty())
+		{
+			char date[64];
+			struct tm tm;
+			gmtime_s(&tm, &rec.time);
+			strftime(date, sizeof(date), "[%d.%m.%Y|%H:%M:%S]", &tm);
+			_lastStamp = date;
+			_lastStampTime = rec.time;
+		}
+
+		_batch += _lastStamp;
+		_batch += "[";
+		_batch += _baseName(rec.file);
+		_batch += ":";
+		_batch += std::to_string(rec.line);
+		_batch += " (";
+		_batch += rec.func;
+		_batch += ")] [";
+		_batch += _levelToString(rec.level);
+		_batch += "]:\t";
+	}
+
+	bool Logger::_drain()
+	{
+		if (!_logOpened)
+			_openLog();
+
+		_drainList.clear();
+		{
+			std::lock_guard<std::mutex> lock(_queuesMutex);
+			for (auto& queue : _queues)
+				_drainList.push_back(queue.get());
+		}
+
+		bool any = false;
+		for (ThreadQueue* queue : _drainList)
+		{
+			size_t head = queue->head.load(std::memory_order_relaxed);
+			size_t tail = queue->tail.load(std::memory_order_acquire);
+			bool midRecord = false;
+			for (; head != tail; head++)
+			{
+				const Record& rec = queue->records[head & (QUEUE_CAPACITY - 1)];
+				if (!midRecord)
+					_format(rec);
+				_batch.append(rec.text, rec.length);
+				midRecord = rec.continued;
+				if (!midRecord)
+					_batch += _nl;
+			}
+			if (queue->head.load(std::memory_order_relaxed) != tail)
+				any = true;
+			queue->head.store(tail, std::memory_order_release);
+		}
+
+		size_t dropped = _dropped.load(std::memory_order_relaxed);
+		if (dropped != _droppedReported)
+		{
+			_batch += "[Logger] " + std::to_string(dropped - _droppedReported) + " records dropped, queue overflow" + _nl;
+			_droppedReported = dropped;
+		}
+
+		if (!_batch.empty())
+		{
+			OutputInterface::_toOutput(_batch);
+			if (_type == Type::File || _type == Type::FileAndConsole)
+				_fileBytes += _batch.size();
+			_batch.clear();
+		}
+
+		if (_file && _fileBytes > 0)
+		{
+			bool tooBig = _rotation.maxSizeBytes && _fileBytes >= _rotation.maxSizeBytes;
+			bool tooOld = _rotation.maxAgeSec && time(0) - _fileOpenedAt >= _rotation.maxAgeSec;
+			if (tooBig || tooOld)
+				_rotate();
+		}
+
+		// Forget queues of exited threads once they are drained
+		{
+			std::lock_guard<std::mutex> lock(_queuesMutex);
+			for (size_t i = 0; i < _queues.size();)
+			{
+				if (_queues[i]->abandoned.load(std::memory_order_acquire) && _queues[i]->empty())
+					_queues.erase(_queues.begin() + i);
+				else
+					i++;
+			}
+		}
+
+		return any;
+	}
+
+	// No profiler or metrics calls here: the writer outlives neither, the metrics exporter reads _lastDrainUs
+	void Logger::_writerLoop()
+	{
+		std::unique_lock<std::mutex> wakeLock(_wakeMutex);
+		while (!_stopWriter)
+		{
+			wakeLock.unlock();
+			{
+				std::lock_guard<std::mutex> lock(_drainMutex);
+				uint64_t start = Clock::NowNs();
+				if (_drain())
+					_lastDrainUs.store((Clock::NowNs() - start) / 1000, std::memory_order_relaxed);
+			}
+			wakeLock.lock();
+			if (!_stopWriter)
+				_wake.wait_for(wakeLock, std::chrono::milliseconds(WRITER_INTERVAL_MS));
+		}
+	}
+
+	void Logger::_reopen()
+	{
+		std::lock_guard<std::mutex> lock(_drainMutex);
+		_drain();
+		SetOutputFile(_logFileName);
+		_fileBytes = 0;
+		_fileOpenedAt = time(0);
+	}
+
+	std::string Logger::_rotatedName(const std::string& fileName, int index)
+	{
+		// app.log -> app.1.log
+		size_t dot = fileName.find_last_of('.');
+		size_t slash = fileName.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return fileName + "." + std::to_string(index);
+		return fileName.substr(0, dot) + "." + std::to_string(index) + fileName.substr(dot);
+	}
+
+	// The file is opened on the first drain, so the startup rotation uses the configured retention
+	void Logger::_openLog()
+	{
+		_logOpened = true;
+		if (_type == Type::File || _type == Type::FileAndConsole)
+			_rotate();
+	}
+
+	// Called with _drainMutex held, producers keep queueing meanwhile. Also keeps the previous run's log on startup.
+	void Logger::_rotate()
+	{
+		Close();
+		bool shifted = false;
+		if (_rotation.retention > 0 && Utils::fileExists(_logFileName))
+		{
+			DeleteFileA(_rotatedName(_logFileName, _rotation.retention).c_str());
+			for (int i = _rotation.retention - 1; i >= 1; i--)
+				MoveFileExA(_rotatedName(_logFileName, i).c_str(), _rotatedName(_logFileName, i + 1).c_str(), MOVEFILE_REPLACE_EXISTING);
+			shifted = MoveFileExA(_logFileName.c_str(), _rotatedName(_logFileName, 1).c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+		}
+
+		// Runs on the writer thread, a locked or full disk must not end the process
+		try
+		{
+			SetOutputFile(_logFileName);
+			_rotateFailed = false;
+			if (shifted && _rotation.compress)
+			{
+				{
+					std::lock_guard<std::mutex> lock(_compressMutex);
+					_compressQueue.push_back(_rotatedName(_logFileName, 1));
+				}
+				_compressWake.notify_one();
+			}
+		}
+		catch (const std::exception& ex)
+		{
+			// Keep appending to the previous file, the next rotation retries
+			std::string previous = shifted ? _rotatedName(_logFileName, 1) : _logFileName;
+			HANDLE hFile = CreateFileA(previous.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (hFile != INVALID_HANDLE_VALUE)
+				_file = std::shared_ptr<WinHandle>(new WinHandle(hFile));
+			if (!_rotateFailed)
+			{
+				std::string msg = "[Logger] " + std::string(ex.what()) + " Error " + std::to_string(GetLastError())
+					+ (_file ? ", continuing in " + previous : ", records are discarded until the next rotation") + _nl;
+				std::cerr << msg;
+				OutputInterface::_toOutput(msg);
+				_rotateFailed = true;
+			}
+		}
+		_fileBytes = 0;
+		_fileOpenedAt = time(0);
+	}
+
+	void Logger::_pruneRotated()
 	{
-		_buffer += str;
-		if (!_doNotAppendSpaces)
-			_buffer += " ";
+		for (int i = _rotation.retention + 1; i <= MAX_RETENTION; i++)
+			DeleteFileA(_rotatedName(_logFileName, i).c_str());
 	}
 
-	void Logger::_write()
+	void Logger::_compressLoop()
 	{
-		if (_buffer != "")
+		std::unique_lock<std::mutex> lock(_compressMutex);
+		while (true)
 		{
-			if (_level >= _minLevel)
+			_compressWake.wait(lock, [this] { return _stopCompressor || !_compressQueue.empty(); });
+			if (_compressQueue.empty())
+				break;
+
+			std::vector<std::string> files;
+			files.swap(_compressQueue);
+			lock.unlock();
+
+			for (auto& file : files)
 			{
-				std::ostringstream ss;
-				ss << _generateTimeStamp() << "[" << _file << ":" << _line << " (" << _func << ")] [" << _levelToString() << "]:\t" << _buffer << _nl;
-				OutputInterface::_toOutput(ss.str());
+				// Transparent NTFS compression keeps rotated logs readable by any tool
+				HANDLE hFile = CreateFileA(file.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+					NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+				if (hFile == INVALID_HANDLE_VALUE)
+					continue;
+				USHORT format = COMPRESSION_FORMAT_DEFAULT;
+				DWORD dw = 0;
+				DeviceIoControl(hFile, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &dw, NULL);
+				CloseHandle(hFile);
 			}
-			_buffer = "";
+
+			lock.lock();
+		}
+	}
+
+	void Logger::Start()
+	{
+		if (_writerRunning.load())
+			return;
+		_stopWriter = false;
+		_stopCompressor = false;
+		_writerThread = std::thread(&Logger::_writerLoop, this);
+		_compressThread = std::thread(&Logger::_compressLoop, this);
+		_writerRunning = true;
+	}
+
+	void Logger::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_wakeMutex);
+			_stopWriter = true;
+		}
+		_wake.notify_one();
+		if (_writerThread.joinable())
+			_writerThread.join();
+		_writerRunning = false;
+		Flush();
+
+		{
+			std::lock_guard<std::mutex> lock(_compressMutex);
+			_stopCompressor = true;
+		}
+		_compressWake.notify_one();
+		if (_compressThread.joinable())
+			_compressThread.join();
+	}
+
+	void Logger::Flush()
+	{
+		std::lock_guard<std::mutex> lock(_drainMutex);
+		_drain();
+	}
+
+	LONG WINAPI Logger::_crashFilter(EXCEPTION_POINTERS* info)
+	{
+		// try_lock: the crash may have happened while this thread was draining
+		if (_instance && _instance->_drainMutex.try_lock())
+		{
+			_instance->_drain();
+			_instance->_drainMutex.unlock();
+		}
+		return _prevExceptionFilter ? _prevExceptionFilter(info) : EXCEPTION_CONTINUE_SEARCH;
+	}
+
+	void Logger::_crashTerminate()
+	{
+		if (_instance && _instance->_drainMutex.try_lock())
+		{
+			_instance->_drain();
+			_instance->_drainMutex.unlock();
 		}
+		if (_prevTerminate)
+			_prevTerminate();
+		abort();
 	}
 
 	void Logger::level(Level lvl)
@@ -290,61 +689,153 @@ namespace _____LOGGER
 		_minLevel = lvl;
 	}
 
+	void Logger::overflowPolicy(OverflowPolicy policy)
+	{
+		_overflowPolicy = policy;
+	}
+
+	Logger::OverflowPolicy Logger::overflowPolicy() const
+	{
+		return _overflowPolicy.load();
+	}
+
+	void Logger::rotation(const RotationSettings& settings)
+	{
+		std::lock_guard<std::mutex> lock(_drainMutex);
+		_rotation = settings;
+		if (_rotation.retention < 0)
+			_rotation.retention = 0;
+		if (_rotation.retention > MAX_RETENTION)
+			_rotation.retention = MAX_RETENTION;
+		_pruneRotated();
+	}
+
+	void Logger::outputType(Type type)
+	{
+		std::lock_guard<std::mutex> lock(_drainMutex);
+		_drain();
+		_type = type;
+	}
+
+	OutputInterface::Type Logger::outputType() const
+	{
+		return _type;
+	}
+
+	size_t Logger::GetDroppedRecords() const
+	{
+		return _dropped.load(std::memory_order_relaxed);
+	}
+
+	uint64_t Logger::GetWriterLatencyUs() const
+	{
+		return _lastDrainUs.load(std::memory_order_relaxed);
+	}
+
 	/****************
 	 *	  WRITER	*
 	 ****************/
 
-	Logger::Writer::Writer(std::string file, const std::string& func, int line, Level level, Logger& logger) : _logger(&logger)
+	Logger::Writer::Writer(const char* file, const char* func, int line, Level level, Logger& logger)
+		: _logger(&logger)
+		, _buffer(nullptr)
+		, _file(file)
+		, _func(func)
+		, _line(line)
+		, _level(level)
+		, _noSpaces(false)
 	{
-		_writeMutex.lock();
-
 		if (level == Logger::Level::Clear)
 		{
-			logger.SetOutputFile(__logFileName);
+			logger._reopen();
 			return;
 		}
 
-		if (file.find("/") != std::string::npos)
-			logger._file = file.substr(file.find_last_of("/") + 1, file.length() - 1);
-		else if (file.find("\\") != std::string::npos)
-			logger._file = file.substr(file.find_last_of("\\") + 1, file.length() - 1);
-		else
-			logger._file = file;
-		logger._line = line;
-		logger._func = func;
-		logger._level = level;
+		int depth = tls_writerDepth < MAX_WRITER_DEPTH ? tls_writerDepth : MAX_WRITER_DEPTH - 1;
+		tls_writerDepth++;
+		_buffer = &tls_lineBuffers[depth];
+		_buffer->clear();
 	}
 
 	Logger::Writer::~Writer()
 	{
-		_logger->_write();
-		_writeMutex.unlock();
+		if (!_buffer)
+			return;
+
+		tls_writerDepth--;
+		if (_buffer->empty() || _level < _logger->_minLevel.load(std::memory_order_relaxed))
+			return;
+
+		Record header;
+		header.time = time(0);
+		header.file = _file;
+		header.func = _func;
+		header.line = _line;
+		header.level = _level;
+		_logger->_push(header, *_buffer);
+	}
+
+	void Logger::Writer::_append(const std::string& str)
+	{
+		if (!_buffer)
+			return;
+
+		*_buffer += str;
+		if (!_noSpaces)
+			*_buffer += " ";
 	}
 
 	Logger::Writer& Logger::Writer::operator<<(const std::string& str)
 	{
-		_logger->_toOutput(str);
+		_append(str);
 		return *this;
 	}
 
+	Logger::Writer& Logger::Writer::operator<<(const char* str)
+	{
+		if (!_buffer)
+			return *this;
+
+		*_buffer += str;
+		if (!_noSpaces)
+			*_buffer += ' ';
+		return *this;
+	}
+
+	void Logger::Writer::_copyLiteral(const char*& fmt)
+	{
+		if ((fmt[0] == '{' && fmt[1] == '{') || (fmt[0] == '}' && fmt[1] == '}'))
+		{
+			*_buffer += fmt[0];
+			fmt += 2;
+			return;
+		}
+
+		const char* end = fmt + 1;
+		while (*end && *end != '{' && *end != '}')
+			end++;
+		_buffer->append(fmt, end);
+		fmt = end;
+	}
+
 	Logger::Writer& Logger::Writer::operator<<(const NewLine&)
 	{
-		_logger->_toOutput(_logger->_nl);
+		_append(_logger->_nl);
 		return *this;
 	}
 
 	Logger::Writer& Logger::Writer::operator<<(const std::vector<std::string>& strings)
 	{
-		_logger->_doNotAppendSpaces = true;
-		_logger->_toOutput("{ ");
+		_noSpaces = true;
+		_append("{ ");
 		for (size_t i = 0; i < strings.size(); i++)
 		{
-			_logger->_toOutput("\"" + strings[i] + "\"");
+			_append("\"" + strings[i] + "\"");
 			if (i != strings.size() - 1)
-				_logger->_toOutput(", ");
+				_append(", ");
 		}
-		_logger->_toOutput(" }");
-		_logger->_doNotAppendSpaces = false;
+		_append(" }");
+		_noSpaces = false;
 		return *this;
 	}
 
@@ -4,10 +4,21 @@
 #include <memory>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <exception>
 #include <type_traits>
+#include <ctime>
+#include <charconv>
 
 #include <Windows.h>
 
+// Statements below this level are compiled out, e.g. /DAPP_LOG_COMPILE_LEVEL=Info
+#ifndef APP_LOG_COMPILE_LEVEL
+#define APP_LOG_COMPILE_LEVEL Debug
+#endif
+
 namespace _____LOGGER
 {
 	const char __logFileName[] = "app.log";
@@ -96,55 +107,201 @@ namespace _____LOGGER
 			Fatal
 		};
 
+		enum class OverflowPolicy
+		{
+			Drop,	// Records below Critical are dropped and counted when the thread queue is full
+			Block	// The logging thread waits for the background writer, or drains itself before Start
+		};
+
+		struct RotationSettings
+		{
+			uint64_t	maxSizeBytes;	// Rotate when the log grows beyond this size, 0 = no limit
+			int			maxAgeSec;		// Rotate when the log is older than this, 0 = no limit
+			int			retention;		// Number of rotated files kept (app.1.log ... app.N.log)
+			bool		compress;		// NTFS-compress rotated files on a background thread
+		};
+
+		static constexpr size_t RECORD_TEXT_SIZE = 192;
+		static constexpr size_t QUEUE_CAPACITY = 512;		// Records per thread, power of two
+		static constexpr int WRITER_INTERVAL_MS = 20;
+		static constexpr int DEFAULT_RETENTION = 5;		// Until APP_LOG_ROTATION applies the configured value
+		static constexpr int MAX_RETENTION = 100;
+
+		// Compact log record. Messages longer than RECORD_TEXT_SIZE span several consecutive records.
+		struct Record
+		{
+			time_t			time;
+			const char*		file;
+			const char*		func;
+			int				line;
+			Level			level;
+			uint16_t		length;
+			bool			continued;
+			char			text[RECORD_TEXT_SIZE];
+		};
+
+		class ThreadQueue;
+
 		class Writer
 		{
 		private:
-			Logger* _logger;
-			static std::recursive_mutex		_writeMutex;
+			Logger*			_logger;
+			std::string*	_buffer;
+			const char*		_file;
+			const char*		_func;
+			int				_line;
+			Level			_level;
+			bool			_noSpaces;
 
 			Writer(const Writer&) = delete;
 			Writer& operator=(const Writer&) = delete;
 
+			void _append(const std::string& str);
+
 		public:
-			Writer(std::string file, const std::string& func, int line, Level level, Logger& logger);
+			Writer(const char* file, const char* func, int line, Level level, Logger& logger);
 			~Writer();
 
 			Writer& operator<<(const std::string& str);
+			Writer& operator<<(const char* str);
 			template<typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
 			inline Writer& operator<<(T n)
 			{
-				if (std::is_same<T, char>::value)
-					_logger->_toOutput(std::string({ char(n) }));
-				else if (std::is_same<T, unsigned char>::value)
-				{
-					char buf[8] = { '\0' };
-					sprintf_s(buf, sizeof(buf), "0x%X", uint8_t(n));
-					std::string str(buf);
-					_logger->_toOutput(str);
-				}
-				else
-					_logger->_toOutput(std::to_string(n));
+				if (!_buffer)
+					return *this;
+				_appendValue(*_buffer, n);
+				if (!_noSpaces)
+					*_buffer += ' ';
 				return *this;
 			}
 			Writer& operator<<(const NewLine&);
 			Writer& operator<<(const std::vector<std::string>& strings);
+
+			// Type-safe formatting: each "{}" in fmt is replaced by the next argument, "{{" and "}}" are literal braces.
+			// Arguments are written straight into the thread's line buffer without temporary strings.
+			template<typename... Args>
+			Writer& format(const char* fmt, const Args&... args)
+			{
+				if (!_buffer)
+					return *this;
+				_format(fmt, args...);
+				while (*fmt)
+					_copyLiteral(fmt);
+				return *this;
+			}
+
+		private:
+			void _copyLiteral(const char*& fmt);
+
+			void _format(const char*& fmt) {}
+
+			template<typename T, typename... Args>
+			void _format(const char*& fmt, const T& arg, const Args&... args)
+			{
+				while (*fmt)
+				{
+					if (fmt[0] == '{' && fmt[1] == '}')
+					{
+						fmt += 2;
+						_appendValue(*_buffer, arg);
+						_format(fmt, args...);
+						return;
+					}
+					_copyLiteral(fmt);
+				}
+			}
+
+			static void _appendValue(std::string& out, const std::string& str) { out += str; }
+			static void _appendValue(std::string& out, const char* str) { out += str; }
+			static void _appendValue(std::string& out, char c) { out += c; }
+			static void _appendValue(std::string& out, unsigned char n)
+			{
+				char buf[8] = { '\0' };
+				sprintf_s(buf, sizeof(buf), "0x%X", uint8_t(n));
+				out += buf;
+			}
+			static void _appendValue(std::string& out, bool b) { out += b ? '1' : '0'; }
+
+			template<typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+			static void _appendValue(std::string& out, T n)
+			{
+				char buf[24];
+				auto res = std::to_chars(buf, buf + sizeof(buf), n);
+				out.append(buf, res.ptr);
+			}
+
+			template<typename T, std::enable_if_t<std::is_floating_point_v<T>, int> = 0>
+			static void _appendValue(std::string& out, T n)
+			{
+				char buf[64];
+				int len = snprintf(buf, sizeof(buf), "%f", double(n));
+				if (len > 0)
+					out.append(buf, len < int(sizeof(buf)) ? len : sizeof(buf) - 1);
+			}
+
+			template<typename T, std::enable_if_t<std::is_pointer_v<T> && !std::is_same_v<std::decay_t<T>, const char*> && !std::is_same_v<std::decay_t<T>, char*>, int> = 0>
+			static void _appendValue(std::string& out, T ptr)
+			{
+				char buf[24];
+				sprintf_s(buf, sizeof(buf), "%p", (const void*)ptr);
+				out += buf;
+			}
+
+		public:
 		};
 
 		friend class Writer;
 
 	protected:
-		Level			_level;
-		Level			_minLevel;
-		std::string		_file;
-		int				_line;
-		std::string		_func;
-		std::string		_buffer;
-		std::string		_logFileName;
-		bool			_doNotAppendSpaces;
-
-		virtual void	_toOutput(const std::string& str) override;
-		std::string		_levelToString();
-		void			_write();
+		std::atomic<Level>							_minLevel;
+		std::atomic<OverflowPolicy>					_overflowPolicy;
+		std::string									_logFileName;
+		std::mutex									_queuesMutex;
+		std::vector<std::unique_ptr<ThreadQueue>>	_queues;
+		std::mutex									_drainMutex;
+		std::vector<ThreadQueue*>					_drainList;
+		std::string									_batch;
+		std::atomic<size_t>							_dropped;
+		size_t										_droppedReported;
+		std::mutex									_wakeMutex;
+		std::condition_variable						_wake;
+		bool										_stopWriter;
+		bool										_logOpened;
+		bool										_rotateFailed;	// Reported once until a reopen succeeds
+		std::atomic<bool>							_writerRunning;
+		std::atomic<uint64_t>						_lastDrainUs;
+		std::thread									_writerThread;
+		time_t										_lastStampTime;
+		std::string									_lastStamp;
+		RotationSettings							_rotation;
+		uint64_t									_fileBytes;
+		time_t										_fileOpenedAt;
+		std::mutex									_compressMutex;
+		std::condition_variable						_compressWake;
+		std::vector<std::string>					_compressQueue;
+		bool										_stopCompressor;
+		std::thread									_compressThread;
+
+		static Logger*								_instance;
+		static LPTOP_LEVEL_EXCEPTION_FILTER			_prevExceptionFilter;
+		static std::terminate_handler				_prevTerminate;
+
+		ThreadQueue*	_threadQueue();
+		void			_push(const Record& header, const std::string& text);
+		bool			_drain();
+		void			_format(const Record& rec);
+		void			_writerLoop();
+		void			_reopen();
+		void			_openLog();
+		void			_rotate();
+		void			_pruneRotated();
+		void			_compressLoop();
+
+		static std::string	_rotatedName(const std::string& fileName, int index);
+
+		static const char*	_levelToString(Level level);
+		static LONG WINAPI	_crashFilter(EXCEPTION_POINTERS* info);
+		static void			_crashTerminate();
 
 	private:
 		Logger(const Logger&) = delete;
@@ -155,6 +312,26 @@ namespace _____LOGGER
 		~Logger();
 
 		void level(Level lvl);
+		inline bool enabled(Level lvl) const
+		{
+			return lvl == Level::Clear || lvl >= _minLevel.load(std::memory_order_relaxed);
+		}
+		static constexpr bool CompiledIn(Level lvl)
+		{
+			return lvl == Level::Clear || lvl >= Level::APP_LOG_COMPILE_LEVEL;
+		}
+		void overflowPolicy(OverflowPolicy policy);
+		OverflowPolicy overflowPolicy() const;
+		void rotation(const RotationSettings& settings);
+		// Records queued so far go to the old output, the log file stays open while another type is set
+		void outputType(Type type);
+		Type outputType() const;
+		// Background writer and compressor. Records queue up until Start, Stop writes out what is left.
+		void Start();
+		void Stop();
+		void Flush();
+		size_t GetDroppedRecords() const;
+		uint64_t GetWriterLatencyUs() const;	// Duration of the writer's last non-empty batch
 	};
 
 #ifdef _LOGGER_MAIN_CPP
@@ -168,4 +345,13 @@ namespace _____LOGGER
 
 #define LOGLVL(lvl)			_____LOGGER::Logger::Level::lvl
 #define APP_LOG_LEVEL(lvl) _____LOGGER::___Logger.level(lvl)
-#define appLog(lvl) _____LOGGER::Logger::Writer(__FILE__, __FUNCTION__, __LINE__, _____LOGGER::Logger::Level::lvl, _____LOGGER::___Logger)
\ No newline at end of file
+#define APP_LOG_OVERFLOW(policy) _____LOGGER::___Logger.overflowPolicy(_____LOGGER::Logger::OverflowPolicy::policy)
+#define APP_LOG_ROTATION(settings) _____LOGGER::___Logger.rotation(settings)
+#define APP_LOG_FLUSH() _____LOGGER::___Logger.Flush()
+#define APP_LOG_START() _____LOGGER::___Logger.Start()
+#define APP_LOG_STOP() _____LOGGER::___Logger.Stop()
+// Arguments are not evaluated at all when the level is filtered out at compile time or runtime
+#define appLog(lvl) \
+	if (!_____LOGGER::Logger::CompiledIn(LOGLVL(lvl)) || !_____LOGGER::___Logger.enabled(LOGLVL(lvl))) {} \
+	else _____LOGGER::Logger::Writer(__FILE__, __FUNCTION__, __LINE__, LOGLVL(lvl), _____LOGGER::___Logger)
+#define appLogf(lvl, ...) appLog(lvl).format(__VA_ARGS__)
\ No newline at end of file
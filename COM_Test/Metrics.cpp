@@ -0,0 +1,292 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <sstream>
+#include <fstream>
+
+#include "Metrics.h"
+#include "Logger.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace _____METRICS
+{
+	struct MetricInfo
+	{
+		const char*	name;
+		const char*	rateName;	// Per-second gauge derived from a counter, nullptr = none
+		const char*	help;
+	};
+
+	static const MetricInfo COUNTERS[] =
+	{
+		{ "sas_serial_bytes_total",				"sas_serial_bytes_per_second",	"Bytes read from the serial port" },
+		{ "sas_serial_reads_total",				"sas_serial_reads_per_second",	"Serial read calls" },
+		{ "sas_samples_total",					"sas_samples_per_second",		"Samples captured, the per-second rate is the observed sample rate" },
+		{ "sas_dropped_bytes_total",			"sas_dropped_bytes_per_second",	"Bytes dropped because the sample block pool was exhausted" },
+		{ "sas_pool_overflow_blocks_total",		nullptr,						"Sample blocks allocated from the heap because the pool was empty" },
+		{ "sas_playback_underruns_total",		nullptr,						"Times waveOut ran out of queued segments" },
+		{ "sas_clipped_samples_total",			nullptr,						"Samples at either end of the 16-bit range" },
+		{ "sas_serial_overruns_total",			nullptr,						"Serial reads after which the UART or driver queue had lost bytes" },
+		{ "sas_serial_line_errors_total",		nullptr,						"Serial reads after which framing, parity or break errors were reported" },
+		{ "sas_flow_control_pauses_total",		nullptr,						"Times RTS was deasserted because the playback queue passed the high watermark" },
+	};
+
+	static const MetricInfo GAUGES[] =
+	{
+		{ "sas_calibrated_sample_rate_hz",		nullptr,	"Sample rate measured at startup" },
+		{ "sas_playback_queue_segments",		nullptr,	"Segments queued to waveOut" },
+		{ "sas_pool_blocks_in_use",				nullptr,	"Sample blocks acquired from the pool" },
+		{ "sas_log_writer_latency_us",			nullptr,	"Time the log writer took for its last batch" },
+		{ "sas_input_peak",						nullptr,	"Peak absolute sample over the last analysis interval, full scale 32768" },
+		{ "sas_input_rms",						nullptr,	"RMS over the last analysis interval, full scale 32768" },
+		{ "sas_dominant_frequency_hz",			nullptr,	"Strongest spectrum bin above DC over the last analysis interval" },
+	};
+
+	static const MetricInfo LATENCIES[] =
+	{
+		{ "sas_latency_read_to_process_seconds",	nullptr,	"First byte of a block read from the serial port until gain is applied" },
+		{ "sas_latency_process_to_sink_seconds",	nullptr,	"Gain applied until the block is handed to its sink" },
+		{ "sas_latency_sink_to_done_seconds",		nullptr,	"Block queued to waveOut until playback completed" },
+		{ "sas_latency_end_to_end_seconds",			nullptr,	"First byte of a block read from the serial port until playback completed" },
+	};
+
+	static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	static_assert(sizeof(COUNTERS) / sizeof(COUNTERS[0]) == size_t(Counter::Count), "Counter descriptions out of sync");
+	static_assert(sizeof(GAUGES) / sizeof(GAUGES[0]) == size_t(Gauge::Count), "Gauge descriptions out of sync");
+	static_assert(sizeof(LATENCIES) / sizeof(LATENCIES[0]) == size_t(Latency::Count), "Latency descriptions out of sync");
+
+	constexpr int RATE_TICK_MS = 1000;
+	constexpr int POLL_MS = 100;
+	constexpr int ACCEPT_TIMEOUT_MS = 500;
+
+	MetricsRegistry::MetricsRegistry()
+		: _settings({ false, 0, "", 0 })
+		, _running(false)
+		, _listenSocket(uintptr_t(INVALID_SOCKET))
+	{
+		for (auto& c : _counters)
+			c.value = 0;
+		for (auto& g : _gauges)
+			g.value = 0;
+		for (auto& r : _rates)
+			r = 0;
+	}
+
+	MetricsRegistry::~MetricsRegistry()
+	{
+		Stop();
+	}
+
+	uint64_t MetricsRegistry::Get(Counter counter) const
+	{
+		return _counters[size_t(counter)].value.load(std::memory_order_relaxed);
+	}
+
+	uint64_t MetricsRegistry::Get(Gauge gauge) const
+	{
+		return _gauges[size_t(gauge)].value.load(std::memory_order_relaxed);
+	}
+
+	double MetricsRegistry::GetRate(Counter counter) const
+	{
+		std::lock_guard<std::mutex> lock(_rateMutex);
+		return _rates[size_t(counter)];
+	}
+
+	const LatencyHistogram& MetricsRegistry::GetLatency(Latency stage) const
+	{
+		return _latencies[size_t(stage)];
+	}
+
+	bool MetricsRegistry::Start(const MetricsSettings& settings)
+	{
+		if (_running.load() || !settings.enabled)
+			return false;
+
+		_settings = settings;
+		_running = true;
+		_exporter = std::thread(&MetricsRegistry::_exportLoop, this);
+
+		if (_settings.httpPort > 0)
+		{
+			WSADATA wsa;
+			SOCKET sock = INVALID_SOCKET;
+			if (WSAStartup(MAKEWORD(2, 2), &wsa) == 0)
+				sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(u_short(_settings.httpPort));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if (sock == INVALID_SOCKET || bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 4) != 0)
+			{
+				appLog(Warning) << "Metrics: cannot listen on 127.0.0.1:" << _settings.httpPort << ", error " << WSAGetLastError();
+				if (sock != INVALID_SOCKET)
+					closesocket(sock);
+			}
+			else
+			{
+				_listenSocket = uintptr_t(sock);
+				_server = std::thread(&MetricsRegistry::_serveLoop, this);
+				appLog(Info) << "Metrics: serving http://127.0.0.1:" << _settings.httpPort << "/metrics";
+			}
+		}
+		return true;
+	}
+
+	void MetricsRegistry::Stop()
+	{
+		if (!_running.exchange(false))
+			return;
+
+		if (_exporter.joinable())
+			_exporter.join();
+		if (_server.joinable())
+			_server.join();
+		if (SOCKET(_listenSocket) != INVALID_SOCKET)
+		{
+			closesocket(SOCKET(_listenSocket));
+			_listenSocket = uintptr_t(INVALID_SOCKET);
+			WSACleanup();
+		}
+		_writeStatsFile();
+	}
+
+	void MetricsRegistry::_exportLoop()
+	{
+		uint64_t last[size_t(Counter::Count)];
+		for (size_t i = 0; i < size_t(Counter::Count); i++)
+			last[i] = _counters[i].value.load(std::memory_order_relaxed);
+
+		int sinceTick = 0;
+		int sinceFile = 0;
+		while (_running.load())
+		{
+			Sleep(POLL_MS);
+			sinceTick += POLL_MS;
+			if (sinceTick < RATE_TICK_MS)
+				continue;
+
+			{
+				std::lock_guard<std::mutex> lock(_rateMutex);
+				for (size_t i = 0; i < size_t(Counter::Count); i++)
+				{
+					uint64_t now = _counters[i].value.load(std::memory_order_relaxed);
+					_rates[i] = double(now - last[i]) * 1000.0 / sinceTick;
+					last[i] = now;
+				}
+			}
+			// The log writer does not touch the registry itself, it may outlive it
+			Set(Gauge::LogWriterLatencyUs, _____LOGGER::___Logger.GetWriterLatencyUs());
+			sinceFile += sinceTick;
+			sinceTick = 0;
+
+			if (!_settings.statsFile.empty() && sinceFile >= _settings.intervalSec * 1000)
+			{
+				sinceFile = 0;
+				_writeStatsFile();
+			}
+		}
+	}
+
+	void MetricsRegistry::_serveLoop()
+	{
+		SOCKET listener = SOCKET(_listenSocket);
+		while (_running.load())
+		{
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET(listener, &readable);
+			timeval timeout = { 0, ACCEPT_TIMEOUT_MS * 1000 };
+			if (select(0, &readable, nullptr, nullptr, &timeout) <= 0)
+				continue;
+
+			SOCKET client = accept(listener, nullptr, nullptr);
+			if (client == INVALID_SOCKET)
+				continue;
+
+			// The request itself is not needed, any path returns the metrics
+			char request[1024];
+			FD_ZERO(&readable);
+			FD_SET(client, &readable);
+			if (select(0, &readable, nullptr, nullptr, &timeout) > 0)
+				recv(client, request, sizeof(request), 0);
+
+			std::string body = FormatPrometheus();
+			std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+				+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+			send(client, response.data(), int(response.size()), 0);
+			shutdown(client, SD_SEND);
+			closesocket(client);
+		}
+	}
+
+	bool MetricsRegistry::_writeStatsFile() const
+	{
+		if (_settings.statsFile.empty())
+			return false;
+
+		// Write aside and swap in, so readers never see a partial file
+		std::string temp = _settings.statsFile + ".tmp";
+		{
+			std::ofstream out(temp, std::ios::trunc);
+			if (!out)
+				return false;
+			out << FormatPrometheus();
+		}
+		return MoveFileExA(temp.c_str(), _settings.statsFile.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+	}
+
+	std::string MetricsRegistry::FormatPrometheus() const
+	{
+		std::ostringstream out;
+		for (size_t i = 0; i < size_t(Counter::Count); i++)
+		{
+			auto& info = COUNTERS[i];
+			out << "# HELP " << info.name << " " << info.help << "\n"
+				<< "# TYPE " << info.name << " counter\n"
+				<< info.name << " " << Get(Counter(i)) << "\n";
+			if (info.rateName)
+			{
+				out << "# HELP " << info.rateName << " " << info.help << ", per second\n"
+					<< "# TYPE " << info.rateName << " gauge\n"
+					<< info.rateName << " " << GetRate(Counter(i)) << "\n";
+			}
+		}
+		for (size_t i = 0; i < size_t(Gauge::Count); i++)
+		{
+			auto& info = GAUGES[i];
+			out << "# HELP " << info.name << " " << info.help << "\n"
+				<< "# TYPE " << info.name << " gauge\n"
+				<< info.name << " " << Get(Gauge(i)) << "\n";
+		}
+		for (size_t i = 0; i < size_t(Latency::Count); i++)
+		{
+			auto& info = LATENCIES[i];
+			auto& hist = _latencies[i];
+			out << "# HELP " << info.name << " " << info.help << "\n"
+				<< "# TYPE " << info.name << " summary\n";
+			for (double q : QUANTILES)
+				out << info.name << "{quantile=\"" << q << "\"} " << hist.Percentile(q) / 1e9 << "\n";
+			out << info.name << "_sum " << hist.GetSum() / 1e9 << "\n"
+				<< info.name << "_count " << hist.GetCount() << "\n";
+		}
+		return out.str();
+	}
+
+	void MetricsRegistry::LogLatencies() const
+	{
+		static const char* names[] = { "read->process", "process->sink", "sink->done", "end-to-end" };
+		for (size_t i = 0; i < size_t(Latency::Count); i++)
+		{
+			auto& hist = _latencies[i];
+			if (hist.GetCount() == 0)
+				continue;
+			appLog(Info) << "Latency " << names[i] << " (ms, " << hist.GetCount() << " blocks): p50 " << hist.Percentile(0.5) / 1e6
+				<< ", p90 " << hist.Percentile(0.9) / 1e6 << ", p99 " << hist.Percentile(0.99) / 1e6
+				<< ", p99.9 " << hist.Percentile(0.999) / 1e6 << ", max " << hist.GetMax() / 1e6;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+
+#include "LatencyHistogram.h"
+#include "Clock.h"
+
+namespace _____METRICS
+{
+	enum class Counter
+	{
+		SerialBytes,
+		SerialReads,
+		Samples,
+		DroppedBytes,			// Read into the drop block because the pool was exhausted
+		PoolOverflowBlocks,		// Blocks allocated from the heap because the pool was empty
+		PlaybackUnderruns,		// waveOut played every queued segment and went idle
+		ClippedSamples,			// Counted by the analysis stage
+		SerialOverruns,			// Reads after which the UART or the driver queue had lost bytes
+		SerialLineErrors,		// Reads after which framing, parity or break errors were reported
+		FlowControlPauses,		// Times RTS was deasserted because the playback queue passed the high watermark
+		Count
+	};
+
+	enum class Gauge
+	{
+		CalibratedSampleRate,
+		PlaybackQueueSegments,
+		PoolBlocksInUse,
+		LogWriterLatencyUs,		// Time the log writer took to format and write its last batch
+		InputPeak,				// Analysis stage, last interval, in sample units (full scale 32768)
+		InputRms,
+		DominantFrequencyHz,
+		Count
+	};
+
+	// Per-block pipeline stages, timed from the monotonic stamps carried by each SampleBlock
+	enum class Latency
+	{
+		ReadToProcess,		// First byte of the block returned by SerialMgr -> gain applied
+		ProcessToSink,		// Gain applied -> handed to the sink (waveOut queue, file buffer, sinks)
+		SinkToDone,			// Queued to waveOut -> WOM_DONE
+		EndToEnd,			// First byte returned by SerialMgr -> WOM_DONE
+		Count
+	};
+
+	inline uint64_t NowNs()
+	{
+		return Clock::NowNs();
+	}
+
+	struct MetricsSettings
+	{
+		bool			enabled;
+		int				httpPort;		// Prometheus endpoint on 127.0.0.1, 0 = disabled
+		std::string		statsFile;		// Rewritten every intervalSec, empty = disabled
+		int				intervalSec;
+	};
+
+	// Lock-free metrics registry. Hot paths update counters and gauges with relaxed atomics,
+	// each on its own cache line; an exporter thread derives per-second rates and publishes
+	// them as a stats file and a Prometheus text endpoint.
+	class MetricsRegistry
+	{
+	private:
+		struct alignas(64) Cell
+		{
+			std::atomic<uint64_t> value;
+		};
+
+		Cell				_counters[size_t(Counter::Count)];
+		Cell				_gauges[size_t(Gauge::Count)];
+		LatencyHistogram	_latencies[size_t(Latency::Count)];
+		double				_rates[size_t(Counter::Count)];		// Per second over the last tick, guarded by _rateMutex
+		mutable std::mutex	_rateMutex;
+
+		MetricsSettings		_settings;
+		std::atomic<bool>	_running;
+		std::thread			_exporter;
+		std::thread			_server;
+		uintptr_t			_listenSocket;
+
+		void _exportLoop();
+		void _serveLoop();
+		bool _writeStatsFile() const;
+
+		MetricsRegistry(const MetricsRegistry&) = delete;
+		MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+	public:
+		MetricsRegistry();
+		~MetricsRegistry();
+
+		inline void Add(Counter counter, uint64_t value)
+		{
+			_counters[size_t(counter)].value.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		inline void Set(Gauge gauge, uint64_t value)
+		{
+			_gauges[size_t(gauge)].value.store(value, std::memory_order_relaxed);
+		}
+
+		inline void Observe(Latency stage, uint64_t ns)
+		{
+			_latencies[size_t(stage)].Record(ns);
+		}
+
+		uint64_t Get(Counter counter) const;
+		uint64_t Get(Gauge gauge) const;
+		double GetRate(Counter counter) const;
+		const LatencyHistogram& GetLatency(Latency stage) const;
+
+		bool Start(const MetricsSettings& settings);
+		void Stop();
+
+		std::string FormatPrometheus() const;
+		void LogLatencies() const;	// p50/p90/p99/p99.9/max of every stage
+	};
+
+#ifdef _METRICS_MAIN_CPP
+	MetricsRegistry ___Metrics;
+#else
+	extern MetricsRegistry ___Metrics;
+#endif
+}
+
+#define appMetricAdd(counter, value) _____METRICS::___Metrics.Add(_____METRICS::Counter::counter, uint64_t(value))
+#define appMetricSet(gauge, value) _____METRICS::___Metrics.Set(_____METRICS::Gauge::gauge, uint64_t(value))
+#define appLatency(stage, fromNs, toNs) _____METRICS::___Metrics.Observe(_____METRICS::Latency::stage, (toNs) > (fromNs) ? (toNs) - (fromNs) : 0)
+#define METRICS_NOW() _____METRICS::NowNs()
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <cstdio>
+
+#include <Windows.h>
+
+#include "Profiler.h"
+#include "Logger.h"
+
+namespace _____PROFILER
+{
+	static thread_local Profiler::ThreadBuffer*	tls_buffer = nullptr;
+	static thread_local std::string				tls_threadName;
+
+	Profiler::Profiler()
+		: _enabled(false)
+		, _capacity(DEFAULT_EVENTS_PER_THREAD)
+		, _startNs(Now())
+	{
+	}
+
+	void Profiler::Start(uint64_t eventsPerThread)
+	{
+		// Power of two, so the ring index is a mask
+		_capacity = 1;
+		while (_capacity < eventsPerThread)
+			_capacity <<= 1;
+		_startNs = Now();
+		_enabled = true;
+		appLog(Info) << "Profiler: recording the last " << _capacity << " events per thread";
+	}
+
+	void Profiler::Stop()
+	{
+		_enabled = false;
+	}
+
+	Profiler::ThreadBuffer* Profiler::_local()
+	{
+		if (tls_buffer)
+			return tls_buffer;
+
+		// First event of a thread without PROFILE_THREAD: allocate its ring, it stays registered for Dump() after the thread exits
+		std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+		buffer->threadId = GetCurrentThreadId();
+		buffer->threadName = tls_threadName;
+		buffer->capacity = _capacity;
+		buffer->events.reset(new ProfileEvent[size_t(_capacity)]);
+		buffer->head = 0;
+
+		std::lock_guard<std::mutex> lock(_buffersMutex);
+		tls_buffer = buffer.get();
+		_buffers.push_back(std::move(buffer));
+		return tls_buffer;
+	}
+
+	void Profiler::_record(ProfileEventType type, const char* name, uint64_t timeNs, uint64_t value)
+	{
+		ThreadBuffer* buffer = _local();
+		uint64_t index = buffer->head.load(std::memory_order_relaxed);
+		ProfileEvent& ev = buffer->events[size_t(index & (buffer->capacity - 1))];
+		ev.timeNs = timeNs;
+		ev.value = value;
+		ev.name = name;
+		ev.type = type;
+		buffer->head.store(index + 1, std::memory_order_release);
+	}
+
+	void Profiler::Zone(const char* name, uint64_t startNs, uint64_t endNs)
+	{
+		_record(ProfileEventType::Zone, name, startNs, endNs - startNs);
+	}
+
+	void Profiler::Counter(const char* name, uint64_t value)
+	{
+		_record(ProfileEventType::Counter, name, Now(), value);
+	}
+
+	void Profiler::Instant(const char* name)
+	{
+		_record(ProfileEventType::Instant, name, Now(), 0);
+	}
+
+	void Profiler::ThreadName(const std::string& name)
+	{
+		tls_threadName = name;
+		if (tls_buffer)
+		{
+			std::lock_guard<std::mutex> lock(_buffersMutex);
+			tls_buffer->threadName = name;
+		}
+		else if (Enabled())
+			_local();
+	}
+
+	bool Profiler::GetThreadRing(void*& data, size_t& bytes)
+	{
+		if (!tls_buffer)
+			return false;
+		data = tls_buffer->events.get();
+		bytes = size_t(tls_buffer->capacity) * sizeof(ProfileEvent);
+		return true;
+	}
+
+	bool Profiler::Dump(const std::string& fileName)
+	{
+		FILE* file = fopen(fileName.c_str(), "wb");
+		if (!file)
+		{
+			appLog(Warning) << "Profiler: cannot create " << fileName;
+			return false;
+		}
+
+		const unsigned long pid = GetCurrentProcessId();
+		uint64_t written = 0;
+		fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+		std::lock_guard<std::mutex> lock(_buffersMutex);
+		for (auto& buffer : _buffers)
+		{
+			if (!buffer->threadName.empty())
+			{
+				fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+					written++ ? ",\n" : "", pid, buffer->threadId, buffer->threadName.c_str());
+			}
+
+			// Events still being written by a running thread may be torn; dump after capture stops for exact data
+			uint64_t head = buffer->head.load(std::memory_order_acquire);
+			uint64_t first = head > buffer->capacity ? head - buffer->capacity : 0;
+			for (uint64_t i = first; i < head; i++)
+			{
+				const ProfileEvent& ev = buffer->events[size_t(i & (buffer->capacity - 1))];
+				double ts = (int64_t(ev.timeNs) - int64_t(_startNs)) / 1000.0;
+				const char* sep = written++ ? ",\n" : "";
+				switch (ev.type)
+				{
+				case ProfileEventType::Zone:
+					fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+						sep, ev.name, pid, buffer->threadId, ts, ev.value / 1000.0);
+					break;
+				case ProfileEventType::Counter:
+					fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%lu,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%llu}}",
+						sep, ev.name, pid, buffer->threadId, ts, (unsigned long long)ev.value);
+					break;
+				case ProfileEventType::Instant:
+					fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%lu,\"tid\":%u,\"ts\":%.3f}",
+						sep, ev.name, pid, buffer->threadId, ts);
+					break;
+				}
+			}
+		}
+
+		fprintf(file, "\n]}\n");
+		bool ok = ferror(file) == 0;
+		fclose(file);
+		appLog(Info) << "Profiler: " << written << " events written to " << fileName;
+		return ok;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "Clock.h"
+
+// Zones, counters and instant events are compiled out with /DAPP_PROFILER_COMPILED=0
+#ifndef APP_PROFILER_COMPILED
+#define APP_PROFILER_COMPILED 1
+#endif
+
+namespace _____PROFILER
+{
+	enum class ProfileEventType : uint32_t
+	{
+		Zone,
+		Counter,
+		Instant
+	};
+
+	struct ProfileEvent
+	{
+		uint64_t			timeNs;
+		uint64_t			value;		// Zone: duration in ns, Counter: value
+		const char*			name;		// String literal, only the pointer is stored
+		ProfileEventType	type;
+	};
+
+	// Instrumentation for glitch hunting. Each thread records into its own ring of the latest
+	// events, so recording is a couple of stores without locks; Dump() writes Chrome trace-event
+	// JSON that opens in Perfetto or chrome://tracing.
+	class Profiler
+	{
+	public:
+		struct ThreadBuffer
+		{
+			uint32_t						threadId;
+			std::string						threadName;
+			std::unique_ptr<ProfileEvent[]>	events;
+			uint64_t						capacity;	// Power of two
+			std::atomic<uint64_t>			head;		// Events written, the ring holds the last capacity of them
+		};
+
+	private:
+		std::atomic<bool>							_enabled;
+		uint64_t									_capacity;
+		uint64_t									_startNs;
+		std::mutex									_buffersMutex;
+		std::vector<std::unique_ptr<ThreadBuffer>>	_buffers;
+
+		ThreadBuffer* _local();
+		void _record(ProfileEventType type, const char* name, uint64_t timeNs, uint64_t value);
+
+		Profiler(const Profiler&) = delete;
+		Profiler& operator=(const Profiler&) = delete;
+
+	public:
+		static constexpr uint64_t DEFAULT_EVENTS_PER_THREAD = 262144;
+
+		Profiler();
+
+		void Start(uint64_t eventsPerThread);
+		void Stop();
+		bool Dump(const std::string& fileName);
+
+		inline bool Enabled() const
+		{
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		static inline uint64_t Now()
+		{
+			return Clock::NowNs();
+		}
+
+		void Zone(const char* name, uint64_t startNs, uint64_t endNs);
+		void Counter(const char* name, uint64_t value);
+		void Instant(const char* name);
+		void ThreadName(const std::string& name);	// Also allocates the thread's ring while enabled, so recording never allocates
+		bool GetThreadRing(void*& data, size_t& bytes);	// This thread's ring, for prefaulting; false if it has none
+	};
+
+#ifdef _PROFILER_MAIN_CPP
+	Profiler ___Profiler;
+#else
+	extern Profiler ___Profiler;
+#endif
+
+	// Records the enclosing scope as one complete event when it ends
+	class ScopedZone
+	{
+	private:
+		const char*		_name;
+		uint64_t		_start;
+
+	public:
+		inline explicit ScopedZone(const char* name)
+			: _name(name)
+			, _start(___Profiler.Enabled() ? Profiler::Now() : 0)
+		{
+		}
+
+		inline ~ScopedZone()
+		{
+			if (_start)
+				___Profiler.Zone(_name, _start, Profiler::Now());
+		}
+	};
+}
+
+#if APP_PROFILER_COMPILED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) _____PROFILER::ScopedZone PROFILE_CONCAT(__profileZone, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) \
+	if (!_____PROFILER::___Profiler.Enabled()) {} \
+	else _____PROFILER::___Profiler.Counter(name, uint64_t(value))
+#define PROFILE_INSTANT(name) \
+	if (!_____PROFILER::___Profiler.Enabled()) {} \
+	else _____PROFILER::___Profiler.Instant(name)
+#define PROFILE_THREAD(name) _____PROFILER::___Profiler.ThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_INSTANT(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <cstring>
+
+#include "RawCapture.h"
+#include "Logger.h"
+#include "Utils.h"
+
+constexpr char RawCaptureWriter::MAGIC[8];
+
+RawCaptureWriter::RawCaptureWriter()
+	: _file(INVALID_HANDLE_VALUE)
+	, _used(0)
+	, _startNs(0)
+	, _lastUs(0)
+	, _bytes(0)
+	, _records(0)
+	, _failed(false)
+{
+}
+
+RawCaptureWriter::~RawCaptureWriter()
+{
+	Close();
+}
+
+bool RawCaptureWriter::Open(const std::string& fileName, const std::string& port, unsigned int baudRate, uint64_t startNs)
+{
+	Close();
+	_file = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		appLog(Warning) << "Raw capture: cannot create " << fileName;
+		return false;
+	}
+
+	_buffer.resize(BUFFER_SIZE);
+	_used = 0;
+	_startNs = startNs;
+	_lastUs = 0;
+	_bytes = 0;
+	_records = 0;
+	_failed = false;
+
+	RawCaptureHeader header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.baudRate = baudRate;
+	header.startUnixMs = Utils::getTimeMs();
+	strncpy(header.port, port.c_str(), sizeof(header.port) - 1);
+	memcpy(_buffer.data(), &header, sizeof(header));
+	_used = sizeof(header);
+
+	appLog(Info) << "Raw capture: recording serial input to " << fileName;
+	return true;
+}
+
+void RawCaptureWriter::_flush()
+{
+	if (_used == 0 || _file == INVALID_HANDLE_VALUE)
+		return;
+
+	DWORD written = 0;
+	if (!WriteFile(_file, _buffer.data(), DWORD(_used), &written, NULL) || written != _used)
+	{
+		if (!_failed)
+			appLog(Warning) << "Raw capture: write failed, error " << GetLastError();
+		_failed = true;
+	}
+	_used = 0;
+}
+
+void RawCaptureWriter::_putVarint(uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		_buffer[_used++] = byte(value | 0x80);
+		value >>= 7;
+	}
+	_buffer[_used++] = byte(value);
+}
+
+void RawCaptureWriter::Write(uint64_t timeNs, const void* data, size_t size)
+{
+	if (_file == INVALID_HANDLE_VALUE || size == 0)
+		return;
+
+	uint64_t timeUs = timeNs > _startNs ? (timeNs - _startNs) / 1000 : 0;
+	uint64_t delta = timeUs > _lastUs ? timeUs - _lastUs : 0;
+	_lastUs += delta;
+
+	if (_used + MAX_RECORD_OVERHEAD + size > _buffer.size())
+	{
+		_flush();
+		if (MAX_RECORD_OVERHEAD + size > _buffer.size())
+			_buffer.resize(MAX_RECORD_OVERHEAD + size);
+	}
+
+	_putVarint(delta);
+	_putVarint(size);
+	memcpy(_buffer.data() + _used, data, size);
+	_used += size;
+	_bytes += size;
+	_records++;
+}
+
+void RawCaptureWriter::Close()
+{
+	if (_file == INVALID_HANDLE_VALUE)
+		return;
+
+	_flush();
+	CloseHandle(_file);
+	_file = INVALID_HANDLE_VALUE;
+	appLog(Info) << "Raw capture: " << _bytes << " bytes in " << _records << " reads recorded";
+}
+
+bool RawCaptureWriter::IsOpen() const
+{
+	return _file != INVALID_HANDLE_VALUE;
+}
+
+uint64_t RawCaptureWriter::GetBytes() const
+{
+	return _bytes;
+}
+
+uint64_t RawCaptureWriter::GetRecords() const
+{
+	return _records;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <Windows.h>
+
+// Raw serial capture file: RawCaptureHeader followed by one record per serial read,
+// varint(microseconds since the previous record) varint(length) bytes[length].
+// Reads that returned no data are not recorded.
+struct RawCaptureHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	baudRate;
+	int64_t		startUnixMs;	// Wall clock when the capture was opened
+	char		port[16];
+};
+
+class RawCaptureWriter
+{
+private:
+	HANDLE				_file;
+	std::vector<byte>	_buffer;
+	size_t				_used;
+	uint64_t			_startNs;
+	uint64_t			_lastUs;
+	uint64_t			_bytes;
+	uint64_t			_records;
+	bool				_failed;
+
+	void _flush();
+	void _putVarint(uint64_t value);
+
+	RawCaptureWriter(const RawCaptureWriter&) = delete;
+	RawCaptureWriter& operator=(const RawCaptureWriter&) = delete;
+
+public:
+	static constexpr char		MAGIC[8] = { 'S', 'A', 'S', 'R', 'A', 'W', 0, 0 };
+	static constexpr uint32_t	VERSION = 1;
+	static constexpr size_t		BUFFER_SIZE = 256 * 1024;
+	static constexpr size_t		MAX_RECORD_OVERHEAD = 20;	// Two 10-byte varints
+
+	RawCaptureWriter();
+	~RawCaptureWriter();
+
+	bool Open(const std::string& fileName, const std::string& port, unsigned int baudRate, uint64_t startNs);
+	void Write(uint64_t timeNs, const void* data, size_t size);	// Buffered, called from the capture thread
+	void Close();
+
+	bool IsOpen() const;
+	uint64_t GetBytes() const;
+	uint64_t GetRecords() const;
+};
\ No newline at end of file
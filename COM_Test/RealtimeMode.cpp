@@ -0,0 +1,91 @@
+#include "RealtimeMode.h"
+#include "Logger.h"
+
+namespace RealtimeMode
+{
+	constexpr size_t PAGE_SIZE = 4096;
+	constexpr size_t WORKING_SET_MARGIN = 16 * 1024 * 1024;
+
+	bool RaiseProcessPriority()
+	{
+		HANDLE process = GetCurrentProcess();
+		if (!SetPriorityClass(process, REALTIME_PRIORITY_CLASS))
+		{
+			appLog(Warning) << "Realtime: SetPriorityClass failed, error " << GetLastError();
+			return false;
+		}
+
+		// Without SeIncreaseBasePriorityPrivilege Windows silently falls back to HIGH_PRIORITY_CLASS
+		if (GetPriorityClass(process) != REALTIME_PRIORITY_CLASS)
+		{
+			appLog(Warning) << "Realtime: no privilege for REALTIME_PRIORITY_CLASS (run as Administrator), using HIGH_PRIORITY_CLASS";
+			return false;
+		}
+
+		appLog(Info) << "Realtime: process priority class is REALTIME";
+		return true;
+	}
+
+	bool SetupCurrentThread(const RealtimeSettings& settings)
+	{
+		bool ok = true;
+		HANDLE thread = GetCurrentThread();
+
+		if (!SetThreadPriority(thread, settings.threadPriority))
+		{
+			appLog(Warning) << "Realtime: SetThreadPriority(" << settings.threadPriority << ") failed, error " << GetLastError();
+			ok = false;
+		}
+		else
+			appLog(Info) << "Realtime: reader thread priority " << GetThreadPriority(thread);
+
+		if (settings.affinityMask)
+		{
+			if (!SetThreadAffinityMask(thread, settings.affinityMask))
+			{
+				appLog(Warning) << "Realtime: SetThreadAffinityMask(" << settings.affinityMask << ") failed, error " << GetLastError();
+				ok = false;
+			}
+			else
+				appLog(Info) << "Realtime: reader thread pinned to CPU mask " << settings.affinityMask;
+		}
+
+		return ok;
+	}
+
+	bool LockMemory(void* ptr, size_t size)
+	{
+		if (!ptr || !size)
+			return true;
+
+		// VirtualLock is limited by the minimum working set, grow it first
+		HANDLE process = GetCurrentProcess();
+		SIZE_T minWs = 0, maxWs = 0;
+		if (GetProcessWorkingSetSize(process, &minWs, &maxWs))
+		{
+			minWs += size + WORKING_SET_MARGIN;
+			if (maxWs < minWs)
+				maxWs = minWs;
+			if (!SetProcessWorkingSetSize(process, minWs, maxWs))
+				appLog(Warning) << "Realtime: SetProcessWorkingSetSize failed, error " << GetLastError();
+		}
+
+		if (!VirtualLock(ptr, size))
+		{
+			appLog(Warning) << "Realtime: VirtualLock of " << size << " bytes failed, error " << GetLastError();
+			return false;
+		}
+
+		appLog(Info) << "Realtime: locked " << size << " bytes of sample buffers";
+		return true;
+	}
+
+	void Prefault(void* ptr, size_t size)
+	{
+		volatile byte* bytes = reinterpret_cast<volatile byte*>(ptr);
+		for (size_t i = 0; i < size; i += PAGE_SIZE)
+			bytes[i] = bytes[i];
+		if (size)
+			bytes[size - 1] = bytes[size - 1];
+	}
+}
\ No newline at end of file
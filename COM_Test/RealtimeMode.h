@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Windows.h>
+
+struct RealtimeSettings
+{
+	bool		enabled;
+	int			threadPriority;		// THREAD_PRIORITY_* value for the reader thread
+	DWORD_PTR	affinityMask;		// CPUs the reader thread is pinned to, 0 = no pinning
+	bool		lockMemory;			// Lock sample buffers into the working set
+	int			filePreallocSec;	// Seconds of audio preallocated for file capture, longer recordings grow the buffer in the hot loop
+};
+
+// Windows counterparts of SCHED_FIFO / sched_setaffinity / mlockall.
+// All functions log what they could not do, so they must be called before the hot loop.
+namespace RealtimeMode
+{
+	bool RaiseProcessPriority();
+	bool SetupCurrentThread(const RealtimeSettings& settings);
+	bool LockMemory(void* ptr, size_t size);
+	void Prefault(void* ptr, size_t size);
+}
\ No newline at end of file
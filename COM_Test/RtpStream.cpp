@@ -0,0 +1,575 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <algorithm>
+
+#include "RtpStream.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "Clock.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+// UDP segmentation offload, Windows 10 1903 and later; older SDKs lack the define
+#ifndef UDP_SEND_MSG_SIZE
+#define UDP_SEND_MSG_SIZE 2
+#endif
+
+static inline void PutBE16(byte* out, uint16_t value)
+{
+	out[0] = byte(value >> 8);
+	out[1] = byte(value);
+}
+
+static inline void PutBE32(byte* out, uint32_t value)
+{
+	out[0] = byte(value >> 24);
+	out[1] = byte(value >> 16);
+	out[2] = byte(value >> 8);
+	out[3] = byte(value);
+}
+
+static inline uint16_t GetBE16(const byte* in)
+{
+	return uint16_t(in[0] << 8 | in[1]);
+}
+
+static inline uint32_t GetBE32(const byte* in)
+{
+	return uint32_t(in[0]) << 24 | uint32_t(in[1]) << 16 | uint32_t(in[2]) << 8 | in[3];
+}
+
+/****************
+ *	  SENDER	*
+ ****************/
+
+RtpSender::RtpSender()
+	: _wake(NULL)
+	, _settings({ false, "", 0, 0, "" })
+	, _samplingRate(0)
+	, _channels(1)
+	, _socket(uintptr_t(INVALID_SOCKET))
+	, _segmentOffload(false)
+	, _packetSamples(0)
+	, _sequence(0)
+	, _timestampBase(0)
+	, _ssrc(0)
+	, _packets(0)
+	, _sends(0)
+	, _sendErrors(0)
+	, _running(false)
+{
+}
+
+RtpSender::~RtpSender()
+{
+	Stop();
+}
+
+bool RtpSender::_parseDestinations()
+{
+	_destinations.clear();
+	std::stringstream list(_settings.destinations);
+	std::string item;
+	while (std::getline(list, item, ','))
+	{
+		item.erase(0, item.find_first_not_of(" \t"));
+		item.erase(item.find_last_not_of(" \t") + 1);
+		size_t colon = item.rfind(':');
+		if (item.empty() || colon == std::string::npos)
+			continue;
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		addrinfo* found = nullptr;
+		if (getaddrinfo(item.substr(0, colon).c_str(), item.substr(colon + 1).c_str(), &hints, &found) != 0 || !found)
+		{
+			appLog(Warning) << "Network: cannot resolve " << item;
+			continue;
+		}
+		const sockaddr_in* addr = reinterpret_cast<const sockaddr_in*>(found->ai_addr);
+		_destinations.push_back({ item, uint32_t(addr->sin_addr.s_addr), uint16_t(addr->sin_port) });
+		freeaddrinfo(found);
+	}
+	return !_destinations.empty();
+}
+
+void RtpSender::_writeSdp() const
+{
+	if (_settings.sdpFile.empty())
+		return;
+
+	// Describes the first destination, which is where a player reading the file listens
+	const Destination& dest = _destinations.front();
+	in_addr address;
+	address.s_addr = dest.address;
+	char host[INET_ADDRSTRLEN] = {};
+	inet_ntop(AF_INET, &address, host, sizeof(host));
+
+	FILE* file = fopen(_settings.sdpFile.c_str(), "w");
+	if (!file)
+	{
+		appLog(Warning) << "Network: cannot create " << _settings.sdpFile;
+		return;
+	}
+	fprintf(file, "v=0\r\no=- %u 1 IN IP4 %s\r\ns=SerialAudioSampler\r\nc=IN IP4 %s\r\nt=0 0\r\n", _ssrc, host, host);
+	fprintf(file, "m=audio %u RTP/AVP %d\r\na=rtpmap:%d L16/%u/%u\r\na=ptime:%d\r\n",
+		unsigned(ntohs(dest.port)), _settings.payloadType, _settings.payloadType, _samplingRate, unsigned(_channels), _settings.packetMs);
+	fclose(file);
+}
+
+bool RtpSender::Start(const NetworkSettings& settings, SamplingRate_t samplingRate, WORD channels)
+{
+	if (_running.load() || !settings.enabled || samplingRate == 0)
+		return false;
+
+	_settings = settings;
+	_samplingRate = samplingRate;
+	_channels = channels;
+	if (!_parseDestinations())
+	{
+		appLog(Warning) << "Network: no usable destination in \"" << settings.destinations << "\"";
+		return false;
+	}
+
+	WSADATA wsa;
+	SOCKET sock = INVALID_SOCKET;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) == 0)
+		sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock == INVALID_SOCKET)
+	{
+		appLog(Warning) << "Network: cannot create a socket, error " << WSAGetLastError();
+		WSACleanup();
+		return false;
+	}
+	_socket = uintptr_t(sock);
+
+	_packetSamples = size_t((std::max)(uint64_t(samplingRate) * settings.packetMs / 1000, uint64_t(1))) * channels;
+	const size_t packetBytes = HEADER_SIZE + EXTENSION_SIZE + _packetSamples * sizeof(int16_t);
+	DWORD segmentSize = DWORD(packetBytes);
+	_segmentOffload = setsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (const char*)&segmentSize, sizeof(segmentSize)) == 0;
+	_batch.assign((std::max)(MAX_BATCH_BYTES / packetBytes, size_t(1)) * packetBytes, 0);
+
+	_ring.Reset(size_t(samplingRate) * channels * RING_SEC, channels);
+	_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+	std::random_device random;
+	_sequence = uint16_t(random());
+	_timestampBase = uint32_t(random());
+	_ssrc = uint32_t(random());
+	_packets = 0;
+	_sends = 0;
+	_sendErrors = 0;
+	_writeSdp();
+
+	_running = true;
+	_sender = std::thread(&RtpSender::_loop, this);
+	for (auto& dest : _destinations)
+		appLog(Info) << "Network: streaming RTP L16 " << samplingRate << " Hz to " << dest.name;
+	appLog(Info) << "Network: " << settings.packetMs << " ms packets of " << packetBytes << " bytes, "
+		<< _batch.size() / packetBytes << " per send" << (_segmentOffload ? " with segmentation offload" : ", one send per packet");
+	return true;
+}
+
+void RtpSender::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	SetEvent(_wake);
+	if (_sender.joinable())
+		_sender.join();
+	closesocket(SOCKET(_socket));
+	_socket = uintptr_t(INVALID_SOCKET);
+	WSACleanup();
+	CloseHandle(_wake);
+	_wake = NULL;
+
+	if (_ring.GetDroppedSamples())
+		appLog(Warning) << "Network sender fell behind and skipped " << _ring.GetDroppedSamples() << " samples";
+	appLog(Info) << "Network: " << _packets << " packets in " << _sends << " sends, " << _sendErrors << " send errors";
+}
+
+void RtpSender::Push(const WaveSample16_t* samples, size_t count)
+{
+	_ring.Push(reinterpret_cast<const int16_t*>(samples), count);
+
+	// Only wake the sender when a whole packet is waiting
+	if (_ring.Available() >= _packetSamples)
+		SetEvent(_wake);
+}
+
+size_t RtpSender::_buildPacket(byte* out, uint64_t position, size_t count)
+{
+	out[0] = 0x90;	// Version 2, header extension
+	out[1] = byte(_settings.payloadType & 0x7F) | (_packets == 0 ? 0x80 : 0);	// Marker on the first packet
+	PutBE16(out + 2, _sequence++);
+	// Derived from the capture position, so the receiver sees a jump where the ring dropped audio and fills it with silence
+	PutBE32(out + 4, _timestampBase + uint32_t((position + _ring.DroppedBefore(position)) / _channels));
+	PutBE32(out + 8, _ssrc);
+	PutBE16(out + 12, EXTENSION_PROFILE);
+	PutBE16(out + 14, 1);
+	PutBE32(out + 16, uint32_t(_channels) << 24 | (_samplingRate & 0xFFFFFF));
+
+	// L16 is big endian
+	byte* payload = out + HEADER_SIZE + EXTENSION_SIZE;
+	for (size_t i = 0; i < count; i++)
+		PutBE16(payload + i * 2, uint16_t(_ring.At(position + i)));
+
+	_packets++;
+	return HEADER_SIZE + EXTENSION_SIZE + count * sizeof(int16_t);
+}
+
+void RtpSender::_send(const byte* data, size_t size, size_t packetBytes)
+{
+	SOCKET sock = SOCKET(_socket);
+	for (auto& dest : _destinations)
+	{
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = dest.address;
+		addr.sin_port = dest.port;
+
+		// With offload the whole batch is one call, otherwise one call per packet
+		size_t step = _segmentOffload ? size : packetBytes;
+		for (size_t sent = 0; sent < size; sent += step)
+		{
+			int chunk = int((std::min)(step, size - sent));
+			if (sendto(sock, (const char*)data + sent, chunk, 0, (const sockaddr*)&addr, sizeof(addr)) != chunk)
+			{
+				if (_sendErrors++ == 0)
+					appLog(Warning) << "Network: send to " << dest.name << " failed, error " << WSAGetLastError();
+			}
+			_sends++;
+		}
+	}
+}
+
+void RtpSender::_loop()
+{
+	PROFILE_THREAD("RtpSender");
+	const size_t packetBytes = HEADER_SIZE + EXTENSION_SIZE + _packetSamples * sizeof(int16_t);
+	const size_t batchPackets = _batch.size() / packetBytes;
+	while (true)
+	{
+		bool running = _running.load();
+		uint64_t read = _ring.GetReadPos();
+		size_t available = _ring.Available();
+		size_t packets = (std::min)(available / _packetSamples, batchPackets);
+		if (packets == 0)
+		{
+			if (running)
+			{
+				WaitForSingleObject(_wake, POLL_MS);
+				continue;
+			}
+
+			// Last partial packet on stop, whole frames only
+			size_t left = available - available % _channels;
+			if (left)
+			{
+				size_t bytes = _buildPacket(_batch.data(), read, left);
+				_ring.Consume(left);
+				_send(_batch.data(), bytes, bytes);
+			}
+			break;
+		}
+
+		PROFILE_ZONE("RtpSend");
+		for (size_t i = 0; i < packets; i++)
+			_buildPacket(_batch.data() + i * packetBytes, read + i * _packetSamples, _packetSamples);
+		_ring.Consume(packets * _packetSamples);
+		_send(_batch.data(), packets * packetBytes, packetBytes);
+	}
+}
+
+/****************
+ *	 RECEIVER	*
+ ****************/
+
+namespace RtpReceiver
+{
+	static constexpr int PLAY_BLOCK_MS = 20;
+	static constexpr int SELECT_TIMEOUT_MS = 200;
+	static constexpr int MAX_GAP_SEC = 10;		// Larger timestamp jumps are a restarted sender, not loss
+
+	Options DefaultOptions()
+	{
+		return { 5004, "", "received.wav", 0, 8000, 1, 100 };
+	}
+
+	// Output side of the receiver: a WAV file, or waveOut fed with pooled blocks after a prebuffer
+	class Output
+	{
+	private:
+		std::string						_target;
+		int								_playBufferMs;
+		WaveFileWriter					_file;
+		std::unique_ptr<WaveStream>		_wave;
+		std::unique_ptr<SampleBlockPool> _pool;
+		std::vector<SampleBlock*>		_held;		// Filled blocks waiting for the prebuffer
+		SampleBlock*					_block;
+		bool							_playing;
+
+		void _startPlaying()
+		{
+			_playing = true;
+			for (auto held : _held)
+				_wave->PushSegment(held);
+			_held.clear();
+		}
+
+		void _submit(SampleBlock* block)
+		{
+			if (_playing)
+			{
+				_wave->PushSegment(block);
+				return;
+			}
+			_held.push_back(block);
+			if (int(_held.size()) * PLAY_BLOCK_MS >= _playBufferMs)
+				_startPlaying();
+		}
+
+	public:
+		Output(const std::string& target, int playBufferMs)
+			: _target(target)
+			, _playBufferMs(playBufferMs)
+			, _block(nullptr)
+			, _playing(false)
+		{
+		}
+
+		bool Open(unsigned int samplingRate, int channels)
+		{
+			if (_target != "play")
+				return _file.Open(_target, WORD(channels), samplingRate, 16);
+
+			_wave.reset(new WaveStream());
+			if (!_wave->Initialize(WAVE_MAPPER, 16, samplingRate, channels))
+				return false;
+			size_t blockBytes = SampleBlockPool::BlockBytesFor(samplingRate, channels, 16, PLAY_BLOCK_MS);
+			_pool.reset(new SampleBlockPool(blockBytes, size_t(_playBufferMs / PLAY_BLOCK_MS) * 4 + 16));
+			return true;
+		}
+
+		void Write(const int16_t* samples, size_t count)
+		{
+			if (!_wave)
+			{
+				_file.Write(samples, count * sizeof(int16_t));
+				return;
+			}
+
+			const byte* in = reinterpret_cast<const byte*>(samples);
+			size_t bytes = count * sizeof(int16_t);
+			while (bytes)
+			{
+				if (!_block)
+					_block = _pool->Acquire();
+				size_t chunk = (std::min)(bytes, _block->available());
+				memcpy(_block->data() + _block->size, in, chunk);
+				_block->size += chunk;
+				in += chunk;
+				bytes -= chunk;
+				if (_block->full())
+				{
+					_submit(_block);
+					_block = nullptr;
+				}
+			}
+		}
+
+		void Close()
+		{
+			if (!_wave)
+			{
+				_file.Close();
+				return;
+			}
+
+			if (_block && _block->size)
+				_held.push_back(_block);
+			else if (_block)
+				_pool->Release(_block);
+			_block = nullptr;
+			_startPlaying();
+
+			// Let the queued audio finish before waveOut is closed
+			for (int waited = 0; _wave->GetQueuedSegments() && waited < 5000; waited += PLAY_BLOCK_MS)
+				Sleep(PLAY_BLOCK_MS);
+			_wave.reset();
+		}
+	};
+
+	int Run(const Options& options, Report& report)
+	{
+		report = {};
+		WSADATA wsa;
+		SOCKET sock = INVALID_SOCKET;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) == 0)
+			sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+		// Several listeners on one host may share a multicast port
+		BOOL reuse = TRUE;
+		int receiveBuffer = 1 << 20;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&receiveBuffer, sizeof(receiveBuffer));
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(u_short(options.port));
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (sock == INVALID_SOCKET || bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			appLog(Critical) << "Receiver: cannot listen on udp port " << options.port << ", error " << WSAGetLastError();
+			if (sock != INVALID_SOCKET)
+				closesocket(sock);
+			WSACleanup();
+			return -1;
+		}
+
+		if (!options.group.empty())
+		{
+			ip_mreq membership = {};
+			inet_pton(AF_INET, options.group.c_str(), &membership.imr_multiaddr);
+			membership.imr_interface.s_addr = htonl(INADDR_ANY);
+			if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&membership, sizeof(membership)) != 0)
+				appLog(Warning) << "Receiver: cannot join " << options.group << ", error " << WSAGetLastError();
+		}
+		appLog(Info) << "Receiver: listening on udp port " << options.port << (options.group.empty() ? "" : " group " + options.group);
+
+		Output output(options.output, options.playBufferMs);
+		std::vector<byte> packet(65536);
+		std::vector<int16_t> samples(packet.size() / sizeof(int16_t));
+		bool started = false;
+		int result = 0;
+		uint64_t startNs = Clock::NowNs();
+		uint64_t baseSeq = 0, maxSeq = 0;
+		uint32_t nextTs = 0;
+		double lastTransit = 0.0, jitter = 0.0;
+
+		while (!(GetKeyState(VK_F12) & 0x8000))
+		{
+			if (options.durationSec > 0 && Clock::NowNs() - startNs >= uint64_t(options.durationSec) * 1000000000ULL)
+				break;
+
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET(sock, &readable);
+			timeval timeout = { 0, SELECT_TIMEOUT_MS * 1000 };
+			if (select(0, &readable, nullptr, nullptr, &timeout) <= 0)
+				continue;
+			int received = recv(sock, (char*)packet.data(), int(packet.size()), 0);
+			uint64_t arrivalNs = Clock::NowNs();
+			if (received < int(RtpSender::HEADER_SIZE) || (packet[0] >> 6) != 2)
+				continue;
+
+			// Fixed header, CSRCs, optional extension, optional padding
+			size_t length = size_t(received);
+			size_t offset = RtpSender::HEADER_SIZE + (packet[0] & 0x0F) * 4;
+			if ((packet[0] & 0x20) && packet[length - 1] < length)
+				length -= packet[length - 1];
+			unsigned int samplingRate = options.samplingRate;
+			int channels = options.channels;
+			if ((packet[0] & 0x10) && offset + 4 <= length)
+			{
+				uint16_t profile = GetBE16(&packet[offset]);
+				size_t words = GetBE16(&packet[offset + 2]);
+				if (profile == RtpSender::EXTENSION_PROFILE && words >= 1 && offset + 8 <= length)
+				{
+					uint32_t format = GetBE32(&packet[offset + 4]);
+					channels = int(format >> 24);
+					samplingRate = format & 0xFFFFFF;
+				}
+				offset += 4 + words * 4;
+			}
+			if (offset > length || channels <= 0 || samplingRate == 0)
+				continue;
+
+			uint16_t seq = GetBE16(&packet[2]);
+			uint32_t ts = GetBE32(&packet[4]);
+			size_t count = (length - offset) / sizeof(int16_t);
+			count -= count % channels;
+
+			if (!started)
+			{
+				if (!output.Open(samplingRate, channels))
+				{
+					appLog(Critical) << "Receiver: cannot open " << options.output;
+					result = -1;
+					break;
+				}
+				started = true;
+				report.samplingRate = samplingRate;
+				report.channels = channels;
+				baseSeq = maxSeq = uint64_t(seq) + 65536;	// Headroom for packets sent before the first one
+				nextTs = ts;
+				appLog(Info) << "Receiver: stream of " << samplingRate << " Hz, " << channels << " channels";
+			}
+
+			// Extend the 16-bit sequence number so the loss count survives wraparound
+			uint64_t ext = maxSeq + int16_t(seq - uint16_t(maxSeq));
+			maxSeq = (std::max)(maxSeq, ext);
+			baseSeq = (std::min)(baseSeq, ext);
+			report.packets++;
+
+			double transit = double(arrivalNs) * report.samplingRate / 1e9 - double(ts);
+			if (report.packets > 1)
+				jitter += (std::abs(transit - lastTransit) - jitter) / 16.0;
+			lastTransit = transit;
+
+			int32_t gap = int32_t(ts - nextTs);
+			if (gap < 0)
+			{
+				report.late++;
+				continue;
+			}
+			if (gap > int32_t(report.samplingRate) * MAX_GAP_SEC)
+			{
+				appLog(Warning) << "Receiver: timestamp jumped " << gap << " frames, resynchronizing";
+				gap = 0;
+			}
+
+			// Lost packets become silence, so the output keeps the sender's timeline
+			if (gap > 0)
+			{
+				std::fill(samples.begin(), samples.end(), int16_t(0));
+				size_t silence = size_t(gap) * report.channels;
+				report.silenceFrames += uint64_t(gap);
+				while (silence)
+				{
+					size_t chunk = (std::min)(silence, samples.size());
+					output.Write(samples.data(), chunk);
+					silence -= chunk;
+				}
+			}
+
+			for (size_t i = 0; i < count; i++)
+				samples[i] = int16_t(GetBE16(&packet[offset + i * 2]));
+			output.Write(samples.data(), count);
+			size_t frames = count / report.channels;
+			report.frames += uint64_t(gap) + frames;
+			nextTs = ts + uint32_t(frames);
+		}
+
+		if (started)
+			output.Close();
+		closesocket(sock);
+		WSACleanup();
+
+		report.expected = started ? maxSeq - baseSeq + 1 : 0;
+		report.lost = report.expected > report.packets ? report.expected - report.packets : 0;
+		report.jitterMs = report.samplingRate ? jitter * 1000.0 / report.samplingRate : 0.0;
+		appLog(Info) << "Receiver: " << report.packets << " packets, " << report.lost << " lost, " << report.late << " late, jitter "
+			<< report.jitterMs << " ms, " << double(report.frames) / (std::max)(report.samplingRate, 1u) << " s of audio";
+		return result == 0 && started ? 0 : -1;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "WaveStream.h"
+#include "SampleRing.h"
+
+struct NetworkSettings
+{
+	bool			enabled;
+	std::string		destinations;	// Comma separated host:port list, multicast groups work too
+	int				packetMs;		// Audio per packet
+	int				payloadType;	// RTP payload type announced in the SDP, 96-127 are dynamic
+	std::string		sdpFile;		// Session description for standard players, empty = none
+};
+
+// RTP/L16 sink. The capture thread copies samples into a lock-free ring and wakes a sender thread,
+// which cuts them into packets of packetMs and sends every batch to each destination.
+// Every packet carries a header extension with the calibrated rate and channel count, so
+// the receiver needs no SDP; players that do not know the extension skip it.
+class RtpSender
+{
+private:
+	struct Destination
+	{
+		std::string		name;
+		uint32_t		address;	// Network order
+		uint16_t		port;		// Network order
+	};
+
+	SampleRing				_ring;
+	HANDLE					_wake;
+
+	NetworkSettings			_settings;
+	SamplingRate_t			_samplingRate;
+	WORD					_channels;
+	std::vector<Destination> _destinations;
+	uintptr_t				_socket;
+	bool					_segmentOffload;	// One send per batch, the stack splits it into packets
+	size_t					_packetSamples;
+	std::vector<byte>		_batch;
+	uint16_t				_sequence;
+	uint32_t				_timestampBase;		// RTP time of ring position 0, samples dropped by the ring still advance it
+	uint32_t				_ssrc;
+	uint64_t				_packets;
+	uint64_t				_sends;
+	uint64_t				_sendErrors;
+
+	std::atomic<bool>		_running;
+	std::thread				_sender;
+
+	bool _parseDestinations();
+	void _writeSdp() const;
+	void _loop();
+	size_t _buildPacket(byte* out, uint64_t position, size_t count);	// count samples of the ring from position
+	void _send(const byte* data, size_t size, size_t packetBytes);
+
+	static constexpr int POLL_MS = 20;
+	static constexpr int RING_SEC = 2;
+	static constexpr size_t MAX_BATCH_BYTES = 60000;	// Below the 64 KB limit of one offloaded send
+
+	RtpSender(const RtpSender&) = delete;
+	RtpSender& operator=(const RtpSender&) = delete;
+
+public:
+	static constexpr size_t		HEADER_SIZE = 12;
+	static constexpr size_t		EXTENSION_SIZE = 8;
+	static constexpr uint16_t	EXTENSION_PROFILE = 0x5341;	// 'SA', one word: channels << 24 | sampling rate
+
+	RtpSender();
+	~RtpSender();
+
+	bool Start(const NetworkSettings& settings, SamplingRate_t samplingRate, WORD channels);
+	void Stop();	// Sends what is left in the ring
+
+	void Push(const WaveSample16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+};
+
+// Reference receiver: writes an RTP/L16 stream to a WAV or plays it, filling lost packets with silence
+namespace RtpReceiver
+{
+	struct Options
+	{
+		int				port;
+		std::string		group;			// Multicast group to join, empty = unicast
+		std::string		output;			// WAV file, or "play" for the default audio device
+		int				durationSec;	// Stop after this long, 0 = until F12
+		unsigned int	samplingRate;	// Used when the stream has no rate extension
+		int				channels;
+		int				playBufferMs;	// Audio held back before playback starts, absorbs network jitter
+	};
+
+	struct Report
+	{
+		uint64_t		packets;		// Received, including late ones
+		uint64_t		expected;		// From the sequence numbers of the first and highest packet
+		uint64_t		lost;			// expected - packets, never negative
+		uint64_t		late;			// Arrived after their audio was played or written, dropped
+		uint64_t		frames;			// Written or played, including silence for lost packets
+		uint64_t		silenceFrames;
+		double			jitterMs;		// RFC 3550 interarrival jitter
+		unsigned int	samplingRate;
+		int				channels;
+	};
+
+	Options DefaultOptions();
+
+	// Returns 0 when any audio was received, -1 when the socket or output could not be opened
+	int Run(const Options& options, Report& report);
+}
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include <new>
+#include <stdexcept>
+
+#include "SampleBlockPool.h"
+#include "Metrics.h"
+
+SampleBlockPool::SampleBlockPool(size_t blockBytes, size_t blockCount)
+	: _slab(nullptr)
+	, _blockStride(0)
+	, _blockCapacity(blockBytes)
+	, _blockCount(blockCount)
+	, _head(0)
+	, _inUse(0)
+	, _heapAllocations(0)
+{
+	if (blockBytes == 0 || blockCount == 0 || blockCount >= UINT32_MAX)
+		throw std::runtime_error("SampleBlockPool: invalid pool size.");
+
+	_blockStride = sizeof(SampleBlock) + blockBytes;
+	_blockStride = (_blockStride + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+	_slab = reinterpret_cast<byte*>(_aligned_malloc(_blockStride * _blockCount, CACHE_LINE_SIZE));
+	if (!_slab)
+		throw std::bad_alloc();
+
+	for (uint32_t i = 0; i < _blockCount; i++)
+	{
+		SampleBlock* block = new (_slab + i * _blockStride) SampleBlock;
+		block->header = { 0 };
+		block->owner = this;
+		block->nextFree = 0;
+		block->nextDone = nullptr;
+		block->size = 0;
+		block->capacity = _blockCapacity;
+		block->pooled = true;
+	}
+
+	for (uint32_t i = uint32_t(_blockCount); i > 0; i--)
+		_push(_blockAt(i - 1));
+}
+
+SampleBlockPool::~SampleBlockPool()
+{
+	for (uint32_t i = 0; i < _blockCount; i++)
+		_blockAt(i)->~SampleBlock();
+	_aligned_free(_slab);
+}
+
+SampleBlock* SampleBlockPool::_blockAt(uint32_t index) const
+{
+	return reinterpret_cast<SampleBlock*>(_slab + index * _blockStride);
+}
+
+uint32_t SampleBlockPool::_indexOf(const SampleBlock* block) const
+{
+	return uint32_t((reinterpret_cast<const byte*>(block) - _slab) / _blockStride);
+}
+
+void SampleBlockPool::_push(SampleBlock* block)
+{
+	uint64_t link = uint64_t(_indexOf(block)) + 1;
+	uint64_t head = _head.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do
+	{
+		block->nextFree.store(uint32_t(head & 0xFFFFFFFF), std::memory_order_relaxed);
+		newHead = ((head >> 32) + 1) << 32 | link;
+	} while (!_head.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+SampleBlock* SampleBlockPool::_pop()
+{
+	uint64_t head = _head.load(std::memory_order_acquire);
+	uint64_t newHead;
+	SampleBlock* block;
+	do
+	{
+		uint32_t link = uint32_t(head & 0xFFFFFFFF);
+		if (link == 0)
+			return nullptr;
+		block = _blockAt(link - 1);
+		newHead = ((head >> 32) + 1) << 32 | block->nextFree.load(std::memory_order_relaxed);
+	} while (!_head.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire));
+	return block;
+}
+
+SampleBlock* SampleBlockPool::TryAcquire()
+{
+	SampleBlock* block = _pop();
+	if (!block)
+		return nullptr;
+
+	block->header = { 0 };
+	block->size = 0;
+	block->arrivalNs = block->processedNs = block->submittedNs = 0;
+	_inUse.fetch_add(1, std::memory_order_relaxed);
+	return block;
+}
+
+SampleBlock* SampleBlockPool::Acquire()
+{
+	SampleBlock* block = TryAcquire();
+	if (block)
+		return block;
+
+	void* mem = _aligned_malloc(sizeof(SampleBlock) + _blockCapacity, CACHE_LINE_SIZE);
+	if (!mem)
+		throw std::bad_alloc();
+	block = new (mem) SampleBlock;
+	block->header = { 0 };
+	block->owner = this;
+	block->nextFree = 0;
+	block->nextDone = nullptr;
+	block->size = 0;
+	block->capacity = _blockCapacity;
+	block->pooled = false;
+	block->arrivalNs = block->processedNs = block->submittedNs = 0;
+	_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	appMetricAdd(PoolOverflowBlocks, 1);
+	_inUse.fetch_add(1, std::memory_order_relaxed);
+	return block;
+}
+
+void SampleBlockPool::Release(SampleBlock* block)
+{
+	if (!block)
+		return;
+
+	_inUse.fetch_sub(1, std::memory_order_relaxed);
+	if (!block->pooled)
+	{
+		block->~SampleBlock();
+		_aligned_free(block);
+		return;
+	}
+
+	_push(block);
+}
+
+size_t SampleBlockPool::GetBlockCapacity() const
+{
+	return _blockCapacity;
+}
+
+size_t SampleBlockPool::GetBlockCount() const
+{
+	return _blockCount;
+}
+
+size_t SampleBlockPool::GetBlocksInUse() const
+{
+	return _inUse.load(std::memory_order_relaxed);
+}
+
+size_t SampleBlockPool::GetHeapAllocations() const
+{
+	return _heapAllocations.load(std::memory_order_relaxed);
+}
+
+byte* SampleBlockPool::GetSlab() const
+{
+	return _slab;
+}
+
+size_t SampleBlockPool::GetSlabSize() const
+{
+	return _blockStride * _blockCount;
+}
+
+size_t SampleBlockPool::BlockBytesFor(DWORD samplingRate, int channels, WORD bps, int msBuffer)
+{
+	size_t frameBytes = size_t(channels) * (bps / 8);
+	size_t frames = (size_t(samplingRate) * msBuffer + 999) / 1000;
+	if (frames == 0)
+		frames = 1;
+	return frames * frameBytes;
+}
\ No newline at end of file
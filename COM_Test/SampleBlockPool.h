@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <Windows.h>
+#include <mmeapi.h>
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+class SampleBlockPool;
+
+// Fixed-size sample block. The WAVEHDR lives inside the block so a segment can be
+// queued to waveOut without any extra allocation, and the sample data follows
+// the block header on the next cache line.
+struct alignas(CACHE_LINE_SIZE) SampleBlock
+{
+	WAVEHDR				header;
+	SampleBlockPool*	owner;
+	std::atomic<uint32_t>	nextFree;	// Free list link: block index + 1, 0 terminates
+	SampleBlock*		nextDone;	// Link in the player's list of played blocks awaiting unprepare
+	size_t				size;		// Bytes used
+	size_t				capacity;	// Bytes available
+	bool				pooled;		// False if allocated from heap because the pool was empty
+	uint64_t			arrivalNs;	// Monotonic time the first bytes of the block were read
+	uint64_t			processedNs;	// Monotonic time gain was applied
+	uint64_t			submittedNs;	// Monotonic time the block was queued to waveOut
+
+	byte* data() { return reinterpret_cast<byte*>(this) + sizeof(SampleBlock); }
+	const byte* data() const { return reinterpret_cast<const byte*>(this) + sizeof(SampleBlock); }
+	size_t available() const { return capacity - size; }
+	bool full() const { return size >= capacity; }
+};
+
+// Preallocated slab of SampleBlocks recycled through a lock-free free list.
+// Acquire() is called by the capture thread, Release() may be called from any thread
+// (e.g. the waveOut callback). When the free list is empty, a block is allocated from
+// the heap and counted, so a correctly sized pool shows zero heap allocations.
+class SampleBlockPool
+{
+private:
+	byte*					_slab;
+	size_t					_blockStride;
+	size_t					_blockCapacity;
+	size_t					_blockCount;
+	std::atomic<uint64_t>	_head;			// Low 32 bits: block index + 1 (0 = empty), high 32 bits: ABA tag
+	std::atomic<size_t>		_inUse;
+	std::atomic<size_t>		_heapAllocations;
+
+	SampleBlock* _blockAt(uint32_t index) const;
+	uint32_t _indexOf(const SampleBlock* block) const;
+	void _push(SampleBlock* block);
+	SampleBlock* _pop();
+
+public:
+	SampleBlockPool(size_t blockBytes, size_t blockCount);
+	SampleBlockPool(const SampleBlockPool&) = delete;
+	SampleBlockPool& operator=(const SampleBlockPool&) = delete;
+	~SampleBlockPool();
+
+	SampleBlock* Acquire();
+	SampleBlock* TryAcquire();	// Never allocates, returns nullptr if the pool is empty
+	void Release(SampleBlock* block);
+
+	size_t GetBlockCapacity() const;
+	size_t GetBlockCount() const;
+	size_t GetBlocksInUse() const;
+	size_t GetHeapAllocations() const;
+	byte* GetSlab() const;
+	size_t GetSlabSize() const;
+
+	static size_t BlockBytesFor(DWORD samplingRate, int channels, WORD bps, int msBuffer);
+};
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <cstring>
+#include <algorithm>
+
+#include "SampleRing.h"
+
+SampleRing::SampleRing()
+	: _mask(0)
+	, _frameSamples(1)
+	, _writePos(0)
+	, _readPos(0)
+	, _droppedSamples(0)
+	, _gaps()
+	, _gapsWritten(0)
+	, _gapsRead(0)
+	, _droppedBefore(0)
+{
+}
+
+void SampleRing::Reset(size_t minSamples, size_t frameSamples)
+{
+	size_t size = 1;
+	while (size < minSamples)
+		size <<= 1;
+	_ring.assign(size, 0);
+	_mask = size - 1;
+	_frameSamples = (std::max)(frameSamples, size_t(1));
+	_writePos = 0;
+	_readPos = 0;
+	_droppedSamples = 0;
+	_gapsWritten = 0;
+	_gapsRead = 0;
+	_droppedBefore = 0;
+}
+
+size_t SampleRing::Push(const int16_t* samples, size_t count)
+{
+	uint64_t write = _writePos.load(std::memory_order_relaxed);
+	uint64_t read = _readPos.load(std::memory_order_acquire);
+	size_t space = _ring.size() - size_t(write - read);
+	if (count > space)
+	{
+		space -= space % _frameSamples;
+		uint64_t total = _droppedSamples.fetch_add(count - space, std::memory_order_relaxed) + count - space;
+		count = space;
+
+		uint64_t gaps = _gapsWritten.load(std::memory_order_relaxed);
+		if (gaps - _gapsRead.load(std::memory_order_acquire) < GAP_SLOTS)
+		{
+			_gaps[gaps % GAP_SLOTS] = { write + count, total };
+			_gapsWritten.store(gaps + 1, std::memory_order_release);
+		}
+	}
+
+	size_t offset = size_t(write) & _mask;
+	size_t first = (std::min)(count, _ring.size() - offset);
+	memcpy(_ring.data() + offset, samples, first * sizeof(int16_t));
+	memcpy(_ring.data(), samples + first, (count - first) * sizeof(int16_t));
+	_writePos.store(write + count, std::memory_order_release);
+	return count;
+}
+
+uint64_t SampleRing::GetWritePos() const
+{
+	return _writePos.load(std::memory_order_relaxed);
+}
+
+size_t SampleRing::Available() const
+{
+	return size_t(_writePos.load(std::memory_order_acquire) - _readPos.load(std::memory_order_relaxed));
+}
+
+size_t SampleRing::Peek(const int16_t*& samples) const
+{
+	uint64_t read = _readPos.load(std::memory_order_relaxed);
+	size_t offset = size_t(read) & _mask;
+	samples = _ring.data() + offset;
+	return (std::min)(Available(), _ring.size() - offset);
+}
+
+void SampleRing::Read(int16_t* out, size_t count)
+{
+	size_t offset = size_t(_readPos.load(std::memory_order_relaxed)) & _mask;
+	size_t first = (std::min)(count, _ring.size() - offset);
+	memcpy(out, _ring.data() + offset, first * sizeof(int16_t));
+	memcpy(out + first, _ring.data(), (count - first) * sizeof(int16_t));
+	Consume(count);
+}
+
+void SampleRing::Consume(size_t count)
+{
+	_readPos.store(_readPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+uint64_t SampleRing::GetReadPos() const
+{
+	return _readPos.load(std::memory_order_relaxed);
+}
+
+uint64_t SampleRing::DroppedBefore(uint64_t position)
+{
+	uint64_t gaps = _gapsWritten.load(std::memory_order_acquire);
+	uint64_t read = _gapsRead.load(std::memory_order_relaxed);
+	for (; read < gaps && _gaps[read % GAP_SLOTS].position <= position; read++)
+		_droppedBefore = _gaps[read % GAP_SLOTS].droppedTotal;
+	_gapsRead.store(read, std::memory_order_release);
+	return _droppedBefore;
+}
+
+uint64_t SampleRing::GetDroppedSamples() const
+{
+	return _droppedSamples.load(std::memory_order_relaxed);
+}
\ No newline at end of file
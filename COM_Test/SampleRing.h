@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer single-consumer ring of 16-bit samples between the capture thread and
+// a sink's worker thread. Push never blocks or allocates: when the worker falls behind, the part of
+// a block that does not fit is dropped and counted. Positions are absolute sample counts.
+class SampleRing
+{
+private:
+	std::vector<int16_t>	_ring;
+	size_t					_mask;
+	size_t					_frameSamples;
+	alignas(64) std::atomic<uint64_t> _writePos;
+	alignas(64) std::atomic<uint64_t> _readPos;
+	std::atomic<uint64_t>	_droppedSamples;
+
+	// Where samples were dropped, for consumers that keep a timeline. A gap that finds the table
+	// full is folded into the next one recorded.
+	struct Gap
+	{
+		uint64_t	position;		// Write position right after the drop
+		uint64_t	droppedTotal;	// Samples dropped up to and including this gap
+	};
+	static constexpr size_t GAP_SLOTS = 16;
+	Gap						_gaps[GAP_SLOTS];
+	alignas(64) std::atomic<uint64_t> _gapsWritten;
+	alignas(64) std::atomic<uint64_t> _gapsRead;
+	uint64_t				_droppedBefore;
+
+	SampleRing(const SampleRing&) = delete;
+	SampleRing& operator=(const SampleRing&) = delete;
+
+public:
+	SampleRing();
+
+	// Capacity is rounded up to a power of two. Neither side may run meanwhile.
+	void Reset(size_t minSamples, size_t frameSamples);
+
+	// Capture thread. Keeps whole frames, returns the samples stored.
+	size_t Push(const int16_t* samples, size_t count);
+	uint64_t GetWritePos() const;
+
+	// Worker thread
+	size_t Available() const;
+	size_t Peek(const int16_t*& samples) const;		// Contiguous samples at the read position, up to the wrap
+	void Read(int16_t* out, size_t count);			// Copies and consumes count <= Available() samples
+	void Consume(size_t count);
+	uint64_t GetReadPos() const;
+	uint64_t DroppedBefore(uint64_t position);		// Samples lost ahead of position, call with rising positions
+	inline int16_t At(uint64_t position) const
+	{
+		return _ring[size_t(position) & _mask];
+	}
+
+	uint64_t GetDroppedSamples() const;
+};
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include <stdexcept>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+
+#include "SampleSource.h"
+#include "Logger.h"
+#include "Clock.h"
+
+/****************
+ *	  SERIAL	*
+ ****************/
+
+SerialSource::SerialSource(const SerialSettings& settings)
+	: _settings(settings)
+{
+	SerialMgr::flowControl flow = SerialMgr::flowControl::None;
+	if (settings.flowControl == "RtsCts")
+		flow = SerialMgr::flowControl::RtsCts;
+	else if (settings.flowControl == "Pipeline")
+		flow = SerialMgr::flowControl::Manual;
+	if (_serial.openDevice(settings.port.c_str(), settings.baudRate, flow) != SerialMgr::errCode::Success)
+		throw std::runtime_error("Failed to open serial port");
+	appLog(Info) << "Connected to " << settings.port << " with baud rate " << settings.baudRate << ", flow control " << settings.flowControl;
+
+	if (!_serial.setupBuffers(DWORD(settings.rxBufferBytes), DWORD(settings.txBufferBytes)))
+		appLog(Warning) << "Serial: driver refused queue sizes " << settings.rxBufferBytes << "/" << settings.txBufferBytes << ", error " << GetLastError();
+	if (settings.readIntervalMs > 0 && !_serial.setReadInterval(DWORD(settings.readIntervalMs)))
+		appLog(Warning) << "Serial: cannot set read interval " << settings.readIntervalMs << " ms";
+	_serial.pollErrors();	// Errors from before the port was ours
+}
+
+SerialSource::~SerialSource()
+{
+	const SerialMgr::errorCounts& errors = _serial.getErrorCounts();
+	if (errors.overrun || errors.rxOverflow || errors.frame || errors.parity || errors.breaks)
+		appLog(Warning) << "Serial line errors: " << errors.overrun << " UART overruns, " << errors.rxOverflow << " input queue overflows, "
+			<< errors.frame << " framing, " << errors.parity << " parity, " << errors.breaks << " breaks";
+	_serial.closeDevice();
+}
+
+int SerialSource::Read(void* buffer, unsigned int size)
+{
+	return _serial.readBytes(buffer, size, 0);
+}
+
+uint64_t SerialSource::NowNs() const
+{
+	return Clock::NowNs();
+}
+
+bool SerialSource::AtEnd() const
+{
+	return false;
+}
+
+std::string SerialSource::GetName() const
+{
+	return _settings.port;
+}
+
+unsigned int SerialSource::GetBaudRate() const
+{
+	return _settings.baudRate;
+}
+
+DWORD SerialSource::TakeLineErrors()
+{
+	return _serial.pollErrors();
+}
+
+bool SerialSource::SetReceiveReady(bool ready)
+{
+	return _settings.flowControl == "Pipeline" && _serial.RTS(ready);
+}
+
+SerialMgr& SerialSource::GetSerial()
+{
+	return _serial;
+}
+
+/****************
+ *	  REPLAY	*
+ ****************/
+
+ReplaySource::ReplaySource(const std::string& fileName, bool realtime)
+	: _in(fileName, std::ios::binary)
+	, _fileName(fileName)
+	, _header({})
+	, _buffer(READ_CHUNK)
+	, _pos(0)
+	, _end(0)
+	, _realtime(realtime)
+	, _atEnd(false)
+	, _recordUs(0)
+	, _recordLeft(0)
+	, _wallStartNs(0)
+{
+	if (!_in)
+		throw std::runtime_error("Cannot open raw capture " + fileName);
+	if (!_in.read(reinterpret_cast<char*>(&_header), sizeof(_header))
+		|| memcmp(_header.magic, RawCaptureWriter::MAGIC, sizeof(RawCaptureWriter::MAGIC)) != 0
+		|| _header.version != RawCaptureWriter::VERSION)
+		throw std::runtime_error(fileName + " is not a raw capture file");
+
+	appLog(Info) << "Replaying " << fileName << " captured from " << _header.port << " at " << _header.baudRate
+		<< " baud, " << (_realtime ? "original timing" : "maximum speed");
+}
+
+bool ReplaySource::_fill(size_t need)
+{
+	if (_end - _pos >= need)
+		return true;
+
+	// Keep the unread tail and append the next chunk
+	memmove(_buffer.data(), _buffer.data() + _pos, _end - _pos);
+	_end -= _pos;
+	_pos = 0;
+	if (_buffer.size() < need)
+		_buffer.resize(need);
+	_in.read(reinterpret_cast<char*>(_buffer.data() + _end), std::streamsize(_buffer.size() - _end));
+	_end += size_t(_in.gcount());
+	return _end - _pos >= need;
+}
+
+bool ReplaySource::_getVarint(uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (!_fill(1))
+			return false;
+		byte b = _buffer[_pos++];
+		value |= uint64_t(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool ReplaySource::_nextRecord()
+{
+	uint64_t delta, length;
+	if (!_getVarint(delta) || !_getVarint(length))
+		return false;
+	_recordUs += delta;
+	_recordLeft = size_t(length);
+	return true;
+}
+
+void ReplaySource::_pace() const
+{
+	if (!_realtime)
+		return;
+
+	uint64_t due = _wallStartNs + _recordUs * 1000;
+	for (uint64_t now = Clock::NowNs(); now < due; now = Clock::NowNs())
+	{
+		uint64_t waitMs = (due - now) / 1000000;
+		if (waitMs > 1)
+			Sleep(DWORD(waitMs - 1));
+		else
+			std::this_thread::yield();
+	}
+}
+
+int ReplaySource::Read(void* buffer, unsigned int size)
+{
+	if (_wallStartNs == 0)
+		_wallStartNs = Clock::NowNs();
+
+	byte* out = static_cast<byte*>(buffer);
+	unsigned int done = 0;
+	while (done < size)
+	{
+		if (_recordLeft == 0)
+		{
+			if (!_nextRecord())
+			{
+				if (!_atEnd)
+					appLog(Info) << "Replay of " << _fileName << " finished.";
+				_atEnd = true;
+				break;
+			}
+			_pace();
+			continue;
+		}
+
+		if (!_fill(1))
+		{
+			_atEnd = true;
+			break;
+		}
+		size_t chunk = (std::min)({ size_t(size - done), _recordLeft, _end - _pos });
+		memcpy(out + done, _buffer.data() + _pos, chunk);
+		_pos += chunk;
+		_recordLeft -= chunk;
+		done += unsigned(chunk);
+	}
+	return int(done);
+}
+
+uint64_t ReplaySource::NowNs() const
+{
+	return _recordUs * 1000;
+}
+
+bool ReplaySource::AtEnd() const
+{
+	return _atEnd;
+}
+
+std::string ReplaySource::GetName() const
+{
+	return _fileName;
+}
+
+unsigned int ReplaySource::GetBaudRate() const
+{
+	return _header.baudRate;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "Serial.h"
+#include "RawCapture.h"
+
+struct SerialSettings
+{
+	std::string		port;
+	unsigned int	baudRate;
+	int				rxBufferBytes;	// Driver input queue, absorbs stalls of the capture thread
+	int				txBufferBytes;
+	int				readIntervalMs;	// Idle line time that ends a read early, 0 = reads wait for the whole block
+	std::string		flowControl;	// "None", "RtsCts": the driver handshakes on its queue, "Pipeline": RTS follows the playback queue
+	int				flowHighMs;		// Pipeline mode: queued playback audio that deasserts RTS
+	int				flowLowMs;		// Pipeline mode: RTS is asserted again once the queue drained below this
+};
+
+// Byte stream feeding SerialAudioSampler: a live serial port or a recorded raw capture
+class SampleSource
+{
+public:
+	virtual ~SampleSource() = default;
+
+	// Blocks until size bytes were read, like SerialMgr::readBytes without timeout.
+	// Returns the bytes read, less than size only on error or at the end of the data.
+	virtual int Read(void* buffer, unsigned int size) = 0;
+
+	// Time base of the data in ns: the monotonic clock for live input, the recorded time during replay
+	virtual uint64_t NowNs() const = 0;
+
+	virtual bool AtEnd() const = 0;
+	virtual std::string GetName() const = 0;
+	virtual unsigned int GetBaudRate() const = 0;
+
+	// CE_* line error flags raised since the last call; set flags mean bytes were lost or corrupted
+	virtual DWORD TakeLineErrors() { return 0; }
+
+	// Asks the sender to pause (false) or resume (true), false if the source cannot signal it
+	virtual bool SetReceiveReady(bool ready) { return false; }
+};
+
+class SerialSource : public SampleSource
+{
+private:
+	SerialMgr		_serial;
+	SerialSettings	_settings;
+
+public:
+	SerialSource(const SerialSettings& settings);
+	~SerialSource();
+
+	int Read(void* buffer, unsigned int size) override;
+	uint64_t NowNs() const override;
+	bool AtEnd() const override;
+	std::string GetName() const override;
+	unsigned int GetBaudRate() const override;
+	DWORD TakeLineErrors() override;
+	bool SetReceiveReady(bool ready) override;
+
+	SerialMgr& GetSerial();
+};
+
+// Feeds a RawCaptureWriter file back into the pipeline, with the original timing or as fast as possible
+class ReplaySource : public SampleSource
+{
+private:
+	std::ifstream		_in;
+	std::string			_fileName;
+	RawCaptureHeader	_header;
+	std::vector<byte>	_buffer;
+	size_t				_pos;
+	size_t				_end;
+	bool				_realtime;
+	bool				_atEnd;
+	uint64_t			_recordUs;		// Recorded time of the current record
+	size_t				_recordLeft;	// Unread bytes of the current record
+	uint64_t			_wallStartNs;	// Monotonic time replay started, for realtime pacing
+
+	bool _fill(size_t need);
+	bool _getVarint(uint64_t& value);
+	bool _nextRecord();
+	void _pace() const;
+
+	static constexpr size_t READ_CHUNK = 256 * 1024;
+
+public:
+	ReplaySource(const std::string& fileName, bool realtime);
+
+	int Read(void* buffer, unsigned int size) override;
+	uint64_t NowNs() const override;
+	bool AtEnd() const override;
+	std::string GetName() const override;
+	unsigned int GetBaudRate() const override;
+};
\ No newline at end of file
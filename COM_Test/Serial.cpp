@@ -1,14 +1,16 @@
 #include "Serial.h"
+#include "Profiler.h"
+#include "Clock.h"
 #include <stdexcept>
 #include <thread>
 #include <chrono>
 
-using uint64_t = unsigned long long int;
-
 SerialMgr::SerialMgr()
     : _hSerial(NULL)
     , _timeouts({0,0,0,0,0})
+    , _timeoutsApplied(false)
     , _baudRate(0)
+    , _errors({0,0,0,0,0})
 {
     _currentStateRTS = true;
     _currentStateDTR = true;
@@ -19,7 +21,7 @@ SerialMgr::~SerialMgr()
     closeDevice();
 }
 
-SerialMgr::errCode SerialMgr::openDevice(std::string port, const unsigned int Bauds)
+SerialMgr::errCode SerialMgr::openDevice(std::string port, const unsigned int Bauds, flowControl flow)
 {
     port = "\\\\.\\" + port;
     _hSerial = CreateFileA(port.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
@@ -57,6 +59,14 @@ SerialMgr::errCode SerialMgr::openDevice(std::string port, const unsigned int Ba
     dcbSerialParams.ByteSize = 8;
     dcbSerialParams.StopBits = ONESTOPBIT;
     dcbSerialParams.Parity = NOPARITY;
+    // Keep reading after line errors, pollErrors() reports them
+    dcbSerialParams.fAbortOnError = FALSE;
+    if (flow != flowControl::None)
+    {
+        dcbSerialParams.fOutxCtsFlow = TRUE;
+        dcbSerialParams.fRtsControl = flow == flowControl::RtsCts ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+        _currentStateRTS = true;
+    }
 
     if (!SetCommState(_hSerial, &dcbSerialParams)) 
         return errCode::SetCommStateFailed;
@@ -70,6 +80,8 @@ SerialMgr::errCode SerialMgr::openDevice(std::string port, const unsigned int Ba
     if (!SetCommTimeouts(_hSerial, &_timeouts)) 
         return errCode::SetCommTimeoutFailed;
 
+    _timeoutsApplied = true;
+    _errors = {0,0,0,0,0};
     _baudRate = Bauds;
     return errCode::Success;
 }
@@ -115,9 +127,7 @@ bool SerialMgr::writeBytes(const void* Buffer, const unsigned int NbBytes)
 SerialMgr::errCode SerialMgr::readChar(char* pByte, unsigned int timeOut_ms)
 {
     DWORD dwBytesRead = 0;
-    _timeouts.ReadTotalTimeoutConstant = timeOut_ms;
-
-    if (!SetCommTimeouts(_hSerial, &_timeouts))
+    if (!applyReadTimeout(timeOut_ms))
         return errCode::SetCommTimeoutFailed;
 
     if (!ReadFile(_hSerial, pByte, 1, &dwBytesRead, NULL))
@@ -131,9 +141,7 @@ SerialMgr::errCode SerialMgr::readChar(char* pByte, unsigned int timeOut_ms)
 SerialMgr::errCode SerialMgr::readByte(byte* pByte, unsigned int timeOut_ms)
 {
     DWORD dwBytesRead = 0;
-    _timeouts.ReadTotalTimeoutConstant = timeOut_ms;
-
-    if (!SetCommTimeouts(_hSerial, &_timeouts))
+    if (!applyReadTimeout(timeOut_ms))
         return errCode::SetCommTimeoutFailed;
 
     if (!ReadFile(_hSerial, pByte, 1, &dwBytesRead, NULL))
@@ -212,13 +220,35 @@ int SerialMgr::readString(char* receivedString, char finalChar, unsigned int max
 
 int SerialMgr::readBytes(void* buffer, unsigned int maxNbBytes, unsigned int timeOut_ms)
 {
+    PROFILE_ZONE("SerialMgr::readBytes");
     DWORD dwBytesRead = 0;
-    _timeouts.ReadTotalTimeoutConstant = (DWORD)timeOut_ms;
-    if (!SetCommTimeouts(_hSerial, &_timeouts)) return -1;
+    if (!applyReadTimeout((DWORD)timeOut_ms)) return -1;
     if (!ReadFile(_hSerial, buffer, (DWORD)maxNbBytes, &dwBytesRead, NULL))  return -2;
     return dwBytesRead;
 }
 
+bool SerialMgr::applyReadTimeout(DWORD timeOut_ms)
+{
+    // SetCommTimeouts is a driver call, most reads use the same timeout as the previous one
+    if (_timeoutsApplied && _timeouts.ReadTotalTimeoutConstant == timeOut_ms)
+        return true;
+    _timeouts.ReadTotalTimeoutConstant = timeOut_ms;
+    _timeoutsApplied = SetCommTimeouts(_hSerial, &_timeouts) != FALSE;
+    return _timeoutsApplied;
+}
+
+bool SerialMgr::setupBuffers(DWORD rxBytes, DWORD txBytes)
+{
+    return SetupComm(_hSerial, rxBytes, txBytes) != FALSE;
+}
+
+bool SerialMgr::setReadInterval(DWORD interval_ms)
+{
+    _timeouts.ReadIntervalTimeout = interval_ms;
+    _timeoutsApplied = SetCommTimeouts(_hSerial, &_timeouts) != FALSE;
+    return _timeoutsApplied;
+}
+
 bool SerialMgr::flushReceiver()
 {
     if (PurgeComm(_hSerial, PURGE_RXCLEAR)) return true; else return false;
@@ -226,12 +256,34 @@ bool SerialMgr::flushReceiver()
 
 int SerialMgr::available()
 {
-    DWORD commErrors;
-    COMSTAT commStatus;
-    ClearCommError(_hSerial, &commErrors, &commStatus);
+    COMSTAT commStatus = {};
+    clearErrors(&commStatus);
     return commStatus.cbInQue;
 }
 
+DWORD SerialMgr::clearErrors(COMSTAT* status)
+{
+    DWORD commErrors = 0;
+    if (!ClearCommError(_hSerial, &commErrors, status))
+        return 0;
+    if (commErrors & CE_OVERRUN)  _errors.overrun++;
+    if (commErrors & CE_RXOVER)   _errors.rxOverflow++;
+    if (commErrors & CE_FRAME)    _errors.frame++;
+    if (commErrors & CE_RXPARITY) _errors.parity++;
+    if (commErrors & CE_BREAK)    _errors.breaks++;
+    return commErrors;
+}
+
+DWORD SerialMgr::pollErrors()
+{
+    return clearErrors(NULL);
+}
+
+const SerialMgr::errorCounts& SerialMgr::getErrorCounts() const
+{
+    return _errors;
+}
+
 bool SerialMgr::DTR(bool status)
 {
     if (status)
@@ -248,7 +300,7 @@ bool SerialMgr::setDTR()
 
 bool SerialMgr::clearDTR()
 {
-    _currentStateDTR = true;
+    _currentStateDTR = false;
     return EscapeCommFunction(_hSerial, CLRDTR);
 }
 
@@ -262,7 +314,7 @@ bool SerialMgr::RTS(bool status)
 
 bool SerialMgr::setRTS()
 {
-    _currentStateRTS = false;
+    _currentStateRTS = true;
     return EscapeCommFunction(_hSerial, SETRTS);
 }
 
@@ -311,43 +363,15 @@ bool SerialMgr::isRTS()
 }
 
 SerialMgr::timeOut::timeOut()
-    : _prevTime({ 0,0 })
+    : _startNs(0)
 {}
 
-int gettimeofday(timeval_t * tp, struct timezone * tzp)
-{
-    static const uint64_t EPOCH = ((uint64_t) 116444736000000000ULL);
-
-    SYSTEMTIME  system_time;
-    FILETIME    file_time;
-    uint64_t    time;
-
-    GetSystemTime( &system_time );
-    SystemTimeToFileTime( &system_time, &file_time );
-    time =  ((uint64_t)file_time.dwLowDateTime )      ;
-    time += ((uint64_t)file_time.dwHighDateTime) << 32;
-
-    tp->tv_sec  = (long) ((time - EPOCH) / 10000000L);
-    tp->tv_usec = (long) (system_time.wMilliseconds * 1000);
-    return 0;
-}
-
 void SerialMgr::timeOut::initTimer()
 {
-    gettimeofday(&_prevTime, NULL);
+    _startNs = Clock::NowNs();
 }
 
 UINT32 SerialMgr::timeOut::elapsedTime_ms()
 {
-    timeval_t CurrentTime;
-    int sec, usec;
-    gettimeofday(&CurrentTime, NULL);
-    sec = CurrentTime.tv_sec - _prevTime.tv_sec;
-    usec = CurrentTime.tv_usec - _prevTime.tv_usec;
-    if (usec < 0)
-    {
-        usec = 1000000 - _prevTime.tv_usec + CurrentTime.tv_usec;
-        sec--;
-    }
-    return sec * 1000 + usec / 1000;
-}
+    return UINT32((Clock::NowNs() - _startNs) / 1000000);
+}
\ No newline at end of file
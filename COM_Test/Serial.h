@@ -2,12 +2,7 @@
 
 #include <windows.h>
 #include <string>
-
-struct timeval_t
-{
-    long tv_sec;
-    long tv_usec;
-};
+#include <cstdint>
 
 class SerialMgr
 {
@@ -25,9 +20,26 @@ public:
         ReadFileFailed
     };
 
+    enum class flowControl
+    {
+        None,       // DCB flow control fields left as the driver has them
+        RtsCts,     // The driver drops RTS when its input queue fills up, CTS gates our output
+        Manual      // RTS starts asserted and is driven by RTS()/setRTS()/clearRTS(), CTS gates our output
+    };
+
+    // Line errors reported by ClearCommError, counted since openDevice
+    struct errorCounts
+    {
+        uint64_t    overrun;        // CE_OVERRUN: the UART FIFO overflowed, bytes lost in hardware
+        uint64_t    rxOverflow;     // CE_RXOVER: the driver's input queue was full, bytes lost
+        uint64_t    frame;          // CE_FRAME
+        uint64_t    parity;         // CE_RXPARITY
+        uint64_t    breaks;         // CE_BREAK
+    };
+
     class timeOut
     {
-        timeval_t   _prevTime;
+        uint64_t    _startNs;
 
     public:
         timeOut();
@@ -40,17 +52,26 @@ private:
     bool            _currentStateDTR;
     HANDLE          _hSerial;
     COMMTIMEOUTS    _timeouts;
+    bool            _timeoutsApplied;   // _timeouts matches the driver, reads skip SetCommTimeouts
     unsigned int    _baudRate;
+    errorCounts     _errors;
 
     int readStringNoTimeOut(char* String, char FinalChar, unsigned int MaxNbBytes);
+    bool applyReadTimeout(DWORD timeOut_ms);
+    DWORD clearErrors(COMSTAT* status);
 
 public:
     SerialMgr();
     ~SerialMgr();
 
-    errCode openDevice(std::string port, const unsigned int Bauds);
+    errCode openDevice(std::string port, const unsigned int Bauds, flowControl flow = flowControl::None);
     void closeDevice();
 
+    // Driver queue sizes, call after openDevice. The driver may round or ignore them.
+    bool setupBuffers(DWORD rxBytes, DWORD txBytes);
+    // A read returns early once the line is idle this long after the first byte, 0 = reads wait for every byte
+    bool setReadInterval(DWORD interval_ms);
+
     int getCurrentBaudRate();
 
     errCode readChar(char* pByte, const unsigned int timeOut_ms = 0);
@@ -66,6 +87,9 @@ public:
     bool flushReceiver();
     int available();
 
+    DWORD pollErrors();     // CE_* flags raised since the last call, also counted
+    const errorCounts& getErrorCounts() const;
+
     bool DTR(bool status);
     bool setDTR();
     bool clearDTR();
@@ -1,18 +1,55 @@
 #include <stdexcept>
 #include <thread>
+#include <fstream>
+#include <algorithm>
 
 #include "SerialAudioSampler.h"
 #include "Logger.h"
+#include "TraceLog.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "Clock.h"
 
-SerialAudioSampler::SerialAudioSampler(const std::string& port, int baudRate, UINT SamplingRateCalculationDurSec)
-	: _isSampling(false)
+SerialAudioSampler::SerialAudioSampler(const SerialSettings& serial, UINT SamplingRateCalculationDurSec, const std::string& rawCaptureFile)
+	: SerialAudioSampler(std::unique_ptr<SampleSource>(new SerialSource(serial)), SamplingRateCalculationDurSec, rawCaptureFile)
+{
+	if (serial.flowControl == "Pipeline")
+	{
+		_flowHighMs = (std::min)(serial.flowHighMs, POOL_HEADROOM_MS);
+		_flowLowMs = serial.flowLowMs < _flowHighMs ? serial.flowLowMs : _flowHighMs / 2;
+		appLog(Info) << "Pipeline flow control: RTS off above " << _flowHighMs << " ms of queued playback, on again below " << _flowLowMs << " ms";
+	}
+}
+
+SerialAudioSampler::SerialAudioSampler(std::unique_ptr<SampleSource> source, UINT SamplingRateCalculationDurSec, const std::string& rawCaptureFile)
+	: _source(std::move(source))
+	, _isSampling(false)
 	, _stopFlag(false)
+	, _rt({ false, THREAD_PRIORITY_TIME_CRITICAL, 0, true, 0 })
+	, _activity({ false, "Cues", 0, 0, 1, 10, 0, 0 })
+	, _writeOverview(false)
+	, _gain(DEFAULT_GAIN)
+	, _streamBufferMs(0)
+	, _segmentBytes(0)
+	, _lineErrorReads(0)
+	, _capturedBytes(0)
+	, _flowHighMs(0)
+	, _flowLowMs(0)
+	, _flowPauses(0)
+	, _flowPausedNs(0)
 {
-	if (_serial.openDevice(port.c_str(), baudRate) != SerialMgr::errCode::Success)
-		throw std::runtime_error("Failed to open serial port");
-	appLog(Info) << "Connected to " << port << " with baud rate " << baudRate;
+	// Allocated up front so realtime capture does not allocate per line error
+	_lineGaps.reserve(MAX_LINE_GAPS);
+	if (!rawCaptureFile.empty())
+	{
+		_recorder.reset(new RawCaptureWriter());
+		if (!_recorder->Open(rawCaptureFile, _source->GetName(), _source->GetBaudRate(), _source->NowNs()))
+			_recorder.reset();
+	}
+
 	appLog(Info) << "Calculating sampling rate... " << "Measure time (sec): " << SamplingRateCalculationDurSec;
 	auto freq = _calculateSamplingRate(SamplingRateCalculationDurSec);
+	appMetricSet(CalibratedSampleRate, freq);
 
 	constexpr auto bps = sizeof(WaveSample16_t) * 8;
 	constexpr auto channels = 1;
@@ -22,7 +59,11 @@ SerialAudioSampler::SerialAudioSampler(const std::string& port, int baudRate, UI
 
 SerialAudioSampler::~SerialAudioSampler()
 {
-	_serial.closeDevice();
+	Stop();
+	Sync();
+	if (_recorder)
+		_recorder->Close();
+	_source.reset();
 	appLog(Debug) << "SerialAudioSampler destroyed.";
 }
 
@@ -30,14 +71,15 @@ SamplingRate_t SerialAudioSampler::_calculateSamplingRate(UINT dur)
 {
 	SamplingRate_t frequency = 0;
 	std::vector<SamplingRate_t> measurements;
-	auto time = Utils::getTimeMs();
+	// Measured on the source's clock, so a replay calibrates to the recorded rate at any speed
+	auto time = int64_t(_source->NowNs() / 1000000);
 	auto last = time;
 	constexpr int measureInterval = 100;
 	SamplingRate_t samplingRateHz;
 
 	while (measurements.size() < (dur * (1000 / measureInterval)))
 	{
-		time = Utils::getTimeMs();
+		time = int64_t(_source->NowNs() / 1000000);
 		if ((time - last) >= measureInterval)
 		{
 			measurements.push_back(frequency);
@@ -45,7 +87,8 @@ SamplingRate_t SerialAudioSampler::_calculateSamplingRate(UINT dur)
 			frequency = 0;
 		}
 		byte dummy[2];
-		_serial.readBytes(dummy, sizeof(dummy), 0);
+		if (_read(dummy, sizeof(dummy)) < int(sizeof(dummy)) && _source->AtEnd())
+			throw std::runtime_error("Input ended during sampling rate calculation");
 		frequency++;
 	}
 
@@ -55,6 +98,57 @@ SamplingRate_t SerialAudioSampler::_calculateSamplingRate(UINT dur)
 	return samplingRateHz;
 }
 
+void SerialAudioSampler::SetRealtimeMode(const RealtimeSettings& settings)
+{
+	if (_isSampling.load())
+		throw std::runtime_error("Cannot do SetRealtimeMode(). Already working.");
+
+	_rt = settings;
+	if (_rt.enabled)
+	{
+		appLog(Info) << "Realtime capture mode enabled.";
+		RealtimeMode::RaiseProcessPriority();
+	}
+}
+
+void SerialAudioSampler::SetActivityGate(const ActivitySettings& settings)
+{
+	if (_isSampling.load())
+		throw std::runtime_error("Cannot do SetActivityGate(). Already working.");
+
+	_activity = settings;
+}
+
+void SerialAudioSampler::SetWriteOverview(bool enabled)
+{
+	if (_isSampling.load())
+		throw std::runtime_error("Cannot do SetWriteOverview(). Already working.");
+
+	_writeOverview = enabled;
+}
+
+void SerialAudioSampler::_enterRealtime(void* buffer, size_t size)
+{
+	if (!_rt.enabled)
+		return;
+
+	// The zone ring was allocated by PROFILE_THREAD, it is written from the hot loop as well
+	void* ring = nullptr;
+	size_t ringSize = 0;
+	_____PROFILER::___Profiler.GetThreadRing(ring, ringSize);
+
+	RealtimeMode::SetupCurrentThread(_rt);
+	RealtimeMode::Prefault(_pool->GetSlab(), _pool->GetSlabSize());
+	RealtimeMode::Prefault(buffer, size);
+	RealtimeMode::Prefault(ring, ringSize);
+	if (_rt.lockMemory)
+	{
+		RealtimeMode::LockMemory(_pool->GetSlab(), _pool->GetSlabSize());
+		RealtimeMode::LockMemory(buffer, size);
+		RealtimeMode::LockMemory(ring, ringSize);
+	}
+}
+
 void SerialAudioSampler::StartSamplingToFile(const std::string& fileName)
 {
 	if (_isSampling.load())
@@ -62,7 +156,12 @@ void SerialAudioSampler::StartSamplingToFile(const std::string& fileName)
 
 	_isSampling = true;
 	_stopFlag = false;
+	_lineGaps.clear();
+	_lineErrorReads = 0;
+	_capturedBytes = 0;
 
+	auto blockBytes = SampleBlockPool::BlockBytesFor(_wave->GetSamplingRate(), _wave->GetChannels(), _wave->GetBPS(), FILE_READ_BLOCK_MS);
+	_pool.reset(new SampleBlockPool(blockBytes, 1));
 	_worker = std::thread(&SerialAudioSampler::_sampleToFile, this, fileName);
 }
 
@@ -71,55 +170,364 @@ void SerialAudioSampler::StartSamplingToWaveStream(int msBuffer, UINT device)
 	if (_isSampling.load())
 		throw std::runtime_error("Cannot do StartSamplingToWaveStream(). Already working.");
 
+	_startStreaming(msBuffer, true, device);
+}
+
+void SerialAudioSampler::StartSamplingToSinks(int msBuffer)
+{
+	if (_isSampling.load())
+		throw std::runtime_error("Cannot do StartSamplingToSinks(). Already working.");
+	if (_sinks.empty())
+		throw std::runtime_error("Cannot do StartSamplingToSinks(). No sinks added.");
+
+	_startStreaming(msBuffer, false, 0);
+}
+
+void SerialAudioSampler::_startStreaming(int msBuffer, bool playback, UINT device)
+{
 	_isSampling = true;
 	_stopFlag = false;
+	_lineGaps.clear();
+	_lineErrorReads = 0;
+	_capturedBytes = 0;
+
+	msBuffer = (std::max)(msBuffer, STREAM_BUFFER_MIN_MS);
+	auto blockBytes = SampleBlockPool::BlockBytesFor(_wave->GetSamplingRate(), _wave->GetChannels(), _wave->GetBPS(), (std::max)(msBuffer, STREAM_BUFFER_MAX_MS));
+	auto blockCount = (std::max<size_t>)(POOL_MIN_BLOCKS, POOL_HEADROOM_MS / msBuffer + 2);
+	_pool.reset(new SampleBlockPool(blockBytes, blockCount));
+	appLog(Debug) << "Sample block pool: " << blockCount << " blocks of " << blockBytes << " bytes";
+	SetStreamBufferMs(msBuffer);
 
-	_wave->Initialize(device, _wave->GetBPS(), _wave->GetSamplingRate(), _wave->GetChannels());
-	_worker = std::thread(&SerialAudioSampler::_sampleToStream, this, msBuffer);
+	if (playback)
+		_wave->Initialize(device, _wave->GetBPS(), _wave->GetSamplingRate(), _wave->GetChannels());
+	_worker = std::thread(&SerialAudioSampler::_sampleToStream, this, msBuffer, playback);
+}
+
+void SerialAudioSampler::AddSink(SampleSink sink)
+{
+	if (_isSampling.load())
+		throw std::runtime_error("Cannot do AddSink(). Already working.");
+
+	_sinks.push_back(std::move(sink));
+}
+
+SamplingRate_t SerialAudioSampler::GetSamplingRate() const
+{
+	return _wave->GetSamplingRate();
+}
+
+WORD SerialAudioSampler::GetChannels() const
+{
+	return WORD(_wave->GetChannels());
+}
+
+void SerialAudioSampler::_emit(const SampleBlock* block)
+{
+	PROFILE_ZONE("Sinks");
+	auto samples = reinterpret_cast<const WaveSample16_t*>(block->data());
+	size_t count = block->size / sizeof(WaveSample16_t);
+	appMetricAdd(Samples, count);
+	for (auto& sink : _sinks)
+		sink(samples, count);
+}
+
+int SerialAudioSampler::_read(void* buffer, unsigned int size)
+{
+	int read = _source->Read(buffer, size);
+	if (read > 0 && _recorder)
+		_recorder->Write(_source->NowNs(), buffer, size_t(read));
+	return read;
+}
+
+void SerialAudioSampler::_readBlock(SampleBlock* block, size_t bytes)
+{
+	PROFILE_ZONE("ReadBlock");
+	if (bytes > block->capacity)
+		bytes = block->capacity;
+
+	while (block->size < bytes && _stopFlag.load() == false)
+	{
+		uint64_t start = TRACE_NOW();
+		unsigned int wanted = unsigned(bytes - block->size);
+		int read = _read(block->data() + block->size, wanted);
+		appTrace(SerialRead, read, TRACE_NOW() - start);
+		appMetricAdd(SerialReads, 1);
+		if (read > 0)
+		{
+			if (block->size == 0)
+				block->arrivalNs = METRICS_NOW();
+			block->size += read;
+			_capturedBytes += read;
+			appMetricAdd(SerialBytes, read);
+		}
+		// ClearCommError is a driver call: poll after short reads, where errors interrupt the data, and once per block
+		if (read < int(wanted) || block->size >= bytes)
+			_checkLine();
+		if (_source->AtEnd())
+		{
+			_stopFlag = true;
+			break;
+		}
+	}
+}
+
+void SerialAudioSampler::_checkLine()
+{
+	DWORD errors = _source->TakeLineErrors();
+	if (!errors)
+		return;
+
+	uint64_t sample = _capturedBytes / sizeof(WaveSample16_t);
+	_lineErrorReads++;
+	if (errors & (CE_OVERRUN | CE_RXOVER))
+		appMetricAdd(SerialOverruns, 1);
+	if (errors & (CE_FRAME | CE_RXPARITY | CE_BREAK))
+		appMetricAdd(SerialLineErrors, 1);
+	appTrace(LineError, errors, sample);
+	PROFILE_INSTANT("LineError");
+	if (_lineGaps.size() < MAX_LINE_GAPS)
+		_lineGaps.push_back({ sample, errors });
+}
+
+void SerialAudioSampler::_throttle()
+{
+	if (_wave->GetQueuedMs() < _flowHighMs)
+		return;
+
+	// Reads stop meanwhile: with RTS down a read could wait forever for bytes the sender holds back
+	PROFILE_ZONE("FlowControl");
+	uint64_t startNs = Clock::NowNs();
+	_source->SetReceiveReady(false);
+	appTrace(FlowControl, 1, _wave->GetQueuedMs());
+	while (_stopFlag.load() == false && _wave->GetQueuedMs() > _flowLowMs)
+		Sleep(1);
+	_source->SetReceiveReady(true);
+	appTrace(FlowControl, 0, _wave->GetQueuedMs());
+	appMetricAdd(FlowControlPauses, 1);
+	_flowPauses++;
+	_flowPausedNs += Clock::NowNs() - startNs;
+}
+
+void SerialAudioSampler::_reportLineGaps(const std::string& fileName) const
+{
+	if (_lineErrorReads == 0)
+		return;
+
+	double framesPerSec = double(_wave->GetSamplingRate()) * _wave->GetChannels();
+	appLog(Warning) << "Serial line errors after " << _lineErrorReads << " reads, the first near "
+		<< _lineGaps.front().sample / framesPerSec << " s of the capture";
+	if (fileName.empty())
+		return;
+
+	std::string gapFile = fileName + ".gaps.csv";
+	std::ofstream out(gapFile, std::ios::trunc);
+	if (!out)
+	{
+		appLog(Warning) << "Cannot write " << gapFile;
+		return;
+	}
+	out << "capture_sample,capture_sec,overrun,rx_overflow,frame,parity,break\n";
+	for (const LineGap& gap : _lineGaps)
+		out << gap.sample << "," << gap.sample / framesPerSec << "," << !!(gap.errors & CE_OVERRUN) << "," << !!(gap.errors & CE_RXOVER) << ","
+			<< !!(gap.errors & CE_FRAME) << "," << !!(gap.errors & CE_RXPARITY) << "," << !!(gap.errors & CE_BREAK) << "\n";
+	if (_lineErrorReads > _lineGaps.size())
+		appLog(Warning) << "Only the first " << _lineGaps.size() << " line errors are listed in " << gapFile;
+}
+
+void SerialAudioSampler::_applyGain(SampleBlock* block)
+{
+	PROFILE_ZONE("ApplyGain");
+	float gain = _gain.load(std::memory_order_relaxed);
+	WaveSample16_t* samples = reinterpret_cast<WaveSample16_t*>(block->data());
+	size_t count = block->size / sizeof(WaveSample16_t);
+	for (size_t i = 0; i < count; i++)
+		samples[i] = WaveSample16_t(samples[i] * gain);
+
+	block->processedNs = METRICS_NOW();
+	appLatency(ReadToProcess, block->arrivalNs, block->processedNs);
+}
+
+void SerialAudioSampler::SetGain(float gain)
+{
+	_gain.store(gain, std::memory_order_relaxed);
+}
+
+void SerialAudioSampler::SetStreamBufferMs(int msBuffer)
+{
+	msBuffer = (std::max)(msBuffer, STREAM_BUFFER_MIN_MS);
+	size_t bytes = SampleBlockPool::BlockBytesFor(_wave->GetSamplingRate(), _wave->GetChannels(), _wave->GetBPS(), msBuffer);
+	if (_pool && bytes > _pool->GetBlockCapacity())
+	{
+		size_t frameBytes = size_t(_wave->GetChannels()) * (_wave->GetBPS() / 8);
+		bytes = _pool->GetBlockCapacity() - _pool->GetBlockCapacity() % frameBytes;
+		msBuffer = int(bytes * 1000 / (frameBytes * _wave->GetSamplingRate()));
+	}
+	_streamBufferMs.store(msBuffer, std::memory_order_relaxed);
+	_segmentBytes.store(bytes, std::memory_order_relaxed);
+}
+
+float SerialAudioSampler::GetGain() const
+{
+	return _gain.load(std::memory_order_relaxed);
+}
+
+int SerialAudioSampler::GetStreamBufferMs() const
+{
+	return _streamBufferMs.load(std::memory_order_relaxed);
 }
 
 void SerialAudioSampler::_sampleToFile(std::string fileName)
 {
+	PROFILE_THREAD("Capture");
 	WaveBuffer_t buffer;
+	std::unique_ptr<WaveOverview> overview;
+	if (_writeOverview)
+		overview.reset(new WaveOverview(WORD(_wave->GetChannels()), _wave->GetSamplingRate()));
+	if (_rt.enabled)
+	{
+		// Preallocate and touch the recording buffer so it does not grow in the hot loop
+		size_t bytesPerSec = size_t(_wave->GetSamplingRate()) * _wave->GetChannels() * (_wave->GetBPS() / 8);
+		buffer.resize(bytesPerSec * _rt.filePreallocSec);
+		buffer.clear();
+		if (overview)
+			overview->Reserve(uint64_t(_wave->GetSamplingRate()) * _rt.filePreallocSec);
+	}
+	std::unique_ptr<ActivityRecorder> activity;
+	if (_activity.enabled)
+		activity.reset(new ActivityRecorder(_activity, fileName, _wave->GetSamplingRate(), _wave->GetChannels(), _wave->GetBPS(), buffer));
+	SampleBlock* block = _pool->Acquire();
+	_enterRealtime(buffer.data(), buffer.capacity());
+
+	size_t heapAllocsAtStart = Utils::getHeapAllocCount();
+	bool reserveExceeded = false;
 	while (_stopFlag.load() == false)
 	{
-		WaveSample16_t sample;
-		_serial.readBytes(&sample, sizeof(sample), 0);
-		sample = WaveSample16_t(sample * SAMPLE_REDUCE_FACTOR);
-		buffer.append<WaveSample16_t>(sample);
+		block->size = 0;
+		_readBlock(block, block->capacity);
+		_applyGain(block);
+		_emit(block);
+		size_t recorded = buffer.size();
+		if (_rt.enabled && !reserveExceeded && buffer.capacity() - recorded < block->size)
+		{
+			// Growing reallocates the whole recording here and releases the locked pages
+			appLog(Warning) << "Recording exceeds FilePreallocSec=" << _rt.filePreallocSec << ", the buffer grows from now on and realtime guarantees no longer hold.";
+			reserveExceeded = true;
+		}
+		if (activity)
+			activity->Process(reinterpret_cast<const WaveSample16_t*>(block->data()), block->size / sizeof(WaveSample16_t));
+		else
+			buffer.append(block->data(), block->size - block->size % sizeof(WaveSample16_t));
+		// Summarize what was just recorded while it is still in cache
+		if (overview && buffer.size() > recorded)
+			overview->Add(reinterpret_cast<const WaveSample16_t*>(buffer.data() + recorded), (buffer.size() - recorded) / sizeof(WaveSample16_t));
+		appLatency(ProcessToSink, block->processedNs, METRICS_NOW());
 	}
+	_pool->Release(block);
+
+	if (_rt.enabled)
+		appLog(Info) << "Capture finished. Heap allocations during capture: " << Utils::getHeapAllocCount() - heapAllocsAtStart;
 
-	buffer.makeWave(_wave->GetChannels(), _wave->GetSamplingRate(), _wave->GetBPS());
-	buffer.saveToFile(fileName);
+	if (activity)
+	{
+		// The last region's post-roll lands in the buffer only now, the overview must cover it too
+		size_t recorded = buffer.size();
+		activity->Finish();
+		if (overview && buffer.size() > recorded)
+			overview->Add(reinterpret_cast<const WaveSample16_t*>(buffer.data() + recorded), (buffer.size() - recorded) / sizeof(WaveSample16_t));
+	}
+	if (!activity || activity->WritesMainFile())
+	{
+		if (overview)
+		{
+			overview->Finish();
+			overview->Save(WaveOverview::SidecarName(fileName));
+		}
+		buffer.makeWave(_wave->GetChannels(), _wave->GetSamplingRate(), _wave->GetBPS());
+		if (activity)
+			activity->AppendCues(buffer);
+		buffer.saveToFile(fileName);
+	}
+	_reportLineGaps(fileName);
 	_isSampling = false;
 }
 
-void SerialAudioSampler::_sampleToStream(int msBuffer)
+void SerialAudioSampler::_sampleToStream(int msBuffer, bool playback)
 {
-	WaveBufferPtr buffer = WaveBufferPtr(new WaveBuffer_t);
-	auto time = Utils::getTimeMs();
-	auto lastTime = time;
-	auto devices = Utils::getAudioDeviceList();
-	auto devId = _wave->GetDevice();
+	PROFILE_THREAD("Capture");
+	if (playback)
+	{
+		auto devices = Utils::getAudioDeviceList();
+		auto devId = _wave->GetDevice();
+		appLog(Info) << "Streaming to " << devices[devId] << " with sampling rate " << _wave->GetSamplingRate() << " Hz";
+	}
+	else
+		appLog(Info) << "Capturing to " << _sinks.size() << " sinks with sampling rate " << _wave->GetSamplingRate() << " Hz";
 
-	appLog(Info) << "Streaming to " << devices[devId] << " with sampling rate " << _wave->GetSamplingRate() <<  " Hz";
+	// In realtime mode an exhausted pool drops audio instead of allocating
+	SampleBlock* dropBlock = _rt.enabled ? _pool->Acquire() : nullptr;
+	size_t droppedBlocks = 0;
+	_enterRealtime(nullptr, 0);
 
+	// Each segment holds StreamBufferMs worth of samples, it may be changed while streaming
+	size_t heapAllocsAtStart = Utils::getHeapAllocCount();
+	size_t poolAllocsAtStart = _pool->GetHeapAllocations();
+	_flowPauses = 0;
+	_flowPausedNs = 0;
 	while (_stopFlag.load() == false)
 	{
-		WaveSample16_t sample;
-		_serial.readBytes(&sample, sizeof(sample), 0);
-		sample = WaveSample16_t(sample * SAMPLE_REDUCE_FACTOR);
-		buffer->append<WaveSample16_t>(sample);
+		if (playback && _flowHighMs)
+			_throttle();
+		SampleBlock* block = _rt.enabled ? _pool->TryAcquire() : _pool->Acquire();
+		if (!block)
+		{
+			dropBlock->size = 0;
+			_readBlock(dropBlock, _segmentBytes.load(std::memory_order_relaxed));
+			droppedBlocks++;
+			appMetricAdd(DroppedBytes, dropBlock->size);
+			PROFILE_INSTANT("BlockDropped");
+			appTrace(BlockDropped, droppedBlocks, _pool->GetBlocksInUse());
+			continue;
+		}
 
-		time = Utils::getTimeMs();
-		if (time - lastTime >= msBuffer)
+		size_t segmentBytes = _segmentBytes.load(std::memory_order_relaxed);
+		_readBlock(block, segmentBytes);
+		if (block->size < segmentBytes)
 		{
-			_wave->PushSegment(buffer);
-			buffer.reset(new WaveBuffer_t);
-			lastTime = time;
+			_pool->Release(block);
+			break;
 		}
+
+		_applyGain(block);
+		_emit(block);
+		uint64_t processedNs = block->processedNs;
+		if (!playback)
+		{
+			appLatency(ProcessToSink, processedNs, METRICS_NOW());
+			_pool->Release(block);
+			continue;
+		}
+
+		block->submittedNs = METRICS_NOW();
+		_wave->PushSegment(block);
+		appLatency(ProcessToSink, processedNs, METRICS_NOW());
+		appTrace(BlockPushed, _wave->GetQueuedSegments(), _pool->GetBlocksInUse());
+		appMetricSet(PlaybackQueueSegments, _wave->GetQueuedSegments());
+		appMetricSet(PoolBlocksInUse, _pool->GetBlocksInUse());
+		PROFILE_COUNTER("PoolBlocksInUse", _pool->GetBlocksInUse());
 	}
 
+	size_t heapAllocs = Utils::getHeapAllocCount() - heapAllocsAtStart;
+	size_t poolAllocs = _pool->GetHeapAllocations() - poolAllocsAtStart;
+	appLog(Info) << "Capture finished. Heap allocations during capture: " << heapAllocs << ", pool overflow blocks: " << poolAllocs;
+	if (poolAllocs)
+		appLog(Warning) << "Sample block pool was exhausted, playback queue grew beyond " << POOL_HEADROOM_MS << " ms";
+	if (droppedBlocks)
+		appLog(Warning) << "Realtime mode dropped " << droppedBlocks << " blocks because the sample block pool was exhausted";
+	if (_flowPauses)
+		appLog(Info) << "Pipeline flow control paused the sender " << _flowPauses << " times, " << _flowPausedNs / 1000000 << " ms in total";
+	_pool->Release(dropBlock);
+	_reportLineGaps("");
+
 	_isSampling = false;
 }
 
@@ -130,8 +538,11 @@ void SerialAudioSampler::Stop()
 
 void SerialAudioSampler::Sync()
 {
-	if (!_isSampling)
-		return;
+	if (_worker.joinable())
+		_worker.join();
+}
 
-	_worker.join();
+bool SerialAudioSampler::IsSampling() const
+{
+	return _isSampling;
 }
\ No newline at end of file
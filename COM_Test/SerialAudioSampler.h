@@ -2,34 +2,98 @@
 #include <string>
 #include <atomic>
 #include <thread>
-#include "Serial.h"
+#include <vector>
+#include <functional>
+#include "SampleSource.h"
+#include "RawCapture.h"
 #include "Utils.h"
 #include "WaveStream.h"
+#include "SampleBlockPool.h"
+#include "RealtimeMode.h"
+#include "ActivityGate.h"
+#include "WaveOverview.h"
 
 
 class SerialAudioSampler
 {
+public:
+	// Receives every processed block on the capture thread, after gain. Must not block.
+	using SampleSink = std::function<void(const WaveSample16_t* samples, size_t count)>;
+
 private:
-	SerialMgr						_serial;
+	// Serial line error noticed after a read; the lost or corrupted bytes lie somewhere before sample
+	struct LineGap
+	{
+		uint64_t	sample;		// Capture sample index, counted from the start of sampling
+		DWORD		errors;		// CE_* flags
+	};
+
+	std::unique_ptr<SampleSource>	_source;
+	std::unique_ptr<RawCaptureWriter> _recorder;	// Records every read when raw capture is on
+	std::unique_ptr<SampleBlockPool> _pool;	// Must outlive _wave, it owns the queued blocks
 	std::unique_ptr<WaveStream>		_wave;
 	std::atomic<bool>				_isSampling;
 	std::atomic<bool>				_stopFlag;
 	std::thread						_worker;
+	RealtimeSettings				_rt;
+	ActivitySettings				_activity;
+	bool							_writeOverview;
+	std::atomic<float>				_gain;
+	std::atomic<int>				_streamBufferMs;
+	std::atomic<size_t>				_segmentBytes;
+	std::vector<SampleSink>			_sinks;
+	std::vector<LineGap>			_lineGaps;		// Reserved up front, later gaps are only counted
+	uint64_t						_lineErrorReads;
+	uint64_t						_capturedBytes;
+	int								_flowHighMs;	// Pipeline flow control watermarks, 0 = off
+	int								_flowLowMs;
+	uint64_t						_flowPauses;
+	uint64_t						_flowPausedNs;
 
 	SamplingRate_t _calculateSamplingRate(UINT dur);
 	void _sampleToFile(std::string fileName);
-	void _sampleToStream(int msBuffer);
+	void _sampleToStream(int msBuffer, bool playback);
+	void _startStreaming(int msBuffer, bool playback, UINT device);
+	void _emit(const SampleBlock* block);
+	int _read(void* buffer, unsigned int size);
+	void _readBlock(SampleBlock* block, size_t bytes);
+	void _applyGain(SampleBlock* block);
+	void _enterRealtime(void* buffer, size_t size);
+	void _checkLine();
+	void _throttle();	// Holds the sender with RTS while the playback queue is above the high watermark
+	void _reportLineGaps(const std::string& fileName) const;	// Empty name = log only
 
-	static constexpr float SAMPLE_REDUCE_FACTOR = 0.33f;
+	static constexpr float DEFAULT_GAIN = 0.33f;
+	static constexpr int STREAM_BUFFER_MIN_MS = 10;
+	static constexpr int STREAM_BUFFER_MAX_MS = 250;	// Pool blocks are sized for this, so StreamBufferMs can be raised live
+	static constexpr int FILE_READ_BLOCK_MS = 20;
+	static constexpr int POOL_HEADROOM_MS = 2000;	// Playback queue depth the pool can absorb without heap allocations
+	static constexpr size_t POOL_MIN_BLOCKS = 8;
+	static constexpr size_t MAX_LINE_GAPS = 4096;
 
 public:
-	SerialAudioSampler(const std::string& port, int baudRate, UINT SamplingRateCalculationDurSec);
+	SerialAudioSampler(const SerialSettings& serial, UINT SamplingRateCalculationDurSec, const std::string& rawCaptureFile = "");
+	SerialAudioSampler(std::unique_ptr<SampleSource> source, UINT SamplingRateCalculationDurSec, const std::string& rawCaptureFile = "");
 	SerialAudioSampler(const SerialAudioSampler&) = delete;
 	~SerialAudioSampler();
 
+	void SetRealtimeMode(const RealtimeSettings& settings);
+	void SetActivityGate(const ActivitySettings& settings);	// File mode only keeps active regions
+	void SetWriteOverview(bool enabled);	// File mode writes a min/max/RMS overview next to the recording
 	void StartSamplingToFile(const std::string& fileName);
 	void StartSamplingToWaveStream(int msBuffer, UINT device);
+	void StartSamplingToSinks(int msBuffer);	// Capture without playback, blocks only go to the sinks
+	void AddSink(SampleSink sink);				// Must be called before sampling starts
+	SamplingRate_t GetSamplingRate() const;
+	WORD GetChannels() const;
+
+	// Live tunables, safe to call from any thread while sampling
+	void SetGain(float gain);
+	void SetStreamBufferMs(int msBuffer);
+	float GetGain() const;
+	int GetStreamBufferMs() const;
 
 	void Stop();
 	void Sync();
+	bool IsSampling() const;	// False once Stop() was processed or a replay reached its end
 };
\ No newline at end of file
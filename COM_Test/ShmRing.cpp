@@ -0,0 +1,231 @@
+#include <cstring>
+#include <algorithm>
+
+#include "ShmRing.h"
+
+ShmRingReader::ShmRingReader()
+	: _mapping(NULL)
+	, _header(nullptr)
+	, _data(nullptr)
+	, _mask(0)
+	, _slot(nullptr)
+	, _event(NULL)
+	, _sessionId(0)
+	, _pending(0)
+{
+}
+
+ShmRingReader::~ShmRingReader()
+{
+	Detach();
+}
+
+static bool ProcessAlive(uint32_t pid)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if (process == NULL)
+		return GetLastError() == ERROR_ACCESS_DENIED;	// Running as another user or as a service
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+}
+
+bool ShmRingReader::_claimSlot(const std::string& name)
+{
+	// The pid owns the slot: claiming it stores the pid in one step, so no other reader sees it half taken
+	const uint32_t self = GetCurrentProcessId();
+	for (uint32_t i = 0; i < SHM_RING_MAX_READERS && !_slot; i++)
+	{
+		uint32_t expected = 0;
+		if (_header->readers[i].pid.compare_exchange_strong(expected, self))
+			_slot = &_header->readers[i];
+	}
+
+	// All taken: reuse a slot whose reader process died without detaching
+	for (uint32_t i = 0; i < SHM_RING_MAX_READERS && !_slot; i++)
+	{
+		uint32_t pid = _header->readers[i].pid.load();
+		if (pid != 0 && pid != self && !ProcessAlive(pid) && _header->readers[i].pid.compare_exchange_strong(pid, self))
+			_slot = &_header->readers[i];
+	}
+	if (!_slot)
+		return false;
+
+	uint32_t index = uint32_t(_slot - _header->readers);
+	_event = CreateEventA(NULL, FALSE, FALSE, ShmRingEventName(name, index).c_str());
+	_slot->waiting.store(0);
+	_slot->overrunSamples.store(0);
+	_slot->cursor.store(_header->writePos.load(std::memory_order_acquire));
+	_slot->generation.fetch_add(1, std::memory_order_release);	// The writer reopens the event
+	_slot->state.store(1, std::memory_order_release);
+	return true;
+}
+
+bool ShmRingReader::Attach(const std::string& name)
+{
+	Detach();
+	_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (_mapping == NULL)
+		return false;
+
+	void* view = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	_header = static_cast<ShmRingHeader*>(view);
+	if (!_header || memcmp(_header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC)) != 0 || _header->version != SHM_RING_VERSION
+		|| !_claimSlot(name))
+	{
+		Detach();
+		return false;
+	}
+
+	_data = reinterpret_cast<const int16_t*>(reinterpret_cast<const byte*>(view) + _header->dataOffset);
+	_mask = _header->capacity - 1;
+	_sessionId = _header->sessionId.load(std::memory_order_acquire);
+	return true;
+}
+
+void ShmRingReader::Detach()
+{
+	if (_slot)
+	{
+		_slot->waiting.store(0);
+		_slot->state.store(0);
+		_slot->pid.store(0, std::memory_order_release);	// Frees the slot
+		_slot = nullptr;
+	}
+	if (_event)
+	{
+		CloseHandle(_event);
+		_event = NULL;
+	}
+	if (_header)
+	{
+		UnmapViewOfFile(_header);
+		_header = nullptr;
+	}
+	if (_mapping)
+	{
+		CloseHandle(_mapping);
+		_mapping = NULL;
+	}
+	_data = nullptr;
+	_pending = 0;
+}
+
+size_t ShmRingReader::Acquire(const int16_t*& samples, size_t maxSamples, DWORD timeoutMs)
+{
+	_pending = 0;
+	if (!_slot)
+		return 0;
+
+	uint64_t cursor = _slot->cursor.load(std::memory_order_relaxed);
+	uint64_t session = _header->sessionId.load(std::memory_order_acquire);
+	uint64_t write = _header->writePos.load(std::memory_order_acquire);
+	if (session != _sessionId)
+	{
+		// A new writer, possibly with another rate or ring size: continue at its first sample still in the ring
+		_sessionId = session;
+		_mask = _header->capacity - 1;
+		uint64_t start = _header->sessionStart.load();
+		cursor = write > _header->capacity ? (std::max)(start, write - _header->capacity) : start;
+		_slot->cursor.store(cursor, std::memory_order_relaxed);
+	}
+
+	if (write == cursor && timeoutMs)
+	{
+		// Announce the wait, then look again, so a publish between the two is not missed
+		_slot->waiting.store(1);
+		write = _header->writePos.load();
+		if (write == cursor)
+			WaitForSingleObject(_event, timeoutMs);
+		_slot->waiting.store(0, std::memory_order_relaxed);
+		write = _header->writePos.load(std::memory_order_acquire);
+	}
+	if (write <= cursor)
+		return 0;
+
+	// Samples older than a ring length behind the writer's reservation are gone
+	const uint64_t channels = (std::max)(_header->channels.load(std::memory_order_relaxed), 1u);
+	uint64_t reserve = _header->reservePos.load(std::memory_order_acquire);
+	if (reserve > cursor + _header->capacity)
+	{
+		uint64_t oldest = reserve - _header->capacity;
+		oldest += (channels - oldest % channels) % channels;
+		_slot->overrunSamples.fetch_add(oldest - cursor, std::memory_order_relaxed);
+		cursor = oldest;
+		_slot->cursor.store(cursor, std::memory_order_relaxed);
+		if (write <= cursor)
+			return 0;
+	}
+
+	size_t offset = size_t(cursor & _mask);
+	size_t count = size_t((std::min<uint64_t>)(write - cursor, _header->capacity - offset));
+	count = (std::min)(count, maxSamples);
+	count -= count % channels;
+	samples = _data + offset;
+	_pending = count;
+	return count;
+}
+
+bool ShmRingReader::Release()
+{
+	if (!_slot || !_pending)
+		return true;
+
+	// Seqlock check: the data reads above must complete before the reservation is read
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t reserve = _header->reservePos.load(std::memory_order_relaxed);
+	uint64_t cursor = _slot->cursor.load(std::memory_order_relaxed);
+	uint64_t pending = _pending;
+	_pending = 0;
+	if (reserve <= cursor + _header->capacity)
+	{
+		_slot->cursor.store(cursor + pending, std::memory_order_release);
+		return true;
+	}
+
+	const uint64_t channels = (std::max)(_header->channels.load(std::memory_order_relaxed), 1u);
+	uint64_t oldest = reserve - _header->capacity;
+	oldest += (channels - oldest % channels) % channels;
+	_slot->overrunSamples.fetch_add(oldest - cursor, std::memory_order_relaxed);
+	_slot->cursor.store(oldest, std::memory_order_release);
+	return false;
+}
+
+size_t ShmRingReader::Read(int16_t* out, size_t maxSamples, DWORD timeoutMs)
+{
+	const int16_t* samples = nullptr;
+	size_t count = Acquire(samples, maxSamples, timeoutMs);
+	if (count)
+		memcpy(out, samples, count * sizeof(int16_t));
+	return Release() ? count : 0;
+}
+
+bool ShmRingReader::IsWriterRunning() const
+{
+	return _header && _header->writerPid.load(std::memory_order_acquire) != 0;
+}
+
+uint32_t ShmRingReader::GetSamplingRate() const
+{
+	return _header ? _header->samplingRate.load() : 0;
+}
+
+WORD ShmRingReader::GetChannels() const
+{
+	return _header ? WORD(_header->channels.load()) : 0;
+}
+
+uint64_t ShmRingReader::GetOverrunSamples() const
+{
+	return _slot ? _slot->overrunSamples.load() : 0;
+}
+
+double ShmRingReader::GetHandoffUs() const
+{
+	if (!_header)
+		return 0.0;
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	return double(now.QuadPart - _header->publishQpc.load(std::memory_order_relaxed)) * 1e6 / double(frequency.QuadPart);
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <Windows.h>
+
+// Shared-memory sample ring for local consumers, the layout and the client library.
+// A consumer process compiles ShmRing.h/.cpp and uses ShmRingReader, no other file of the sampler is needed.
+//
+// Protocol: one writer (ShmRingWriter), up to SHM_RING_MAX_READERS readers. The writer announces a block in
+// reservePos, copies it into the ring and then publishes writePos with release order; it never waits for
+// readers. Each reader owns a slot with its cursor. A reader validates data after using it: if reservePos
+// moved more than the capacity past the cursor meanwhile, the samples were overwritten, the reader counts
+// an overrun and resyncs.
+
+constexpr char		SHM_RING_MAGIC[8] = { 'S', 'A', 'S', 'S', 'H', 'M', 0, 0 };
+constexpr uint32_t	SHM_RING_VERSION = 1;
+constexpr uint32_t	SHM_RING_MAX_READERS = 16;
+
+struct alignas(64) ShmReaderSlot
+{
+	std::atomic<uint32_t>	state;		// 0 = not attached, 1 = attached and its cursor valid
+	std::atomic<uint32_t>	waiting;	// Reader sleeps on its event, the writer sets it on the next publish
+	std::atomic<uint32_t>	pid;		// Owner of the slot, 0 = free
+	std::atomic<uint32_t>	generation;	// Incremented on every attach, so the writer reopens the event
+	std::atomic<uint64_t>	cursor;		// Next sample the reader will consume
+	std::atomic<uint64_t>	overrunSamples;
+};
+
+struct ShmRingHeader
+{
+	char					magic[8];
+	uint32_t				version;
+	uint32_t				dataOffset;
+	uint64_t				capacity;		// Samples, a power of two, may change when a writer starts
+	std::atomic<uint64_t>	sessionId;		// New for every writer start, readers resync when it changes
+	std::atomic<uint64_t>	sessionStart;	// writePos when the current writer started
+	std::atomic<uint32_t>	samplingRate;
+	std::atomic<uint32_t>	channels;
+	std::atomic<uint32_t>	writerPid;		// 0 while no writer is running
+	uint32_t				reserved;
+	alignas(64) std::atomic<uint64_t> writePos;		// Samples published in total, restarts only with a new ring size
+	std::atomic<uint64_t>	reservePos;		// writePos plus the samples being copied right now
+	std::atomic<int64_t>	publishQpc;		// QueryPerformanceCounter of the last publish, comparable across processes
+	ShmReaderSlot			readers[SHM_RING_MAX_READERS];
+};
+
+// Named auto-reset event of a reader slot, created by the reader and set by the writer
+inline std::string ShmRingEventName(const std::string& name, uint32_t slot)
+{
+	return name + ".reader" + std::to_string(slot);
+}
+
+class ShmRingReader
+{
+private:
+	HANDLE				_mapping;
+	ShmRingHeader*		_header;
+	const int16_t*		_data;
+	uint64_t			_mask;
+	ShmReaderSlot*		_slot;
+	HANDLE				_event;
+	uint64_t			_sessionId;
+	uint64_t			_pending;		// Samples handed out by Acquire, not yet released
+
+	bool _claimSlot(const std::string& name);
+
+	ShmRingReader(const ShmRingReader&) = delete;
+	ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+public:
+	ShmRingReader();
+	~ShmRingReader();
+
+	bool Attach(const std::string& name);	// Starts at the live position
+	void Detach();
+
+	// Zero-copy access: points at up to maxSamples contiguous whole frames in the ring, waiting up to
+	// timeoutMs for data. Returns the sample count, 0 on timeout or while no writer is running.
+	size_t Acquire(const int16_t*& samples, size_t maxSamples, DWORD timeoutMs);
+
+	// Ends the access started by Acquire. False if the writer overwrote the samples meanwhile,
+	// then they must be discarded; the cursor has already moved to the oldest valid sample.
+	bool Release();
+
+	// Copying convenience over Acquire/Release, drops overwritten data
+	size_t Read(int16_t* out, size_t maxSamples, DWORD timeoutMs);
+
+	bool IsWriterRunning() const;
+	uint32_t GetSamplingRate() const;
+	WORD GetChannels() const;
+	uint64_t GetOverrunSamples() const;
+	double GetHandoffUs() const;	// Time since the writer published the newest samples
+};
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+#include "ShmRingWriter.h"
+#include "RealtimeMode.h"
+#include "Logger.h"
+
+ShmRingWriter::ShmRingWriter()
+	: _mapping(NULL)
+	, _header(nullptr)
+	, _data(nullptr)
+	, _mask(0)
+	, _events()
+	, _eventGeneration()
+	, _settings({ false, "", 0 })
+{
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+	Stop();
+}
+
+static bool OtherProcessAlive(uint32_t pid)
+{
+	if (pid == 0 || pid == GetCurrentProcessId())
+		return false;
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if (process == NULL)
+		return GetLastError() == ERROR_ACCESS_DENIED;	// Running as another user or as a service
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+}
+
+bool ShmRingWriter::Start(const ShmRingSettings& settings, uint32_t samplingRate, WORD channels)
+{
+	if (!settings.enabled || _header || samplingRate == 0 || channels == 0)
+		return false;
+
+	uint64_t wanted = (std::max)(uint64_t(samplingRate) * channels * settings.bufferMs / 1000, uint64_t(4096));
+	uint64_t capacity = 1;
+	while (capacity < wanted)
+		capacity <<= 1;
+	const uint32_t dataOffset = (sizeof(ShmRingHeader) + 4095) & ~4095u;
+	const uint64_t size = dataOffset + capacity * sizeof(int16_t);
+
+	_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), settings.name.c_str());
+	bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+	if (_mapping == NULL)
+	{
+		appLog(Warning) << "Shared memory: cannot create " << settings.name << ", error " << GetLastError();
+		return false;
+	}
+	void* view = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size_t(size));
+	if (view == nullptr)
+	{
+		// An older mapping of that name, kept open by its readers, is smaller than this ring
+		appLog(Warning) << "Shared memory: cannot map " << settings.name << ", error " << GetLastError();
+		CloseHandle(_mapping);
+		_mapping = NULL;
+		return false;
+	}
+	_header = static_cast<ShmRingHeader*>(view);
+	_data = reinterpret_cast<int16_t*>(static_cast<byte*>(view) + dataOffset);
+	_mask = capacity - 1;
+	_settings = settings;
+
+	// Readers still attached from a previous run keep their slots
+	bool reuse = existed && memcmp(_header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC)) == 0
+		&& _header->version == SHM_RING_VERSION && _header->dataOffset == dataOffset;
+	if (reuse && OtherProcessAlive(_header->writerPid.load()))
+	{
+		appLog(Warning) << "Shared memory: " << settings.name << " already has a writer, process " << _header->writerPid.load();
+		_header = nullptr;	// Leave the other writer's header alone
+		UnmapViewOfFile(view);
+		CloseHandle(_mapping);
+		_mapping = NULL;
+		return false;
+	}
+	if (!reuse)
+	{
+		memset(view, 0, dataOffset);
+		memcpy(_header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC));
+		_header->version = SHM_RING_VERSION;
+		_header->dataOffset = dataOffset;
+	}
+	else if (_header->capacity != capacity)
+		_header->writePos.store(0);	// Old positions mean nothing with another ring size
+	_header->capacity = capacity;
+	_header->reservePos.store(_header->writePos.load());
+	RealtimeMode::Prefault(_data, size_t(capacity * sizeof(int16_t)));
+
+	std::random_device random;
+	_header->samplingRate.store(samplingRate);
+	_header->channels.store(channels);
+	_header->sessionStart.store(_header->writePos.load());
+	_header->sessionId.store((uint64_t(random()) << 32) | random(), std::memory_order_release);
+	_header->writerPid.store(GetCurrentProcessId(), std::memory_order_release);
+
+	appLog(Info) << "Shared memory: publishing " << settings.name << ", " << double(capacity) / channels / samplingRate
+		<< " s ring, " << (size >> 10) << " KB";
+	return true;
+}
+
+void ShmRingWriter::Stop()
+{
+	if (!_header)
+		return;
+
+	_header->writerPid.store(0, std::memory_order_release);
+	for (uint32_t i = 0; i < SHM_RING_MAX_READERS; i++)
+	{
+		ShmReaderSlot& slot = _header->readers[i];
+		if (slot.state.load() != 0)
+		{
+			uint64_t overrun = slot.overrunSamples.load();
+			if (overrun)
+				appLog(Warning) << "Shared memory: reader " << slot.pid.load() << " fell behind and lost " << overrun << " samples";
+			slot.waiting.store(1);	// Wake it, it sees the writer gone
+		}
+	}
+	_wakeReaders();
+
+	for (auto& event : _events)
+		if (event)
+		{
+			CloseHandle(event);
+			event = NULL;
+		}
+	UnmapViewOfFile(_header);
+	CloseHandle(_mapping);
+	_header = nullptr;
+	_data = nullptr;
+	_mapping = NULL;
+}
+
+void ShmRingWriter::_wakeReaders()
+{
+	for (uint32_t i = 0; i < SHM_RING_MAX_READERS; i++)
+	{
+		ShmReaderSlot& slot = _header->readers[i];
+		if (slot.waiting.load(std::memory_order_relaxed) == 0 || slot.waiting.exchange(0) == 0)
+			continue;
+
+		// The reader creates its event on attach; open it again when the slot changed hands
+		uint32_t generation = slot.generation.load(std::memory_order_acquire);
+		if (!_events[i] || _eventGeneration[i] != generation)
+		{
+			if (_events[i])
+				CloseHandle(_events[i]);
+			_events[i] = OpenEventA(EVENT_MODIFY_STATE, FALSE, ShmRingEventName(_settings.name, i).c_str());
+			_eventGeneration[i] = generation;
+		}
+		if (_events[i])
+			SetEvent(_events[i]);
+	}
+}
+
+void ShmRingWriter::Push(const int16_t* samples, size_t count)
+{
+	if (!_header || count == 0)
+		return;
+
+	// A block longer than the ring keeps only its newest whole frames
+	const uint64_t capacity = _mask + 1;
+	if (count > capacity)
+	{
+		size_t channels = _header->channels.load(std::memory_order_relaxed);
+		size_t keep = size_t(capacity) - size_t(capacity) % channels;
+		samples += count - keep;
+		count = keep;
+	}
+
+	// Readers check reservePos after using data, see ShmRing.h
+	uint64_t write = _header->writePos.load(std::memory_order_relaxed);
+	_header->reservePos.store(write + count, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	size_t offset = size_t(write & _mask);
+	size_t first = (std::min)(count, size_t(capacity) - offset);
+	memcpy(_data + offset, samples, first * sizeof(int16_t));
+	memcpy(_data, samples + first, (count - first) * sizeof(int16_t));
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	_header->publishQpc.store(now.QuadPart, std::memory_order_relaxed);
+	_header->writePos.store(write + count, std::memory_order_release);
+
+	// Pairs with the reader's store of waiting before its second look at writePos
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_wakeReaders();
+}
\ No newline at end of file
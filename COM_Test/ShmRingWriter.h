@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "ShmRing.h"
+
+struct ShmRingSettings
+{
+	bool			enabled;
+	std::string		name;		// Mapping name, readers attach with the same name
+	int				bufferMs;	// Audio kept in the ring, how far a reader may fall behind
+};
+
+// Publishes the sampler's output into the shared-memory ring of ShmRing.h. Push runs on the capture
+// thread and copies straight into the mapping; there is no worker thread and no second copy.
+class ShmRingWriter
+{
+private:
+	HANDLE				_mapping;
+	ShmRingHeader*		_header;
+	int16_t*			_data;
+	uint64_t			_mask;
+	HANDLE				_events[SHM_RING_MAX_READERS];
+	uint32_t			_eventGeneration[SHM_RING_MAX_READERS];
+	ShmRingSettings		_settings;
+
+	void _wakeReaders();
+
+	ShmRingWriter(const ShmRingWriter&) = delete;
+	ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+public:
+	ShmRingWriter();
+	~ShmRingWriter();
+
+	bool Start(const ShmRingSettings& settings, uint32_t samplingRate, WORD channels);
+	void Stop();
+
+	void Push(const int16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+};
\ No newline at end of file
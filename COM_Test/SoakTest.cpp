@@ -0,0 +1,397 @@
+#include "SoakTest.h"
+
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <Windows.h>
+#include <psapi.h>
+
+#include "SerialAudioSampler.h"
+#include "Logger.h"
+#include "Clock.h"
+#include "LatencyHistogram.h"
+
+#pragma comment(lib, "Psapi.lib")
+
+namespace SoakTest
+{
+	constexpr int CALIBRATION_SEC = 2;
+	constexpr int SAMPLER_RX_BUFFER_BYTES = 65536;	// Same driver queues as the [SerialPort] defaults
+	constexpr int SAMPLER_TX_BUFFER_BYTES = 4096;
+	constexpr size_t GENERATOR_CHUNK_SAMPLES = 256;
+	constexpr uint64_t COUNTER_PERIOD = 65536;	// The generated signal is sample index mod 2^16
+	constexpr uint64_t RESYNC_SAMPLES = 8;		// Consecutive counter values that confirm a position after a break
+
+	static int64_t nowNs()
+	{
+		return int64_t(Clock::NowNs());
+	}
+
+	static int64_t fileTimeNs(const FILETIME& ft)
+	{
+		return int64_t((uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 100;
+	}
+
+	static int64_t processCpuNs()
+	{
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+			return 0;
+		return fileTimeNs(kernel) + fileTimeNs(user);
+	}
+
+	static int64_t threadCpuNs()
+	{
+		FILETIME creation, exit, kernel, user;
+		if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+			return 0;
+		return fileTimeNs(kernel) + fileTimeNs(user);
+	}
+
+	static double rssMB()
+	{
+		PROCESS_MEMORY_COUNTERS pmc = {};
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+			return 0;
+		return double(pmc.WorkingSetSize) / (1024.0 * 1024.0);
+	}
+
+	// Writes sample index mod 2^16 paced against a fixed schedule: sample i is never written
+	// before start + i / rate, so a received sample's latency follows from its index alone.
+	class Generator
+	{
+	private:
+		SerialMgr				_serial;
+		double					_samplesPerNs;
+		int64_t					_startNs;
+		std::atomic<uint64_t>	_sent;
+		std::atomic<bool>		_stop;
+		int64_t					_cpuNs;
+		std::thread				_thread;
+
+		void _run()
+		{
+			int64_t cpuStart = threadCpuNs();
+			WaveSample16_t chunk[GENERATOR_CHUNK_SAMPLES];
+			uint64_t sent = 0;
+			while (!_stop.load(std::memory_order_relaxed))
+			{
+				uint64_t due = uint64_t(double(nowNs() - _startNs) * _samplesPerNs);
+				size_t count = size_t((std::min<uint64_t>)(due - (std::min)(due, sent), GENERATOR_CHUNK_SAMPLES));
+				if (count == 0)
+				{
+					Sleep(1);
+					continue;
+				}
+
+				for (size_t i = 0; i < count; i++)
+					chunk[i] = WaveSample16_t(sent + i);
+				if (!_serial.writeBytes(chunk, unsigned(count * sizeof(WaveSample16_t))))
+				{
+					appLog(Warning) << "Soak: generator write failed";
+					Sleep(1);
+					continue;
+				}
+				sent += count;
+				_sent.store(sent, std::memory_order_relaxed);
+			}
+			_cpuNs = threadCpuNs() - cpuStart;
+		}
+
+	public:
+		Generator(const std::string& port, unsigned int baudRate, double samplesPerSec)
+			: _samplesPerNs(samplesPerSec / 1e9)
+			, _startNs(0)
+			, _sent(0)
+			, _stop(false)
+			, _cpuNs(0)
+		{
+			if (_serial.openDevice(port, baudRate) != SerialMgr::errCode::Success)
+				throw std::runtime_error("Failed to open generator port " + port);
+		}
+
+		~Generator()
+		{
+			Stop();
+			_serial.closeDevice();
+		}
+
+		void Start()
+		{
+			_startNs = nowNs();
+			_thread = std::thread(&Generator::_run, this);
+		}
+
+		void Stop()
+		{
+			_stop = true;
+			if (_thread.joinable())
+				_thread.join();
+		}
+
+		uint64_t GetSent() const { return _sent.load(std::memory_order_relaxed); }
+		int64_t GetCpuNs() const { return _cpuNs; }
+		int64_t ScheduledNs(uint64_t index) const { return _startNs + int64_t(double(index + 1) / _samplesPerNs); }
+	};
+
+	// Runs on the capture thread. Tracks the absolute sample index, counts gaps as drops and
+	// anything else that breaks the counter sequence as mismatches. After a break the position is
+	// only trusted again once RESYNC_SAMPLES consecutive counter values confirm it, in either byte
+	// alignment, so gaps at block ends, gaps of any length and lost bytes are all recovered.
+	class Verifier
+	{
+	private:
+		const Generator&		_generator;
+		bool					_synced;		// False until the first position is confirmed
+		bool					_shifted;		// Samples are assembled across received sample boundaries after a lost byte
+		WaveSample16_t			_previous;		// Last received sample, for the shifted alignment
+		uint64_t				_expected;		// Absolute index of the next sample
+		uint64_t				_run;			// Samples received since the sequence broke, 0 while in sequence
+		uint64_t				_candidate[2];	// Per alignment: index after the current hypothesis
+		uint64_t				_streak[2];		// Per alignment: consecutive samples confirming it
+		std::atomic<uint64_t>	_received;
+		std::atomic<uint64_t>	_dropped;
+		std::atomic<uint64_t>	_mismatched;
+		LatencyHistogram		_latency;
+
+		// Newest index already sent that carries this counter value
+		uint64_t _locate(WaveSample16_t value) const
+		{
+			uint64_t sent = _generator.GetSent();
+			uint64_t base = sent - (std::min)(sent, COUNTER_PERIOD);
+			uint64_t index = base + (value - base % COUNTER_PERIOD + COUNTER_PERIOD) % COUNTER_PERIOD;
+			if (index >= sent && index >= COUNTER_PERIOD)
+				index -= COUNTER_PERIOD;
+			return index;
+		}
+
+		// Accepts the hypothesis of one alignment and accounts for the samples since the break
+		void _resync(int alignment, uint64_t& dropped, uint64_t& mismatched)
+		{
+			uint64_t streakStart = _candidate[alignment] - _streak[alignment];
+			if (_synced)
+			{
+				uint64_t bad = _run - _streak[alignment];
+				uint64_t skipped = streakStart > _expected ? streakStart - _expected : 0;
+				mismatched += bad;
+				dropped += skipped > bad ? skipped - bad : 0;
+			}
+			_expected = _candidate[alignment];
+			_shifted = alignment == 1;
+			_synced = true;
+			_run = 0;
+		}
+
+	public:
+		Verifier(const Generator& generator)
+			: _generator(generator), _synced(false), _shifted(false), _previous(0), _expected(0), _run(1)
+			, _candidate(), _streak(), _received(0), _dropped(0), _mismatched(0)
+		{
+		}
+
+		void operator()(const WaveSample16_t* samples, size_t count)
+		{
+			if (count == 0)
+				return;
+
+			uint64_t dropped = 0, mismatched = 0;
+			for (size_t i = 0; i < count; i++)
+			{
+				// Alignment 0 takes samples as received, 1 joins the high byte of the previous one with the low byte of this one
+				WaveSample16_t values[2] = { samples[i], WaveSample16_t((_previous >> 8) | (samples[i] << 8)) };
+				_previous = samples[i];
+
+				if (_run == 0)
+				{
+					if (values[_shifted] == WaveSample16_t(_expected))
+					{
+						_expected++;
+						continue;
+					}
+					_streak[0] = _streak[1] = 0;
+				}
+
+				_run++;
+				for (int alignment = 0; alignment < 2; alignment++)
+				{
+					WaveSample16_t value = values[alignment];
+					if (_streak[alignment] && value == WaveSample16_t(_candidate[alignment]))
+						_streak[alignment]++;
+					else
+					{
+						_candidate[alignment] = _locate(value);
+						_streak[alignment] = 1;
+					}
+					_candidate[alignment]++;
+				}
+				if (_streak[_shifted] >= RESYNC_SAMPLES)
+					_resync(_shifted, dropped, mismatched);
+				else if (_streak[!_shifted] >= RESYNC_SAMPLES)
+					_resync(!_shifted, dropped, mismatched);
+			}
+
+			if (_synced && _run == 0)
+			{
+				int64_t latency = nowNs() - _generator.ScheduledNs(_expected - 1);
+				_latency.Record(uint64_t((std::max<int64_t>)(latency, 0)));
+			}
+			_received.fetch_add(count, std::memory_order_relaxed);
+			_dropped.fetch_add(dropped, std::memory_order_relaxed);
+			_mismatched.fetch_add(mismatched, std::memory_order_relaxed);
+		}
+
+		// Samples of a break still unresolved when the capture ended count as mismatches
+		void Finish()
+		{
+			if (_synced && _run)
+				_mismatched.fetch_add(_run, std::memory_order_relaxed);
+			_run = 0;
+		}
+
+		uint64_t GetReceived() const { return _received.load(std::memory_order_relaxed); }
+		uint64_t GetDropped() const { return _dropped.load(std::memory_order_relaxed); }
+		uint64_t GetMismatched() const { return _mismatched.load(std::memory_order_relaxed); }
+		const LatencyHistogram& GetLatency() const { return _latency; }
+	};
+
+	Options DefaultOptions()
+	{
+		Options opt;
+		opt.baudRate = 921600;
+		opt.sampleRate = 8000;
+		opt.speed = 1.0;
+		opt.durationSec = 3600;
+		opt.blockMs = 20;
+		opt.reportIntervalSec = 10;
+		opt.reportFile = "soak.json";
+		opt.maxDroppedSamples = 0;
+		opt.maxMismatchedSamples = 0;
+		opt.maxRssGrowthMB = 16;
+		opt.maxCpuMsPerAudioSec = 50;
+		opt.maxP99LatencyMs = 100;
+		return opt;
+	}
+
+	int Run(const Options& options, Report& report)
+	{
+		report = Report();
+		double samplesPerSec = options.sampleRate * options.speed;
+		double serialBytesPerSec = options.baudRate / 10.0;
+		if (samplesPerSec * sizeof(WaveSample16_t) > serialBytesPerSec)
+			appLog(Warning) << "Soak: " << samplesPerSec * sizeof(WaveSample16_t) << " B/s exceeds " << serialBytesPerSec
+				<< " B/s at " << options.baudRate << " baud, only virtual port pairs without baud emulation keep up";
+
+		try
+		{
+			Generator generator(options.generatorPort, options.baudRate, samplesPerSec);
+			generator.Start();
+
+			SerialAudioSampler sampler({ options.samplerPort, options.baudRate, SAMPLER_RX_BUFFER_BYTES, SAMPLER_TX_BUFFER_BYTES, 0, "None", 0, 0 }, CALIBRATION_SEC);
+			report.calibratedRate = sampler.GetSamplingRate();
+			sampler.SetGain(1.0f);
+
+			Verifier verifier(generator);
+			sampler.AddSink([&verifier](const WaveSample16_t* samples, size_t count) { verifier(samples, count); });
+
+			int64_t startNs = nowNs();
+			int64_t cpuStart = processCpuNs();
+			report.rssStartMB = report.rssPeakMB = rssMB();
+			sampler.StartSamplingToSinks(options.blockMs);
+
+			int64_t endNs = startNs + int64_t(options.durationSec) * 1000000000;
+			int64_t nextReport = startNs + int64_t(options.reportIntervalSec) * 1000000000;
+			while (nowNs() < endNs)
+			{
+				Sleep(100);
+				if (nowNs() < nextReport)
+					continue;
+
+				nextReport += int64_t(options.reportIntervalSec) * 1000000000;
+				double rss = rssMB();
+				report.rssPeakMB = (std::max)(report.rssPeakMB, rss);
+				appLog(Info) << "Soak: " << (nowNs() - startNs) / 1000000000 << " s, received " << verifier.GetReceived()
+					<< ", dropped " << verifier.GetDropped() << ", mismatched " << verifier.GetMismatched() << ", RSS " << rss << " MB";
+			}
+
+			sampler.Stop();
+			generator.Stop();
+			sampler.Sync();
+			verifier.Finish();
+
+			report.wallSec = (nowNs() - startNs) / 1e9;
+			report.rssEndMB = rssMB();
+			report.rssPeakMB = (std::max)(report.rssPeakMB, report.rssEndMB);
+			report.generatedSamples = generator.GetSent();
+			report.receivedSamples = verifier.GetReceived();
+			report.droppedSamples = verifier.GetDropped();
+			report.mismatchedSamples = verifier.GetMismatched();
+			report.audioSec = double(report.receivedSamples) / options.sampleRate;
+			double samplerCpuNs = double(processCpuNs() - cpuStart - generator.GetCpuNs());
+			report.cpuMsPerAudioSec = report.audioSec > 0 ? samplerCpuNs / 1e6 / report.audioSec : 0;
+
+			auto& latency = verifier.GetLatency();
+			report.latencyP50Ms = latency.Percentile(0.50) / 1e6;
+			report.latencyP90Ms = latency.Percentile(0.90) / 1e6;
+			report.latencyP99Ms = latency.Percentile(0.99) / 1e6;
+			report.latencyP999Ms = latency.Percentile(0.999) / 1e6;
+			report.latencyMaxMs = latency.GetMax() / 1e6;
+		}
+		catch (const std::exception& ex)
+		{
+			appLog(Critical) << "Soak: " << ex.what();
+			report.failures.push_back(ex.what());
+			return -1;
+		}
+
+		if (report.receivedSamples == 0)
+			report.failures.push_back("no samples received");
+		if (report.droppedSamples > options.maxDroppedSamples)
+			report.failures.push_back("dropped samples " + std::to_string(report.droppedSamples) + " > " + std::to_string(options.maxDroppedSamples));
+		if (report.mismatchedSamples > options.maxMismatchedSamples)
+			report.failures.push_back("mismatched samples " + std::to_string(report.mismatchedSamples) + " > " + std::to_string(options.maxMismatchedSamples));
+		if (report.rssEndMB - report.rssStartMB > options.maxRssGrowthMB)
+			report.failures.push_back("RSS grew by " + std::to_string(report.rssEndMB - report.rssStartMB) + " MB");
+		if (report.cpuMsPerAudioSec > options.maxCpuMsPerAudioSec)
+			report.failures.push_back("CPU " + std::to_string(report.cpuMsPerAudioSec) + " ms per audio second");
+		if (report.latencyP99Ms > options.maxP99LatencyMs)
+			report.failures.push_back("p99 latency " + std::to_string(report.latencyP99Ms) + " ms");
+
+		for (auto& failure : report.failures)
+			appLog(Warning) << "Soak failed: " << failure;
+		return report.failures.empty() ? 0 : 1;
+	}
+
+	bool SaveReport(const std::string& file, const Options& options, const Report& report)
+	{
+		std::ofstream out(file);
+		if (!out)
+			return false;
+
+		out << "{" << std::endl
+			<< "  \"passed\": " << (report.failures.empty() ? "true" : "false") << "," << std::endl
+			<< "  \"sample_rate\": " << options.sampleRate << "," << std::endl
+			<< "  \"speed\": " << options.speed << "," << std::endl
+			<< "  \"baud_rate\": " << options.baudRate << "," << std::endl
+			<< "  \"calibrated_rate\": " << report.calibratedRate << "," << std::endl
+			<< "  \"wall_sec\": " << report.wallSec << "," << std::endl
+			<< "  \"audio_sec\": " << report.audioSec << "," << std::endl
+			<< "  \"generated_samples\": " << report.generatedSamples << "," << std::endl
+			<< "  \"received_samples\": " << report.receivedSamples << "," << std::endl
+			<< "  \"dropped_samples\": " << report.droppedSamples << "," << std::endl
+			<< "  \"mismatched_samples\": " << report.mismatchedSamples << "," << std::endl
+			<< "  \"rss_mb_start\": " << report.rssStartMB << "," << std::endl
+			<< "  \"rss_mb_peak\": " << report.rssPeakMB << "," << std::endl
+			<< "  \"rss_mb_end\": " << report.rssEndMB << "," << std::endl
+			<< "  \"cpu_ms_per_audio_sec\": " << report.cpuMsPerAudioSec << "," << std::endl
+			<< "  \"latency_ms\": { \"p50\": " << report.latencyP50Ms << ", \"p90\": " << report.latencyP90Ms << ", \"p99\": " << report.latencyP99Ms
+			<< ", \"p999\": " << report.latencyP999Ms << ", \"max\": " << report.latencyMaxMs << " }," << std::endl
+			<< "  \"failures\": [";
+		for (size_t i = 0; i < report.failures.size(); i++)
+			out << (i ? ", " : "") << "\"" << report.failures[i] << "\"";
+		out << "]" << std::endl << "}" << std::endl;
+		return bool(out);
+	}
+}
\ No newline at end of file
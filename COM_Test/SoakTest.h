@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// End-to-end soak and throughput harness. A generator thread writes a 16-bit counter signal
+// to one end of a serial port pair at a configurable rate, SerialAudioSampler captures the
+// other end into a verifying sink, and the run fails when drops, corruption, memory growth,
+// CPU cost or latency cross the configured thresholds.
+namespace SoakTest
+{
+	struct Options
+	{
+		std::string		generatorPort;		// Generator writes here
+		std::string		samplerPort;		// Sampler reads here, connected to generatorPort (null-modem cable or com0com)
+		unsigned int	baudRate;
+		unsigned int	sampleRate;			// Samples per second of generated audio
+		double			speed;				// Time compression, the generator runs this many times faster than real time
+		int				durationSec;		// Wall-clock length of the run
+		int				blockMs;			// Sampler segment length
+		int				reportIntervalSec;
+		std::string		reportFile;			// JSON report, empty = none
+
+		uint64_t		maxDroppedSamples;
+		uint64_t		maxMismatchedSamples;
+		double			maxRssGrowthMB;
+		double			maxCpuMsPerAudioSec;
+		double			maxP99LatencyMs;
+	};
+
+	struct Report
+	{
+		double			wallSec;
+		double			audioSec;			// Audio received, in seconds of the generated rate
+		unsigned int	calibratedRate;		// Rate measured by the sampler
+		uint64_t		generatedSamples;
+		uint64_t		receivedSamples;
+		uint64_t		droppedSamples;
+		uint64_t		mismatchedSamples;
+		double			rssStartMB;
+		double			rssPeakMB;
+		double			rssEndMB;
+		double			cpuMsPerAudioSec;	// Process CPU time without the generator thread
+		double			latencyP50Ms;
+		double			latencyP90Ms;
+		double			latencyP99Ms;
+		double			latencyP999Ms;
+		double			latencyMaxMs;
+		std::vector<std::string> failures;
+	};
+
+	Options DefaultOptions();
+
+	// Returns 0 when all thresholds hold, 1 when any is crossed, -1 when the run could not start
+	int Run(const Options& options, Report& report);
+	bool SaveReport(const std::string& file, const Options& options, const Report& report);
+}
\ No newline at end of file
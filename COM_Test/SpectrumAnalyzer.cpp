@@ -0,0 +1,273 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <Windows.h>
+
+#include "SpectrumAnalyzer.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Profiler.h"
+
+static double toDb(double ratio)
+{
+	return ratio > 0.0 ? 10.0 * std::log10(ratio) : -200.0;
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+	: _settings({ false, 0, 0, "", 0 })
+	, _sampleRate(0)
+	, _running(false)
+	, _frameFill(0)
+	, _frames(0)
+	, _windowGain(1.0)
+	, _intervalSamples(0)
+	, _samples(0)
+	, _sumSquares(0)
+	, _min(0)
+	, _max(0)
+	, _clipped(0)
+	, _index(0)
+	, _last({})
+{
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+	Stop();
+}
+
+bool SpectrumAnalyzer::Start(const AnalysisSettings& settings, uint32_t sampleRate)
+{
+	if (_running.load() || !settings.enabled || sampleRate == 0)
+		return false;
+
+	_settings = settings;
+	_sampleRate = sampleRate;
+	// Rounded up to a power of two for the radix-2 FFT
+	size_t fftSize = 8;
+	while (fftSize < size_t(settings.fftSize))
+		fftSize <<= 1;
+	_fft.reset(new Fft(fftSize));
+
+	const size_t n = _fft->GetSize();
+	const double pi = 3.14159265358979323846;
+	_window.resize(n);
+	double windowSum = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		_window[i] = float(0.5 - 0.5 * std::cos(2.0 * pi * double(i) / double(n)));
+		windowSum += _window[i];
+	}
+	// A full-scale sine peaks at (32768 * sum(w) / 2)^2 in its bin, that is 0 dBFS
+	_windowGain = std::pow(32768.0 * windowSum / 2.0, 2);
+
+	_frame.assign(n, 0.0f);
+	_windowed.assign(n, 0.0f);
+	_frameFill = 0;
+	_power.assign(n / 2 + 1, 0.0f);
+	_powerSum.assign(n / 2 + 1, 0.0);
+	_frames = 0;
+
+	_ring.Reset((std::max)(size_t(sampleRate) * RING_SEC, n * 2), 1);
+
+	_intervalSamples = (std::max<uint64_t>)(uint64_t(sampleRate) * uint64_t(settings.intervalMs) / 1000, 1);
+	_samples = 0;
+	_sumSquares = 0;
+	_clipped = 0;
+	_index = 0;
+
+	_running = true;
+	_worker = std::thread(&SpectrumAnalyzer::_loop, this);
+	appLog(Info) << "Analysis: " << n << "-point FFT, " << double(sampleRate) / double(n) << " Hz resolution, result every "
+		<< settings.intervalMs << " ms" << (settings.file.empty() ? "" : " to " + settings.file);
+	return true;
+}
+
+void SpectrumAnalyzer::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	if (_worker.joinable())
+		_worker.join();
+	if (_ring.GetDroppedSamples())
+		appLog(Warning) << "Analysis fell behind and skipped " << _ring.GetDroppedSamples() << " samples";
+}
+
+void SpectrumAnalyzer::Push(const WaveSample16_t* samples, size_t count)
+{
+	_ring.Push(reinterpret_cast<const int16_t*>(samples), count);
+}
+
+void SpectrumAnalyzer::_loop()
+{
+	PROFILE_THREAD("Analysis");
+	while (true)
+	{
+		bool running = _running.load();
+		const int16_t* samples = nullptr;
+		size_t count = _ring.Peek(samples);
+		if (count == 0)
+		{
+			if (!running)
+				break;
+			Sleep(POLL_MS);
+			continue;
+		}
+
+		_process(samples, count);
+		_ring.Consume(count);
+	}
+
+	if (_samples)
+		_publish();
+}
+
+void SpectrumAnalyzer::_process(const int16_t* samples, size_t count)
+{
+	PROFILE_ZONE("Analyze");
+	while (count)
+	{
+		// Never run past the end of the interval or the FFT frame, so each loop below is a plain vectorizable pass
+		size_t chunk = (std::min)({ count, size_t(_intervalSamples - _samples), _frame.size() - _frameFill });
+
+		if (_samples == 0)
+			_min = _max = samples[0];
+		int lo = _min, hi = _max;
+		uint64_t clipped = 0;
+		float sumSquares = 0;
+		float* frame = _frame.data() + _frameFill;
+		for (size_t i = 0; i < chunk; i++)
+		{
+			int s = samples[i];
+			lo = (std::min)(lo, s);
+			hi = (std::max)(hi, s);
+			clipped += (s <= -32768) | (s >= 32767);
+			float f = float(s);
+			sumSquares += f * f;
+			frame[i] = f;
+		}
+		_min = lo;
+		_max = hi;
+		_clipped += clipped;
+		_sumSquares += sumSquares;
+		_samples += chunk;
+		_frameFill += chunk;
+
+		if (_frameFill == _frame.size())
+			_analyzeFrame();
+		if (_samples == _intervalSamples)
+			_publish();
+
+		samples += chunk;
+		count -= chunk;
+	}
+}
+
+void SpectrumAnalyzer::_analyzeFrame()
+{
+	PROFILE_ZONE("Fft");
+	const size_t n = _frame.size();
+	for (size_t i = 0; i < n; i++)
+		_windowed[i] = _frame[i] * _window[i];
+	_fft->PowerSpectrum(_windowed.data(), _power.data());
+	for (size_t k = 0; k < _power.size(); k++)
+		_powerSum[k] += _power[k];
+	_frames++;
+
+	// Keep the second half, frames overlap by 50%
+	memmove(_frame.data(), _frame.data() + n / 2, n / 2 * sizeof(float));
+	_frameFill = n / 2;
+}
+
+void SpectrumAnalyzer::_publish()
+{
+	AnalysisResult result = {};
+	result.index = _index++;
+	result.samples = _samples;
+	result.frames = _frames;
+	result.rmsDbfs = toDb(_sumSquares / double(_samples) / (32768.0 * 32768.0));
+	int peak = (std::max)(std::abs(_min), std::abs(_max));
+	result.peakDbfs = toDb(double(peak) * peak / (32768.0 * 32768.0));
+	result.clipped = _clipped;
+	result.flat = _min == _max;
+
+	const size_t bins = _powerSum.size();
+	const double binHz = double(_sampleRate) / double(_frame.size());
+	size_t bands = size_t((std::max)(_settings.bands, 1));
+	result.bandHz = binHz * double(bins - 1) / double(bands);
+	result.bandsDbfs.assign(bands, -200.0f);
+	result.dominantDbfs = -200.0;
+	if (_frames)
+	{
+		size_t dominant = 1;
+		for (size_t k = 2; k < bins; k++)
+			if (_powerSum[k] > _powerSum[dominant])
+				dominant = k;
+		result.dominantHz = double(dominant) * binHz;
+		result.dominantDbfs = toDb(_powerSum[dominant] / double(_frames) / _windowGain);
+
+		// DC is left out of the bands, band b covers bins (b * (bins - 1) / bands, (b + 1) * (bins - 1) / bands]
+		for (size_t b = 0; b < bands; b++)
+		{
+			size_t from = 1 + b * (bins - 1) / bands;
+			size_t to = 1 + (b + 1) * (bins - 1) / bands;
+			double sum = 0;
+			for (size_t k = from; k < to; k++)
+				sum += _powerSum[k];
+			if (to > from)
+				result.bandsDbfs[b] = float(toDb(sum / double(to - from) / double(_frames) / _windowGain));
+		}
+	}
+
+	appMetricAdd(ClippedSamples, _clipped);
+	appMetricSet(InputPeak, peak);
+	appMetricSet(InputRms, std::sqrt(_sumSquares / double(_samples)));
+	appMetricSet(DominantFrequencyHz, result.dominantHz);
+	if (result.flat)
+		appLog(Warning) << "Analysis: input stuck at " << _min << " for " << _samples << " samples";
+	else if (_clipped)
+		appLog(Debug) << "Analysis: " << _clipped << " clipped samples";
+
+	if (!_settings.file.empty())
+		_writeFile(result);
+	{
+		std::lock_guard<std::mutex> lock(_lastMutex);
+		_last = std::move(result);
+	}
+
+	std::fill(_powerSum.begin(), _powerSum.end(), 0.0);
+	_frames = 0;
+	_samples = 0;
+	_sumSquares = 0;
+	_clipped = 0;
+}
+
+bool SpectrumAnalyzer::_writeFile(const AnalysisResult& result) const
+{
+	// Write aside and swap in, so readers never see a partial file
+	std::string temp = _settings.file + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::trunc);
+		if (!out)
+			return false;
+		out.setf(std::ios::fixed);
+		out.precision(1);
+		out << "{\"index\":" << result.index << ",\"sampleRate\":" << _sampleRate << ",\"samples\":" << result.samples
+			<< ",\"rmsDbfs\":" << result.rmsDbfs << ",\"peakDbfs\":" << result.peakDbfs << ",\"clipped\":" << result.clipped
+			<< ",\"flat\":" << (result.flat ? "true" : "false") << ",\"dominantHz\":" << result.dominantHz
+			<< ",\"dominantDbfs\":" << result.dominantDbfs << ",\"bandHz\":" << result.bandHz << ",\"bandsDbfs\":[";
+		for (size_t b = 0; b < result.bandsDbfs.size(); b++)
+			out << (b ? "," : "") << result.bandsDbfs[b];
+		out << "]}\n";
+	}
+	return MoveFileExA(temp.c_str(), _settings.file.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+AnalysisResult SpectrumAnalyzer::GetLast() const
+{
+	std::lock_guard<std::mutex> lock(_lastMutex);
+	return _last;
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+#include "WaveStream.h"
+#include "SampleRing.h"
+#include "Fft.h"
+
+struct AnalysisSettings
+{
+	bool			enabled;
+	int				fftSize;	// Rounded up to a power of two, frames overlap by half
+	int				intervalMs;	// Audio time per published result
+	std::string		file;		// Rewritten with every result, empty = metrics only
+	int				bands;		// Spectrum bins are averaged into this many equal-width bands
+};
+
+struct AnalysisResult
+{
+	uint64_t			index;
+	uint64_t			samples;
+	uint64_t			frames;
+	double				rmsDbfs;
+	double				peakDbfs;
+	uint64_t			clipped;		// Samples at either end of the 16-bit range
+	bool				flat;			// Every sample had the same value, e.g. a dead channel
+	double				dominantHz;		// Strongest bin above DC, shows hum at 50/60 Hz and harmonics
+	double				dominantDbfs;
+	double				bandHz;
+	std::vector<float>	bandsDbfs;
+};
+
+// Level and spectrum analysis off the capture thread. Push() copies samples into a lock-free
+// ring and returns; a worker computes Hann-windowed FFT power, RMS, peak and clip counts and
+// publishes one result per interval to the metrics registry and a small JSON file.
+class SpectrumAnalyzer
+{
+private:
+	SampleRing				_ring;
+
+	AnalysisSettings		_settings;
+	uint32_t				_sampleRate;
+	std::atomic<bool>		_running;
+	std::thread				_worker;
+
+	std::unique_ptr<Fft>	_fft;
+	std::vector<float>		_window;
+	std::vector<float>		_frame;
+	std::vector<float>		_windowed;
+	size_t					_frameFill;
+	std::vector<float>		_power;
+	std::vector<double>		_powerSum;
+	uint64_t				_frames;
+	double					_windowGain;
+
+	uint64_t				_intervalSamples;
+	uint64_t				_samples;
+	double					_sumSquares;
+	int						_min;
+	int						_max;
+	uint64_t				_clipped;
+	uint64_t				_index;
+
+	AnalysisResult			_last;
+	mutable std::mutex		_lastMutex;
+
+	void _loop();
+	void _process(const int16_t* samples, size_t count);
+	void _analyzeFrame();
+	void _publish();
+	bool _writeFile(const AnalysisResult& result) const;
+
+	static constexpr int POLL_MS = 10;
+	static constexpr int RING_SEC = 2;
+
+	SpectrumAnalyzer(const SpectrumAnalyzer&) = delete;
+	SpectrumAnalyzer& operator=(const SpectrumAnalyzer&) = delete;
+
+public:
+	SpectrumAnalyzer();
+	~SpectrumAnalyzer();
+
+	bool Start(const AnalysisSettings& settings, uint32_t sampleRate);
+	void Stop();	// Analyzes what is left in the ring and publishes the last partial interval
+
+	void Push(const WaveSample16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+	AnalysisResult GetLast() const;
+};
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <fstream>
+#include <vector>
+
+#include "TraceLog.h"
+#include "Logger.h"
+#include "Utils.h"
+
+namespace _____TRACE
+{
+	constexpr char TraceLog::MAGIC[8];
+
+	const char* TraceEventName(uint16_t event)
+	{
+		switch (TraceEvent(event))
+		{
+		case TraceEvent::SerialRead:
+			return "SerialRead";
+
+		case TraceEvent::BlockPushed:
+			return "BlockPushed";
+
+		case TraceEvent::BlockDropped:
+			return "BlockDropped";
+
+		case TraceEvent::SequenceError:
+			return "SequenceError";
+
+		case TraceEvent::CrcError:
+			return "CrcError";
+
+		case TraceEvent::LineError:
+			return "LineError";
+
+		case TraceEvent::FlowControl:
+			return "FlowControl";
+
+		default:
+			return "Unknown";
+		}
+	}
+
+	TraceLog::TraceLog()
+		: _file(INVALID_HANDLE_VALUE)
+		, _mapping(NULL)
+		, _header(nullptr)
+		, _records(nullptr)
+		, _capacity(0)
+		, _next(0)
+		, _open(false)
+	{
+	}
+
+	TraceLog::~TraceLog()
+	{
+		Close();
+	}
+
+	uint16_t TraceLog::_threadId()
+	{
+		static std::atomic<uint16_t> nextId(1);
+		static thread_local uint16_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+		return id;
+	}
+
+	bool TraceLog::Open(const std::string& fileName, uint64_t capacityRecords)
+	{
+		Close();
+		if (capacityRecords == 0)
+			return false;
+
+		uint64_t size = sizeof(TraceFileHeader) + capacityRecords * sizeof(TraceRecord);
+		_file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (_file == INVALID_HANDLE_VALUE)
+		{
+			appLog(Warning) << "Trace: cannot create " << fileName;
+			return false;
+		}
+
+		_mapping = CreateFileMappingA(_file, NULL, PAGE_READWRITE, DWORD(size >> 32), DWORD(size & 0xFFFFFFFF), NULL);
+		if (!_mapping)
+		{
+			appLog(Warning) << "Trace: CreateFileMapping failed, error " << GetLastError();
+			Close();
+			return false;
+		}
+
+		void* view = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, SIZE_T(size));
+		if (!view)
+		{
+			appLog(Warning) << "Trace: MapViewOfFile failed, error " << GetLastError();
+			Close();
+			return false;
+		}
+
+		_header = reinterpret_cast<TraceFileHeader*>(view);
+		_records = reinterpret_cast<TraceRecord*>(_header + 1);
+		_capacity = capacityRecords;
+		_next = 0;
+
+		memset(_header, 0, sizeof(TraceFileHeader));
+		memcpy(_header->magic, MAGIC, sizeof(MAGIC));
+		_header->version = VERSION;
+		_header->recordSize = sizeof(TraceRecord);
+		_header->capacity = capacityRecords;
+		_header->writeIndex = 0;
+		_header->startUnixMs = Utils::getTimeMs();
+		_header->startNs = Now();
+
+		_open = true;
+		appLog(Info) << "Trace: writing " << capacityRecords << " record ring to " << fileName;
+		return true;
+	}
+
+	void TraceLog::Close()
+	{
+		_open = false;
+		if (_header)
+		{
+			FlushViewOfFile(_header, 0);
+			UnmapViewOfFile(_header);
+			_header = nullptr;
+			_records = nullptr;
+		}
+		if (_mapping)
+		{
+			CloseHandle(_mapping);
+			_mapping = NULL;
+		}
+		if (_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(_file);
+			_file = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	bool TraceLog::Decode(const std::string& traceFile, const std::string& csvFile)
+	{
+		std::ifstream in(traceFile, std::ios::binary);
+		if (!in)
+			return false;
+
+		TraceFileHeader header;
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return false;
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.recordSize != sizeof(TraceRecord))
+			return false;
+
+		std::ofstream out(csvFile);
+		if (!out)
+			return false;
+
+		std::vector<TraceRecord> records(size_t(header.capacity));
+		in.read(reinterpret_cast<char*>(records.data()), std::streamsize(records.size() * sizeof(TraceRecord)));
+		size_t available = size_t(in.gcount() / sizeof(TraceRecord));
+
+		out << "index,time_ns,rel_ns,thread,event,arg0,arg1\n";
+		uint64_t written = header.writeIndex.load();
+		uint64_t first = written > header.capacity ? written - header.capacity : 0;
+		for (uint64_t index = first; index < written; index++)
+		{
+			size_t slot = size_t(index % header.capacity);
+			if (slot >= available)
+				continue;
+			const TraceRecord& rec = records[slot];
+			if (rec.sequence != uint32_t(index + 1))
+				continue;	// Torn or overwritten record
+
+			out << index << ',' << rec.timeNs << ',' << rec.timeNs - header.startNs << ',' << rec.thread << ','
+				<< TraceEventName(rec.event) << ',' << rec.arg0 << ',' << rec.arg1 << '\n';
+		}
+
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <Windows.h>
+
+#include "Clock.h"
+
+namespace _____TRACE
+{
+	enum class TraceEvent : uint16_t
+	{
+		None,
+		SerialRead,		// arg0: bytes read, arg1: read call latency (ns)
+		BlockPushed,	// arg0: segments queued for playback, arg1: pool blocks in use
+		BlockDropped,	// arg0: dropped blocks so far, arg1: pool blocks in use
+		SequenceError,	// arg0: expected sequence, arg1: received sequence
+		CrcError,		// arg0: expected CRC, arg1: received CRC
+		LineError,		// arg0: CE_* flags from ClearCommError, arg1: capture sample where it was noticed
+		FlowControl,	// arg0: 1 = RTS deasserted, 0 = asserted again, arg1: queued playback ms
+		Count
+	};
+
+	const char* TraceEventName(uint16_t event);
+
+	// 32-byte record, two per cache line
+	struct TraceRecord
+	{
+		uint64_t	timeNs;		// Monotonic nanoseconds
+		uint32_t	sequence;	// Low 32 bits of record index + 1, written last so torn records can be skipped
+		uint16_t	event;
+		uint16_t	thread;
+		uint64_t	arg0;
+		uint64_t	arg1;
+	};
+
+	struct TraceFileHeader
+	{
+		char					magic[8];
+		uint32_t				version;
+		uint32_t				recordSize;
+		uint64_t				capacity;		// Records in the ring
+		std::atomic<uint64_t>	writeIndex;		// Total records written, only ever raised
+		int64_t					startUnixMs;	// Wall clock when the trace was opened
+		uint64_t				startNs;		// Monotonic time when the trace was opened
+		uint8_t					reserved[16];
+	};
+
+	// Binary trace channel: fixed-size records written lock-free into a memory-mapped ring file.
+	// Cheap enough to call per serial read; decode offline with Decode().
+	class TraceLog
+	{
+	private:
+		HANDLE					_file;
+		HANDLE					_mapping;
+		TraceFileHeader*		_header;
+		TraceRecord*			_records;
+		uint64_t				_capacity;
+		std::atomic<uint64_t>	_next;
+		std::atomic<bool>		_open;
+
+		static uint16_t _threadId();
+
+		TraceLog(const TraceLog&) = delete;
+		TraceLog& operator=(const TraceLog&) = delete;
+
+	public:
+		static constexpr char		MAGIC[8] = { 'S', 'A', 'S', 'T', 'R', 'A', 'C', 'E' };
+		static constexpr uint32_t	VERSION = 1;
+
+		TraceLog();
+		~TraceLog();
+
+		bool Open(const std::string& fileName, uint64_t capacityRecords);
+		void Close();
+
+		inline bool Enabled() const
+		{
+			return _open.load(std::memory_order_relaxed);
+		}
+
+		inline uint64_t Now() const
+		{
+			return Clock::NowNs();
+		}
+
+		inline void Write(TraceEvent event, uint64_t arg0, uint64_t arg1)
+		{
+			uint64_t index = _next.fetch_add(1, std::memory_order_relaxed);
+			TraceRecord& rec = _records[index % _capacity];
+			rec.sequence = 0;
+			rec.timeNs = Now();
+			rec.event = uint16_t(event);
+			rec.thread = _threadId();
+			rec.arg0 = arg0;
+			rec.arg1 = arg1;
+			std::atomic_thread_fence(std::memory_order_release);
+			rec.sequence = uint32_t(index + 1);
+
+			// Writers finish out of order, a plain store could move the index back past newer records
+			uint64_t written = _header->writeIndex.load(std::memory_order_relaxed);
+			while (written < index + 1 && !_header->writeIndex.compare_exchange_weak(written, index + 1, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		static bool Decode(const std::string& traceFile, const std::string& csvFile);
+	};
+
+#ifdef _TRACE_MAIN_CPP
+	TraceLog ___Trace;
+#else
+	extern TraceLog ___Trace;
+#endif
+}
+
+#define TRACE_ENABLED() _____TRACE::___Trace.Enabled()
+#define TRACE_NOW() (TRACE_ENABLED() ? _____TRACE::___Trace.Now() : 0)
+#define appTrace(event, arg0, arg1) \
+	if (!TRACE_ENABLED()) {} \
+	else _____TRACE::___Trace.Write(_____TRACE::TraceEvent::event, uint64_t(arg0), uint64_t(arg1))
\ No newline at end of file
@@ -0,0 +1,321 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+
+#include "TriggerRecorder.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "Utils.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+TriggerRecorder::TriggerRecorder()
+	: _ringMask(0)
+	, _writePos(0)
+	, _pending(0)
+	, _settings({ false, 0, 0, "", 0.0, 0, "" })
+	, _samplingRate(0)
+	, _channels(1)
+	, _levelThreshold(0)
+	, _dumps(0)
+	, _lostSamples(0)
+	, _socket(uintptr_t(INVALID_SOCKET))
+	, _event(NULL)
+	, _running(false)
+{
+}
+
+TriggerRecorder::~TriggerRecorder()
+{
+	Stop();
+}
+
+const char* TriggerRecorder::SourceName(TriggerSource source)
+{
+	switch (source)
+	{
+	case TriggerSource::Level:		return "level";
+	case TriggerSource::Command:	return "command";
+	case TriggerSource::Event:		return "event";
+	case TriggerSource::Manual:		return "manual";
+	default:						return "unknown";
+	}
+}
+
+bool TriggerRecorder::Start(const TriggerSettings& settings, SamplingRate_t samplingRate, WORD channels)
+{
+	if (_running.load() || !settings.enabled || samplingRate == 0)
+		return false;
+
+	_settings = settings;
+	_samplingRate = samplingRate;
+	_channels = channels;
+	_levelThreshold = settings.levelDb < 0.0
+		? int16_t((std::min)(32767.0, 32768.0 * std::pow(10.0, settings.levelDb / 20.0)))
+		: 0;
+
+	// All memory is taken here; capture and dumps only reuse it
+	size_t ringSize = 1;
+	while (ringSize < size_t(samplingRate) * channels * (settings.preSec + settings.postSec + SLACK_SEC))
+		ringSize <<= 1;
+	_ring.assign(ringSize, 0);
+	_ringMask = ringSize - 1;
+	_scratch.assign(SCRATCH_SAMPLES, 0);
+	_writePos = 0;
+	_pending = 0;
+	_dumps = 0;
+	_lostSamples = 0;
+
+	CreateDirectoryA(settings.directory.c_str(), NULL);
+	_openListeners();
+
+	_running = true;
+	_worker = std::thread(&TriggerRecorder::_loop, this);
+	appLog(Info) << "Trigger: keeping " << settings.preSec << " s before and " << settings.postSec << " s after a trigger, "
+		<< (ringSize * sizeof(int16_t) >> 10) << " KB ring";
+	return true;
+}
+
+void TriggerRecorder::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+
+	if (_worker.joinable())
+		_worker.join();
+	_closeListeners();
+	if (_lostSamples)
+		appLog(Warning) << "Trigger: dumps fell behind capture and lost " << _lostSamples << " samples";
+	appLog(Info) << "Trigger: " << _dumps << " dumps written to " << _settings.directory;
+}
+
+bool TriggerRecorder::_openListeners()
+{
+	bool ok = true;
+	if (!_settings.eventName.empty())
+	{
+		_event = CreateEventA(NULL, FALSE, FALSE, _settings.eventName.c_str());
+		if (_event == NULL)
+		{
+			appLog(Warning) << "Trigger: cannot create event " << _settings.eventName << ", error " << GetLastError();
+			ok = false;
+		}
+		else
+			appLog(Info) << "Trigger: listening for event " << _settings.eventName;
+	}
+
+	if (_settings.commandPort > 0)
+	{
+		WSADATA wsa;
+		SOCKET sock = INVALID_SOCKET;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) == 0)
+			sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(u_short(_settings.commandPort));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (sock == INVALID_SOCKET || bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			appLog(Warning) << "Trigger: cannot listen on udp 127.0.0.1:" << _settings.commandPort << ", error " << WSAGetLastError();
+			if (sock != INVALID_SOCKET)
+				closesocket(sock);
+			WSACleanup();
+			ok = false;
+		}
+		else
+		{
+			_socket = uintptr_t(sock);
+			appLog(Info) << "Trigger: listening for commands on udp 127.0.0.1:" << _settings.commandPort;
+		}
+	}
+	return ok;
+}
+
+void TriggerRecorder::_closeListeners()
+{
+	if (_event != NULL)
+	{
+		CloseHandle(_event);
+		_event = NULL;
+	}
+	if (SOCKET(_socket) != INVALID_SOCKET)
+	{
+		closesocket(SOCKET(_socket));
+		_socket = uintptr_t(INVALID_SOCKET);
+		WSACleanup();
+	}
+}
+
+void TriggerRecorder::Push(const WaveSample16_t* samples, size_t count)
+{
+	const int16_t* in = reinterpret_cast<const int16_t*>(samples);
+	uint64_t write = _writePos.load(std::memory_order_relaxed);
+
+	// The ring always takes the newest samples; a dump that fell too far behind notices and skips
+	while (count)
+	{
+		size_t offset = size_t(write) & _ringMask;
+		size_t chunk = (std::min)(count, _ring.size() - offset);
+		memcpy(_ring.data() + offset, in, chunk * sizeof(int16_t));
+
+		if (_levelThreshold > 0 && _pending.load(std::memory_order_relaxed) == 0)
+		{
+			for (size_t i = 0; i < chunk; i++)
+			{
+				if (in[i] >= _levelThreshold || in[i] <= -_levelThreshold)
+				{
+					_request(write + i, TriggerSource::Level);
+					break;
+				}
+			}
+		}
+
+		write += chunk;
+		in += chunk;
+		count -= chunk;
+	}
+	_writePos.store(write, std::memory_order_release);
+}
+
+void TriggerRecorder::Trigger()
+{
+	_request(_writePos.load(std::memory_order_acquire), TriggerSource::Manual);
+}
+
+void TriggerRecorder::_request(uint64_t position, TriggerSource source)
+{
+	// Only the first trigger arms; the worker disarms when its dump is complete
+	position -= position % _channels;
+	uint64_t expected = 0;
+	_pending.compare_exchange_strong(expected, (position << 3) | uint64_t(source), std::memory_order_acq_rel);
+}
+
+void TriggerRecorder::_poll()
+{
+	if (_event != NULL && WaitForSingleObject(_event, 0) == WAIT_OBJECT_0)
+		_request(_writePos.load(std::memory_order_acquire), TriggerSource::Event);
+
+	SOCKET sock = SOCKET(_socket);
+	if (sock == INVALID_SOCKET)
+	{
+		Sleep(POLL_MS);
+		return;
+	}
+
+	// Waiting on the socket is the worker's poll interval
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(sock, &readable);
+	timeval timeout = { 0, POLL_MS * 1000 };
+	if (select(0, &readable, nullptr, nullptr, &timeout) <= 0)
+		return;
+
+	char command[64];
+	sockaddr_in from = {};
+	int fromLen = sizeof(from);
+	int received = recvfrom(sock, command, sizeof(command) - 1, 0, (sockaddr*)&from, (socklen_t*)&fromLen);
+	if (received <= 0)
+		return;
+	command[received] = 0;
+
+	const char* reply = "ERROR unknown command\n";
+	if (_strnicmp(command, "trigger", 7) == 0)
+	{
+		bool busy = _pending.load(std::memory_order_acquire) != 0;
+		_request(_writePos.load(std::memory_order_acquire), TriggerSource::Command);
+		reply = busy ? "BUSY\n" : "OK\n";
+	}
+	sendto(sock, reply, int(strlen(reply)), 0, (sockaddr*)&from, fromLen);
+}
+
+void TriggerRecorder::_loop()
+{
+	PROFILE_THREAD("TriggerRecorder");
+	while (_running.load())
+	{
+		_poll();
+		uint64_t pending = _pending.load(std::memory_order_acquire);
+		if (pending == 0)
+			continue;
+
+		_writeDump(pending >> 3, TriggerSource(pending & 7));
+		_pending.store(0, std::memory_order_release);
+	}
+}
+
+void TriggerRecorder::_writeDump(uint64_t position, TriggerSource source)
+{
+	PROFILE_ZONE("TriggerDump");
+	const uint64_t perSec = uint64_t(_samplingRate) * _channels;
+	const uint64_t preSamples = _settings.preSec * perSec;
+	const uint64_t postSamples = _settings.postSec * perSec;
+
+	uint64_t write = _writePos.load(std::memory_order_acquire);
+	uint64_t oldest = write > _ring.size() ? write - _ring.size() : 0;
+	uint64_t from = (std::max)(position > preSamples ? position - preSamples : 0, oldest);
+	from += (_channels - from % _channels) % _channels;
+	const uint64_t to = position + postSamples;
+
+	time_t now = time(0);
+	tm local;
+	localtime_s(&local, &now);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &local);
+	char name[64];
+	snprintf(name, sizeof(name), "trigger_%s_%03d.wav", stamp, int(Utils::getTimeMs() % 1000));
+	std::string path = _settings.directory + "\\" + name;
+	if (!_dump.Open(path, _channels, _samplingRate, sizeof(int16_t) * 8))
+	{
+		appLog(Warning) << "Trigger: cannot create " << path;
+		return;
+	}
+	appLog(Info) << "Trigger: " << SourceName(source) << " trigger, dumping to " << path;
+
+	uint64_t cursor = from;
+	while (cursor < to)
+	{
+		write = _writePos.load(std::memory_order_acquire);
+		if (write <= cursor)
+		{
+			// Post-trigger audio has not arrived yet; keep answering commands meanwhile
+			if (!_running.load())
+				break;
+			_poll();
+			continue;
+		}
+
+		size_t offset = size_t(cursor) & _ringMask;
+		size_t chunk = size_t((std::min<uint64_t>)((std::min)(write, to) - cursor, _scratch.size()));
+		chunk = (std::min)(chunk, _ring.size() - offset);
+		memcpy(_scratch.data(), _ring.data() + offset, chunk * sizeof(int16_t));
+
+		// Capture may have lapped the copy while it ran; those samples are newer audio, skip past them
+		write = _writePos.load(std::memory_order_acquire);
+		oldest = write > _ring.size() ? write - _ring.size() : 0;
+		if (oldest > cursor)
+		{
+			uint64_t skip = oldest - cursor + perSec / 10;
+			skip -= skip % _channels;
+			_lostSamples += skip;
+			cursor += skip;
+			continue;
+		}
+
+		_dump.Write(_scratch.data(), chunk * sizeof(int16_t));
+		cursor += chunk;
+	}
+
+	uint64_t bytes = _dump.GetDataBytes();
+	if (!_dump.Close())
+		appLog(Warning) << "Trigger: writing " << path << " failed";
+	_dumps++;
+	appLog(Info) << "Trigger: " << name << " holds " << double(position - from) / perSec << " s before and "
+		<< double((std::min)(cursor, to) > position ? (std::min)(cursor, to) - position : 0) / perSec << " s after the trigger, "
+		<< bytes << " bytes";
+}
\ No newline at end of file
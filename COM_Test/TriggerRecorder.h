@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "WaveStream.h"
+
+struct TriggerSettings
+{
+	bool			enabled;
+	int				preSec;			// Audio kept before the trigger
+	int				postSec;		// Audio recorded after the trigger
+	std::string		directory;		// Dumps are written here as trigger_YYYYMMDD_HHMMSS_mmm.wav
+	double			levelDb;		// Trigger when a sample reaches this level in dBFS, 0 = disabled
+	int				commandPort;	// UDP port on 127.0.0.1 accepting "trigger", 0 = disabled
+	std::string		eventName;		// Named event another process can set, empty = disabled
+};
+
+enum class TriggerSource
+{
+	None,
+	Level,
+	Command,
+	Event,
+	Manual
+};
+
+// Keeps the last preSec + postSec seconds of samples in a ring allocated once at Start.
+// The capture thread only copies into the ring and checks the level; a worker thread
+// listens for triggers and writes the pre- and post-trigger audio to a WAV while capture goes on.
+// Triggers arriving while a dump is in progress are ignored.
+class TriggerRecorder
+{
+private:
+	std::vector<int16_t>	_ring;
+	size_t					_ringMask;
+	std::vector<int16_t>	_scratch;
+	alignas(64) std::atomic<uint64_t> _writePos;
+	alignas(64) std::atomic<uint64_t> _pending;		// (position << 3) | TriggerSource of the armed trigger, 0 = none
+
+	TriggerSettings			_settings;
+	SamplingRate_t			_samplingRate;
+	WORD					_channels;
+	int16_t					_levelThreshold;
+	WaveFileWriter			_dump;
+	uint64_t				_dumps;
+	uint64_t				_lostSamples;
+
+	uintptr_t				_socket;
+	HANDLE					_event;
+	std::atomic<bool>		_running;
+	std::thread				_worker;
+
+	void _loop();
+	void _poll();
+	void _request(uint64_t position, TriggerSource source);
+	void _writeDump(uint64_t position, TriggerSource source);
+	bool _openListeners();
+	void _closeListeners();
+
+	static constexpr int POLL_MS = 20;
+	static constexpr int SLACK_SEC = 2;		// Extra ring space, so the dump can lag capture without losing its oldest samples
+	static constexpr size_t SCRATCH_SAMPLES = 32 * 1024;
+
+	TriggerRecorder(const TriggerRecorder&) = delete;
+	TriggerRecorder& operator=(const TriggerRecorder&) = delete;
+
+public:
+	TriggerRecorder();
+	~TriggerRecorder();
+
+	bool Start(const TriggerSettings& settings, SamplingRate_t samplingRate, WORD channels);
+	void Stop();	// A dump in progress is cut short at the samples captured so far
+
+	void Push(const WaveSample16_t* samples, size_t count);	// Capture thread, never blocks or allocates
+	void Trigger();		// Any thread
+
+	static const char* SourceName(TriggerSource source);
+};
\ No newline at end of file
@@ -1,8 +1,39 @@
 #pragma once
 #include <chrono>
+#include <atomic>
+#include <new>
 #include "Utils.h"
 #include <mmeapi.h>
 
+static std::atomic<size_t> g_heapAllocCount(0);
+
+void* operator new(size_t size)
+{
+	g_heapAllocCount.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+	while (true)
+	{
+		void* ptr = malloc(size);
+		if (ptr)
+			return ptr;
+		auto handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
 namespace Utils
 {
 	int64_t getTimeMs()
@@ -13,6 +44,11 @@ namespace Utils
 		return millis;
 	}
 
+	size_t getHeapAllocCount()
+	{
+		return g_heapAllocCount.load(std::memory_order_relaxed);
+	}
+
 	bool fileExists(const std::string& file)
 	{
 		struct stat info;
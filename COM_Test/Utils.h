@@ -31,7 +31,8 @@ namespace Utils
 		return biggest;
 	}
 
-	int64_t getTimeMs();
+	int64_t getTimeMs();	// Wall clock, for timestamps only. Intervals use Clock::NowNs().
+	size_t getHeapAllocCount();	// Number of global operator new calls since start
 	bool fileExists(const std::string& file);
 	std::vector<std::string> getAudioDeviceList();
 	void RemoveBOMFromFile(const std::string& path);
@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <Windows.h>
+
+#include "WaveOverview.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+constexpr char WaveOverview::MAGIC[8];
+constexpr uint32_t WaveOverview::LEVELS[];
+
+static const int ACC_MIN_INIT = 32767;
+static const int ACC_MAX_INIT = -32768;
+
+WaveOverview::WaveOverview(uint16_t channels, uint32_t samplingRate)
+	: _channels((std::max<uint16_t>)(channels, 1))
+	, _samplingRate(samplingRate)
+	, _frames(0)
+{
+	for (uint32_t spe : LEVELS)
+	{
+		Level level;
+		level.samplesPerEntry = spe;
+		level.pending.assign(_channels, { ACC_MIN_INIT, ACC_MAX_INIT, 0.0, 0 });
+		_levels.push_back(std::move(level));
+	}
+}
+
+void WaveOverview::Reserve(uint64_t frames)
+{
+	for (auto& level : _levels)
+		level.entries.reserve(size_t((frames / level.samplesPerEntry + 1) * _channels));
+}
+
+void WaveOverview::Add(const WaveSample16_t* samples, size_t count)
+{
+	PROFILE_ZONE("Overview");
+	const int16_t* s = reinterpret_cast<const int16_t*>(samples);
+	size_t frames = count / _channels;
+	Level& first = _levels[0];
+	while (frames)
+	{
+		size_t take = (std::min)(frames, size_t(first.samplesPerEntry - first.pending[0].frames));
+		for (uint16_t c = 0; c < _channels; c++)
+		{
+			Accumulator& acc = first.pending[c];
+			int lo = acc.min, hi = acc.max;
+			float sumSquares = 0;
+			for (size_t i = 0; i < take; i++)
+			{
+				int v = s[i * _channels + c];
+				lo = (std::min)(lo, v);
+				hi = (std::max)(hi, v);
+				sumSquares += float(v) * float(v);
+			}
+			acc.min = lo;
+			acc.max = hi;
+			acc.sumSquares += sumSquares;
+			acc.frames += take;
+		}
+
+		_frames += take;
+		s += take * _channels;
+		frames -= take;
+		if (first.pending[0].frames == first.samplesPerEntry)
+			_emit(0);
+	}
+}
+
+void WaveOverview::_emit(size_t index)
+{
+	Level& level = _levels[index];
+	Level* next = index + 1 < _levels.size() ? &_levels[index + 1] : nullptr;
+	for (uint16_t c = 0; c < _channels; c++)
+	{
+		Accumulator& acc = level.pending[c];
+		double rms = acc.frames ? std::sqrt(acc.sumSquares / double(acc.frames)) : 0.0;
+		level.entries.push_back({ int16_t(acc.min), int16_t(acc.max), uint16_t((std::min)(rms, 65535.0)) });
+
+		// Coarser levels are folded from this one instead of rescanning samples
+		if (next)
+		{
+			Accumulator& up = next->pending[c];
+			up.min = (std::min)(up.min, acc.min);
+			up.max = (std::max)(up.max, acc.max);
+			up.sumSquares += acc.sumSquares;
+			up.frames += acc.frames;
+		}
+		acc = { ACC_MIN_INIT, ACC_MAX_INIT, 0.0, 0 };
+	}
+
+	if (next && next->pending[0].frames == next->samplesPerEntry)
+		_emit(index + 1);
+}
+
+void WaveOverview::Finish()
+{
+	for (size_t i = 0; i < _levels.size(); i++)
+	{
+		if (_levels[i].pending[0].frames)
+			_emit(i);
+	}
+}
+
+bool WaveOverview::Save(const std::string& fileName) const
+{
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		appLog(Warning) << "Overview: cannot create " << fileName;
+		return false;
+	}
+
+	OverviewHeader header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.channels = _channels;
+	header.samplingRate = _samplingRate;
+	header.levelCount = uint32_t(_levels.size());
+	header.frames = _frames;
+
+	std::vector<OverviewLevel> table(_levels.size());
+	uint64_t offset = sizeof(header) + sizeof(OverviewLevel) * table.size();
+	for (size_t i = 0; i < _levels.size(); i++)
+	{
+		table[i] = {};
+		table[i].samplesPerEntry = _levels[i].samplesPerEntry;
+		table[i].entryCount = _levels[i].entries.size() / _channels;
+		table[i].offset = offset;
+		offset += _levels[i].entries.size() * sizeof(OverviewEntry);
+	}
+
+	bool ok = true;
+	DWORD written = 0;
+	ok &= WriteFile(file, &header, sizeof(header), &written, NULL) != FALSE;
+	ok &= WriteFile(file, table.data(), DWORD(table.size() * sizeof(OverviewLevel)), &written, NULL) != FALSE;
+	for (auto& level : _levels)
+	{
+		if (!level.entries.empty())
+			ok &= WriteFile(file, level.entries.data(), DWORD(level.entries.size() * sizeof(OverviewEntry)), &written, NULL) != FALSE;
+	}
+	CloseHandle(file);
+
+	if (!ok)
+		appLog(Warning) << "Overview: write to " << fileName << " failed";
+	return ok;
+}
+
+std::string WaveOverview::SidecarName(const std::string& recording)
+{
+	return recording + ".ovw";
+}
\ No newline at end of file
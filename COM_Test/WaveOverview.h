@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "WaveStream.h"
+
+// Overview sidecar (<recording>.ovw) for drawing long recordings at any zoom:
+//   OverviewHeader, OverviewLevel[levelCount], then each level's entries at its offset.
+// An entry is one OverviewEntry per channel and covers samplesPerEntry frames, the last entry of a level may cover fewer.
+struct OverviewHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint16_t	channels;
+	uint16_t	reserved;
+	uint32_t	samplingRate;
+	uint32_t	levelCount;
+	uint64_t	frames;
+};
+
+struct OverviewLevel
+{
+	uint32_t	samplesPerEntry;
+	uint32_t	reserved;
+	uint64_t	entryCount;
+	uint64_t	offset;		// From the start of the file
+};
+
+struct OverviewEntry
+{
+	int16_t		min;
+	int16_t		max;
+	uint16_t	rms;
+};
+
+// Builds min/max/RMS per 256, 4096 and 65536 frames while recording. Each level is folded from the
+// one below, so samples are touched once, right after they were written to the recording buffer.
+class WaveOverview
+{
+private:
+	struct Accumulator
+	{
+		int			min;
+		int			max;
+		double		sumSquares;
+		uint64_t	frames;
+	};
+
+	struct Level
+	{
+		uint32_t					samplesPerEntry;
+		std::vector<Accumulator>	pending;	// One per channel
+		std::vector<OverviewEntry>	entries;
+	};
+
+	uint16_t			_channels;
+	uint32_t			_samplingRate;
+	uint64_t			_frames;
+	std::vector<Level>	_levels;
+
+	void _emit(size_t level);
+
+public:
+	static constexpr char		MAGIC[8] = { 'S', 'A', 'S', 'O', 'V', 'W', 0, 0 };
+	static constexpr uint32_t	VERSION = 1;
+	static constexpr uint32_t	LEVELS[] = { 256, 4096, 65536 };
+
+	WaveOverview(uint16_t channels, uint32_t samplingRate);
+
+	void Reserve(uint64_t frames);		// Preallocates entries, for realtime capture
+	void Add(const WaveSample16_t* samples, size_t count);	// Interleaved, whole frames
+	void Finish();						// Emits the partial last entries
+	bool Save(const std::string& fileName) const;
+
+	static std::string SidecarName(const std::string& recording);
+};
\ No newline at end of file
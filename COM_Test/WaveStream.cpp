@@ -1,18 +1,21 @@
+#include <cstring>
+
 #include "WaveStream.h"
 #include "Logger.h"
+#include "Metrics.h"
+#include "Profiler.h"
 
 void WaveBuffer_t::append(const void* data, size_t size)
 {
 	const byte* bData = reinterpret_cast<const byte*>(data);
-	for (size_t i = 0; i < size; i++)
-		push_back(bData[i]);
+	insert(end(), bData, bData + size);
 }
 
 void WaveBuffer_t::makeWave(WORD channels, SamplingRate_t samplingRate, WORD bps)
 {
 	WaveBuffer_t wave;
 	wave.append((const byte*)"RIFF", 4);
-	wave.append<int>(36 + (size()));
+	wave.append<uint32_t>(uint32_t(36 + size()));
 	wave.append((const byte*)"WAVE", 4);
 	wave.append((const byte*)"fmt ", 4);
 	wave.append<int>(16);
@@ -23,7 +26,7 @@ void WaveBuffer_t::makeWave(WORD channels, SamplingRate_t samplingRate, WORD bps
 	wave.append<WORD>(channels * (bps / 8));
 	wave.append<WORD>(bps);
 	wave.append((const byte*)"data", 4);
-	wave.append<size_t>(size());
+	wave.append<uint32_t>(uint32_t(size()));
 	wave.append(&at(0), size());
 	clear();
 	*this = wave;
@@ -40,18 +43,159 @@ bool WaveBuffer_t::saveToFile(const std::string& path)
 	return true;
 }
 
-void CALLBACK callback(HWAVEOUT hWaveOut, UINT uMsg, DWORD_PTR inst, DWORD_PTR param1, DWORD_PTR param2)
+WaveFileWriter::WaveFileWriter()
+	: _file(INVALID_HANDLE_VALUE)
+	, _buffer(BUFFER_SIZE)
+	, _used(0)
+	, _dataBytes(0)
+	, _channels(0)
+	, _samplingRate(0)
+	, _bps(0)
+	, _failed(false)
+{
+}
+
+WaveFileWriter::~WaveFileWriter()
+{
+	Close();
+}
+
+bool WaveFileWriter::Open(const std::string& path, WORD channels, SamplingRate_t samplingRate, WORD bps)
+{
+	Close();
+	_file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Placeholder header, rewritten with the real sizes on Close()
+	memset(_buffer.data(), 0, HEADER_SIZE);
+	_used = HEADER_SIZE;
+	_dataBytes = 0;
+	_channels = channels;
+	_samplingRate = samplingRate;
+	_bps = bps;
+	_failed = false;
+	return true;
+}
+
+bool WaveFileWriter::_flush()
+{
+	DWORD written = 0;
+	if (_used && (!WriteFile(_file, _buffer.data(), DWORD(_used), &written, NULL) || written != _used))
+		_failed = true;
+	_used = 0;
+	return !_failed;
+}
+
+bool WaveFileWriter::Write(const void* data, size_t size)
+{
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (_used + size > _buffer.size())
+		_flush();
+	if (size > _buffer.size())
+	{
+		DWORD written = 0;
+		if (!WriteFile(_file, data, DWORD(size), &written, NULL) || written != size)
+			_failed = true;
+	}
+	else
+	{
+		memcpy(_buffer.data() + _used, data, size);
+		_used += size;
+	}
+	_dataBytes += size;
+	return !_failed;
+}
+
+bool WaveFileWriter::Close()
+{
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	_flush();
+	WaveBuffer_t header;
+	header.append((const byte*)"RIFF", 4);
+	header.append<uint32_t>(uint32_t(36 + _dataBytes));
+	header.append((const byte*)"WAVE", 4);
+	header.append((const byte*)"fmt ", 4);
+	header.append<uint32_t>(16);
+	header.append<WORD>(WAVE_FORMAT_PCM);
+	header.append<WORD>(_channels);
+	header.append<uint32_t>(_samplingRate);
+	header.append<uint32_t>(_samplingRate * _channels * (_bps / 8));
+	header.append<WORD>(_channels * (_bps / 8));
+	header.append<WORD>(_bps);
+	header.append((const byte*)"data", 4);
+	header.append<uint32_t>(uint32_t(_dataBytes));
+
+	LARGE_INTEGER start = {};
+	DWORD written = 0;
+	if (!SetFilePointerEx(_file, start, NULL, FILE_BEGIN) || !WriteFile(_file, header.data(), DWORD(header.size()), &written, NULL))
+		_failed = true;
+	CloseHandle(_file);
+	_file = INVALID_HANDLE_VALUE;
+	return !_failed;
+}
+
+bool WaveFileWriter::IsOpen() const
+{
+	return _file != INVALID_HANDLE_VALUE;
+}
+
+uint64_t WaveFileWriter::GetDataBytes() const
 {
-	StreamQueue* queue = (StreamQueue*)inst;
+	return _dataBytes;
+}
+
+void CALLBACK WaveStream::_callback(HWAVEOUT hWaveOut, UINT uMsg, DWORD_PTR inst, DWORD_PTR param1, DWORD_PTR param2)
+{
+	WaveStream* stream = (WaveStream*)inst;
 
 	if (uMsg == WOM_DONE)
-		queue->pop();
+	{
+		// No waveOut calls are allowed here, so the block is unprepared and released by the next push
+		SampleBlock* block = (SampleBlock*)((WAVEHDR*)param1)->dwUser;
+		size_t queued = stream->_queued.fetch_sub(1, std::memory_order_relaxed) - 1;
+		stream->_queuedBytes.fetch_sub(block->size, std::memory_order_relaxed);
+		if (!stream->_closing.load(std::memory_order_relaxed))
+		{
+			uint64_t doneNs = METRICS_NOW();
+			appLatency(SinkToDone, block->submittedNs, doneNs);
+			appLatency(EndToEnd, block->arrivalNs, doneNs);
+			if (queued == 0)
+				appMetricAdd(PlaybackUnderruns, 1);
+		}
+		appMetricSet(PlaybackQueueSegments, queued);
+
+		SampleBlock* head = stream->_done.load(std::memory_order_relaxed);
+		do
+			block->nextDone = head;
+		while (!stream->_done.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+	}
+}
+
+void WaveStream::_reclaim()
+{
+	SampleBlock* block = _done.exchange(nullptr, std::memory_order_acquire);
+	while (block)
+	{
+		SampleBlock* next = block->nextDone;
+		waveOutUnprepareHeader(_hWaveOut, &block->header, sizeof(WAVEHDR));
+		block->owner->Release(block);
+		block = next;
+	}
 }
 
 WaveStream::WaveStream()
 	: _hWaveOut(NULL)
 	, _wfx({ WAVE_FORMAT_PCM,0,0,0,0,0,0 })
 	, _device(0)
+	, _queued(0)
+	, _queuedBytes(0)
+	, _closing(false)
+	, _done(nullptr)
 {
 }
 
@@ -59,6 +203,10 @@ WaveStream::WaveStream(WORD bps, SamplingRate_t samplingRate, int channels)
 	: _hWaveOut(NULL)
 	, _wfx({ WAVE_FORMAT_PCM,0,0,0,0,0,0 })
 	, _device(0)
+	, _queued(0)
+	, _queuedBytes(0)
+	, _closing(false)
+	, _done(nullptr)
 {
 	_wfx.wBitsPerSample = bps;
 	_wfx.nSamplesPerSec = samplingRate;
@@ -69,6 +217,7 @@ bool WaveStream::Initialize(UINT device, WORD bps, SamplingRate_t samplingRate,
 {
 	if (_hWaveOut)
 	{
+		_reclaim();
 		if (waveOutClose(_hWaveOut) != MMSYSERR_NOERROR)
 			return false;
 	}
@@ -82,7 +231,7 @@ bool WaveStream::Initialize(UINT device, WORD bps, SamplingRate_t samplingRate,
 	_wfx.nAvgBytesPerSec = _wfx.nSamplesPerSec * _wfx.nBlockAlign;
 	_wfx.cbSize = 0;
 
-	if (waveOutOpen(&_hWaveOut, device, &_wfx, DWORD(&callback), DWORD_PTR(&_queue), CALLBACK_FUNCTION) != MMSYSERR_NOERROR)
+	if (waveOutOpen(&_hWaveOut, device, &_wfx, DWORD_PTR(&_callback), DWORD_PTR(this), CALLBACK_FUNCTION) != MMSYSERR_NOERROR)
 		return false;
 
 	appLog(Info) << "WaveStream initialized.";
@@ -91,23 +240,34 @@ bool WaveStream::Initialize(UINT device, WORD bps, SamplingRate_t samplingRate,
 
 WaveStream::~WaveStream()
 {
+	_closing = true;
+	if (_hWaveOut)
+		waveOutReset(_hWaveOut);	// Marks all queued blocks done
+	_reclaim();
 	waveOutClose(_hWaveOut);
 	appLog(Info) << "WaveStream destroyed. ";
 }
 
 
-void WaveStream::PushSegment(WaveBufferPtr buffer)
+void WaveStream::PushSegment(SampleBlock* block)
 {
+	PROFILE_ZONE("WaveStream::PushSegment");
 	if (!_hWaveOut)
 		throw std::runtime_error("WaveStream is not initialized.");
 
-	std::shared_ptr<WAVEHDR> header(new WAVEHDR);
-	*header = { LPSTR(&(buffer->operator[](0))), buffer->size(), 0, 0, 0, 0, 0, 0 };
-	WaveQueueUnit sound = { buffer, header };
-	_queue.push(sound);
-	waveOutPrepareHeader(_hWaveOut, header.get(), sizeof(WAVEHDR));
-	waveOutWrite(_hWaveOut, header.get(), sizeof(WAVEHDR));
-	waveOutUnprepareHeader(_hWaveOut, header.get(), sizeof(WAVEHDR));
+	_reclaim();
+	block->header = { LPSTR(block->data()), DWORD(block->size), 0, DWORD_PTR(block), 0, 0, 0, 0 };
+	_queued.fetch_add(1, std::memory_order_relaxed);
+	_queuedBytes.fetch_add(block->size, std::memory_order_relaxed);
+	waveOutPrepareHeader(_hWaveOut, &block->header, sizeof(WAVEHDR));
+	if (waveOutWrite(_hWaveOut, &block->header, sizeof(WAVEHDR)) != MMSYSERR_NOERROR)
+	{
+		waveOutUnprepareHeader(_hWaveOut, &block->header, sizeof(WAVEHDR));
+		_queued.fetch_sub(1, std::memory_order_relaxed);
+		_queuedBytes.fetch_sub(block->size, std::memory_order_relaxed);
+		block->owner->Release(block);
+	}
+	PROFILE_COUNTER("QueuedSegments", _queued.load(std::memory_order_relaxed));
 }
 
 SamplingRate_t WaveStream::GetSamplingRate() const
@@ -128,4 +288,16 @@ WORD WaveStream::GetBPS() const
 UINT WaveStream::GetDevice() const
 {
 	return _device;
+}
+
+size_t WaveStream::GetQueuedSegments() const
+{
+	return _queued.load(std::memory_order_relaxed);
+}
+
+int WaveStream::GetQueuedMs() const
+{
+	if (_wfx.nAvgBytesPerSec == 0)
+		return 0;
+	return int(uint64_t(_queuedBytes.load(std::memory_order_relaxed)) * 1000 / _wfx.nAvgBytesPerSec);
 }
\ No newline at end of file
@@ -1,25 +1,20 @@
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
 
 #include <Windows.h>
 #include <mmeapi.h>
 #include <mmsystem.h>
 
 #include "Utils.h"
+#include "SampleBlockPool.h"
 
 
-class WaveBuffer_t;
-struct WaveQueueUnit
-{
-	std::shared_ptr<WaveBuffer_t> buffer;
-	std::shared_ptr<WAVEHDR>	  header;
-};
-
 using WaveSample16_t = unsigned short;
 using SamplingRate_t = DWORD;
-using StreamQueue = std::queue<WaveQueueUnit>;
-using WaveBufferPtr = std::shared_ptr<WaveBuffer_t>;
 
 class WaveBuffer_t : public std::vector<byte>
 {
@@ -29,23 +24,59 @@ public:
 	template <typename T>
 	void append(T data)
 	{
-		const byte* bData = reinterpret_cast<const byte*>(&data);
-		size_t size = sizeof(T);
-		for (size_t i = 0; i < size; i++)
-			push_back(bData[i]);
+		append(&data, sizeof(T));
 	}
 
 	void makeWave(WORD channels, SamplingRate_t samplingRate, WORD bps);
 	bool saveToFile(const std::string& path);
 };
 
+// Streams a PCM wave to disk through a fixed buffer, the header sizes are filled in on Close()
+class WaveFileWriter
+{
+private:
+	HANDLE				_file;
+	std::vector<byte>	_buffer;
+	size_t				_used;
+	uint64_t			_dataBytes;
+	WORD				_channels;
+	SamplingRate_t		_samplingRate;
+	WORD				_bps;
+	bool				_failed;
+
+	bool _flush();
+
+	WaveFileWriter(const WaveFileWriter&) = delete;
+	WaveFileWriter& operator=(const WaveFileWriter&) = delete;
+
+public:
+	static constexpr size_t BUFFER_SIZE = 64 * 1024;
+	static constexpr size_t HEADER_SIZE = 44;
+
+	WaveFileWriter();
+	~WaveFileWriter();
+
+	bool Open(const std::string& path, WORD channels, SamplingRate_t samplingRate, WORD bps);
+	bool Write(const void* data, size_t size);
+	bool Close();	// False if any write failed
+
+	bool IsOpen() const;
+	uint64_t GetDataBytes() const;
+};
+
 class WaveStream
 {
 private:
-	HWAVEOUT		_hWaveOut;
-	StreamQueue	    _queue;
-	WAVEFORMATEX	_wfx;
-	UINT			_device;
+	HWAVEOUT			_hWaveOut;
+	WAVEFORMATEX		_wfx;
+	UINT				_device;
+	std::atomic<size_t>	_queued;
+	std::atomic<size_t>	_queuedBytes;	// Segments may differ in size, e.g. after a live buffer change
+	std::atomic<bool>	_closing;		// Set before waveOutReset, so returned blocks are not counted as underruns
+	std::atomic<SampleBlock*>	_done;	// Played blocks, still prepared, pushed by the callback
+
+	static void CALLBACK _callback(HWAVEOUT hWaveOut, UINT uMsg, DWORD_PTR inst, DWORD_PTR param1, DWORD_PTR param2);
+	void _reclaim();
 
 public:
 	WaveStream();
@@ -54,10 +85,12 @@ public:
 	~WaveStream();
 
 	bool Initialize(UINT device, WORD bps, SamplingRate_t samplingRate, int channels);
-	void PushSegment(WaveBufferPtr buffer); //Add to queue and play
+	void PushSegment(SampleBlock* block); //Add to queue and play, block is released to its pool on a later push after it played
 
 	SamplingRate_t GetSamplingRate() const;
 	int GetChannels() const;
 	WORD GetBPS() const;
 	UINT GetDevice() const;
+	size_t GetQueuedSegments() const;
+	int GetQueuedMs() const;	// Playback time of the queued segments
 };
\ No newline at end of file
@@ -1,11 +1,28 @@
 #include <iostream>
+#include <vector>
 
-#include "ConfigMgr.h"
+#include "ConfigSchema.h"
 #include "SerialAudioSampler.h"
 #include "Utils.h"
+#include "ConfigWatcher.h"
+#include "Benchmark.h"
+#include "SoakTest.h"
+#include "Clock.h"
+#include "SpectrumAnalyzer.h"
+#include "CaptureArchive.h"
+#include "TriggerRecorder.h"
+#include "BlackBox.h"
+#include "RtpStream.h"
+#include "ShmRingWriter.h"
 
 #define _LOGGER_MAIN_CPP
 #include "Logger.h"
+#define _TRACE_MAIN_CPP
+#include "TraceLog.h"
+#define _METRICS_MAIN_CPP
+#include "Metrics.h"
+#define _PROFILER_MAIN_CPP
+#include "Profiler.h"
 
 #pragma comment(lib, "Winmm.lib")
 
@@ -15,56 +32,682 @@ struct ConfigValues
 {
 	std::string			SerialPort;
 	int					BaudRate;
+	std::string			RawCaptureFile;
+	int					SerialRxBufferBytes;
+	int					SerialTxBufferBytes;
+	int					SerialReadIntervalMs;
+	std::string			SerialFlowControl;
+	int					SerialFlowHighMs;
+	int					SerialFlowLowMs;
 
 	UINT				Device;
 	int					SampleCalcDurationSec;
 	int					StreamBufferMs;
 	std::string			FileName;
+	float				Gain;
+	bool				WriteOverview;
+
+	bool				RealtimeEnabled;
+	int					RealtimeThreadPriority;
+	DWORD_PTR			RealtimeAffinityMask;
+	bool				RealtimeLockMemory;
+	int					RealtimeFilePreallocSec;
+
+	std::string			LogLevel;
+	uint64_t			LogMaxSizeMB;
+	int					LogMaxAgeHours;
+	int					LogRetention;
+	bool				LogCompress;
+
+	bool				TraceEnabled;
+	std::string			TraceFileName;
+	int					TraceRecords;
+	bool				TraceZonesEnabled;
+	std::string			TraceZonesFile;
+	int					TraceZoneEventsPerThread;
+
+	bool				MetricsEnabled;
+	int					MetricsHttpPort;
+	std::string			MetricsStatsFile;
+	int					MetricsIntervalSec;
+
+	bool				ActivityEnabled;
+	std::string			ActivityMode;
+	double				ActivityStartDb;
+	double				ActivityStopDb;
+	double				ActivityMaxZcr;
+	int					ActivityWindowMs;
+	int					ActivityPreRollMs;
+	int					ActivityPostRollMs;
+
+	bool				ArchiveEnabled;
+	std::string			ArchiveDirectory;
+	int					ArchiveSegmentSec;
+
+	bool				BlackBoxEnabled;
+	std::string			BlackBoxFile;
+	double				BlackBoxHours;
+	int					BlackBoxFlushSec;
+
+	bool				NetworkEnabled;
+	std::string			NetworkDestinations;
+	int					NetworkPacketMs;
+	int					NetworkPayloadType;
+	std::string			NetworkSdpFile;
+
+	bool				SharedMemoryEnabled;
+	std::string			SharedMemoryName;
+	int					SharedMemoryBufferMs;
+
+	bool				TriggerEnabled;
+	int					TriggerPreSec;
+	int					TriggerPostSec;
+	std::string			TriggerDirectory;
+	double				TriggerLevelDb;
+	int					TriggerCommandPort;
+	std::string			TriggerEventName;
+
+	bool				AnalysisEnabled;
+	int					AnalysisFftSize;
+	int					AnalysisIntervalMs;
+	std::string			AnalysisFile;
+	int					AnalysisBands;
+
+	SerialSettings Serial() const
+	{
+		return { SerialPort, unsigned(BaudRate), SerialRxBufferBytes, SerialTxBufferBytes, SerialReadIntervalMs, SerialFlowControl, SerialFlowHighMs, SerialFlowLowMs };
+	}
+
+	RealtimeSettings Realtime() const
+	{
+		return { RealtimeEnabled, RealtimeThreadPriority, RealtimeAffinityMask, RealtimeLockMemory, RealtimeFilePreallocSec };
+	}
+
+	_____LOGGER::Logger::RotationSettings LogRotation() const
+	{
+		return { LogMaxSizeMB * 1024 * 1024, LogMaxAgeHours * 3600, LogRetention, LogCompress };
+	}
+
+	_____METRICS::MetricsSettings Metrics() const
+	{
+		return { MetricsEnabled, MetricsHttpPort, MetricsStatsFile, MetricsIntervalSec };
+	}
+
+	ActivitySettings Activity() const
+	{
+		return { ActivityEnabled, ActivityMode, ActivityStartDb, ActivityStopDb, ActivityMaxZcr, ActivityWindowMs, ActivityPreRollMs, ActivityPostRollMs };
+	}
+
+	ArchiveSettings Archive() const
+	{
+		return { ArchiveEnabled, ArchiveDirectory, ArchiveSegmentSec };
+	}
+
+	BlackBoxSettings BlackBox() const
+	{
+		return { BlackBoxEnabled, BlackBoxFile, BlackBoxHours, BlackBoxFlushSec };
+	}
+
+	NetworkSettings Network() const
+	{
+		return { NetworkEnabled, NetworkDestinations, NetworkPacketMs, NetworkPayloadType, NetworkSdpFile };
+	}
+
+	ShmRingSettings SharedMemory() const
+	{
+		return { SharedMemoryEnabled, SharedMemoryName, SharedMemoryBufferMs };
+	}
+
+	TriggerSettings Trigger() const
+	{
+		return { TriggerEnabled, TriggerPreSec, TriggerPostSec, TriggerDirectory, TriggerLevelDb, TriggerCommandPort, TriggerEventName };
+	}
+
+	AnalysisSettings Analysis() const
+	{
+		return { AnalysisEnabled, AnalysisFftSize, AnalysisIntervalMs, AnalysisFile, AnalysisBands };
+	}
+};
+
+// Every config key with its type, default and valid range. Parsed once, the pipeline only reads ConfigValues fields.
+const ConfigSchema<ConfigValues>& GetSchema()
+{
+	using C = ConfigValues;
+	static const ConfigSchema<ConfigValues> schema = ConfigSchema<ConfigValues>()
+		.Str("SerialPort",	"Name",						&C::SerialPort,					"COM1")
+		.Num("SerialPort",	"BaudRate",					&C::BaudRate,					115200, 110, 4000000)
+		.Str("SerialPort",	"RawCaptureFile",			&C::RawCaptureFile,				"")
+		.Num("SerialPort",	"RxBufferBytes",			&C::SerialRxBufferBytes,		65536, 1024, 16 * 1048576)
+		.Num("SerialPort",	"TxBufferBytes",			&C::SerialTxBufferBytes,		4096, 1024, 1048576)
+		.Num("SerialPort",	"ReadIntervalMs",			&C::SerialReadIntervalMs,		0, 0, 1000)
+		.Str("SerialPort",	"FlowControl",				&C::SerialFlowControl,			"None", { "None", "RtsCts", "Pipeline" })
+		.Num("SerialPort",	"FlowHighMs",				&C::SerialFlowHighMs,			1500, 20, 2000)
+		.Num("SerialPort",	"FlowLowMs",				&C::SerialFlowLowMs,			500, 0, 2000)
+
+		.Num("Audio",		"Device",					&C::Device,						0u, 0u, WAVE_MAPPER)
+		.Num("Audio",		"SampleCalcDurationSec",	&C::SampleCalcDurationSec,		5, 1, 60)
+		.Num("Audio",		"StreamBufferMs",			&C::StreamBufferMs,				50, 10, 1000)
+		.Str("Audio",		"FileName",					&C::FileName,					"result.wav")
+		.Num("Audio",		"Gain",						&C::Gain,						0.33f, 0.0f, 16.0f)
+		.Bool("Audio",		"WriteOverview",			&C::WriteOverview,				true)
+
+		.Bool("Activity",	"Enabled",					&C::ActivityEnabled,			false)
+		.Str("Activity",	"Mode",						&C::ActivityMode,				"Cues", { "Cues", "Events" })
+		.Num("Activity",	"StartDb",					&C::ActivityStartDb,			-40.0, -120.0, 0.0)
+		.Num("Activity",	"StopDb",					&C::ActivityStopDb,				-46.0, -120.0, 0.0)
+		.Num("Activity",	"MaxZeroCrossingRate",		&C::ActivityMaxZcr,				1.0, 0.0, 1.0)
+		.Num("Activity",	"WindowMs",					&C::ActivityWindowMs,			10, 1, 1000)
+		.Num("Activity",	"PreRollMs",				&C::ActivityPreRollMs,			500, 0, 60000)
+		.Num("Activity",	"PostRollMs",				&C::ActivityPostRollMs,			1000, 0, 60000)
+
+		.Bool("Archive",	"Enabled",					&C::ArchiveEnabled,				false)
+		.Str("Archive",		"Directory",				&C::ArchiveDirectory,			"archive")
+		.Num("Archive",		"SegmentSec",				&C::ArchiveSegmentSec,			600, 10, 86400)
+
+		.Bool("BlackBox",	"Enabled",					&C::BlackBoxEnabled,			false)
+		.Str("BlackBox",	"File",						&C::BlackBoxFile,				"blackbox.sbb")
+		.Num("BlackBox",	"Hours",					&C::BlackBoxHours,				4.0, 0.01, 1000.0)
+		.Num("BlackBox",	"FlushSec",					&C::BlackBoxFlushSec,			2, 1, 60)
+
+		.Bool("Network",	"Enabled",					&C::NetworkEnabled,				false)
+		.Str("Network",		"Destinations",				&C::NetworkDestinations,		"127.0.0.1:5004")
+		.Num("Network",		"PacketMs",					&C::NetworkPacketMs,			20, 1, 100)
+		.Num("Network",		"PayloadType",				&C::NetworkPayloadType,			96, 96, 127)
+		.Str("Network",		"SdpFile",					&C::NetworkSdpFile,				"stream.sdp")
+
+		.Bool("SharedMemory",	"Enabled",				&C::SharedMemoryEnabled,			false)
+		.Str("SharedMemory",	"Name",					&C::SharedMemoryName,				"SerialAudioSampler.Ring")
+		.Num("SharedMemory",	"BufferMs",				&C::SharedMemoryBufferMs,			2000, 100, 60000)
+
+		.Bool("Trigger",	"Enabled",					&C::TriggerEnabled,				false)
+		.Num("Trigger",		"PreSec",					&C::TriggerPreSec,				30, 0, 3600)
+		.Num("Trigger",		"PostSec",					&C::TriggerPostSec,				10, 0, 3600)
+		.Str("Trigger",		"Directory",				&C::TriggerDirectory,			"triggers")
+		.Num("Trigger",		"LevelDb",					&C::TriggerLevelDb,				0.0, -120.0, 0.0)
+		.Num("Trigger",		"CommandPort",				&C::TriggerCommandPort,			9465, 0, 65535)
+		.Str("Trigger",		"EventName",				&C::TriggerEventName,			"SerialAudioSampler.Trigger")
+
+		.Bool("Analysis",	"Enabled",					&C::AnalysisEnabled,			false)
+		.Num("Analysis",	"FftSize",					&C::AnalysisFftSize,			2048, 64, 65536)
+		.Num("Analysis",	"IntervalMs",				&C::AnalysisIntervalMs,			1000, 100, 60000)
+		.Str("Analysis",	"File",						&C::AnalysisFile,				"analysis.json")
+		.Num("Analysis",	"Bands",					&C::AnalysisBands,				64, 1, 1024)
+
+		.Bool("Realtime",	"Enabled",					&C::RealtimeEnabled,			false)
+		.Num("Realtime",	"ThreadPriority",			&C::RealtimeThreadPriority,		int(THREAD_PRIORITY_TIME_CRITICAL), int(THREAD_PRIORITY_IDLE), int(THREAD_PRIORITY_TIME_CRITICAL))
+		.Num("Realtime",	"AffinityMask",				&C::RealtimeAffinityMask,		DWORD_PTR(0), DWORD_PTR(0), ~DWORD_PTR(0))
+		.Bool("Realtime",	"LockMemory",				&C::RealtimeLockMemory,			true)
+		.Num("Realtime",	"FilePreallocSec",			&C::RealtimeFilePreallocSec,	600, 0, 86400)
+
+		.Str("Log",			"Level",					&C::LogLevel,					"Debug", { "Debug", "Info", "Warning", "Critical", "Fatal" })
+		.Num("Log",			"MaxSizeMB",				&C::LogMaxSizeMB,				uint64_t(16), uint64_t(0), uint64_t(1024 * 1024))
+		.Num("Log",			"MaxAgeHours",				&C::LogMaxAgeHours,				24, 0, 24 * 365)
+		.Num("Log",			"Retention",				&C::LogRetention,				5, 0, 100)
+		.Bool("Log",		"Compress",					&C::LogCompress,				true)
+
+		.Bool("Trace",		"Enabled",					&C::TraceEnabled,				false)
+		.Str("Trace",		"FileName",					&C::TraceFileName,				"trace.bin")
+		.Num("Trace",		"Records",					&C::TraceRecords,				1048576, 1024, 64 * 1048576)
+		.Bool("Trace",		"ZonesEnabled",				&C::TraceZonesEnabled,			false)
+		.Str("Trace",		"ZonesFile",				&C::TraceZonesFile,				"zones.json")
+		.Num("Trace",		"ZoneEventsPerThread",		&C::TraceZoneEventsPerThread,	262144, 1024, 16 * 1048576)
+
+		.Bool("Metrics",	"Enabled",					&C::MetricsEnabled,				false)
+		.Num("Metrics",		"HttpPort",					&C::MetricsHttpPort,			9464, 0, 65535)
+		.Str("Metrics",		"StatsFile",				&C::MetricsStatsFile,			"stats.prom")
+		.Num("Metrics",		"IntervalSec",				&C::MetricsIntervalSec,			5, 1, 3600);
+	return schema;
+}
+
+// Parses config.cfg in one pass. The file is only written when it is missing or lacks keys.
+bool LoadSettings(ConfigValues& cvals, std::vector<std::string>& errors)
+{
+	bool missingKeys = true;
+	if (!Utils::fileExists(CONFIG_FILE_NAME))
+		GetSchema().Defaults(cvals);	// First run, the defaults are written below
+	else if (!GetSchema().Load(CONFIG_FILE_NAME, cvals, errors, missingKeys))
+		return false;
+
+	if (missingKeys)
+	{
+		if (Utils::fileExists(CONFIG_FILE_NAME))
+			Utils::RemoveBOMFromFile(CONFIG_FILE_NAME);
+		if (!GetSchema().SaveMissing(CONFIG_FILE_NAME, cvals))
+			appLog(Warning) << "Cannot write defaults to " << CONFIG_FILE_NAME;
+	}
+	return true;
+}
+
+bool ParseLogLevel(const std::string& name, _____LOGGER::Logger::Level& level)
+{
+	static const std::pair<const char*, _____LOGGER::Logger::Level> levels[] =
+	{
+		{ "Debug", LOGLVL(Debug) },
+		{ "Info", LOGLVL(Info) },
+		{ "Warning", LOGLVL(Warning) },
+		{ "Critical", LOGLVL(Critical) },
+		{ "Fatal", LOGLVL(Fatal) }
+	};
+
+	for (auto& lvl : levels)
+	{
+		if (name == lvl.first)
+		{
+			level = lvl.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Re-reads the config while capturing and publishes the live-tunable values to the pipeline
+void ReloadSettings(SerialAudioSampler& sampler, ConfigValues& current)
+{
+	ConfigValues next;
+	std::vector<std::string> errors;
+	bool missingKeys = false;
+	if (!GetSchema().Load(CONFIG_FILE_NAME, next, errors, missingKeys))
+	{
+		for (auto& err : errors)
+			appLog(Warning) << "Config reload: " << err;
+		appLog(Warning) << "Config reload rejected, keeping current settings.";
+		return;
+	}
+
+	if (next.Gain != current.Gain)
+	{
+		sampler.SetGain(next.Gain);
+		appLog(Info) << "Config reload: Gain " << current.Gain << " -> " << next.Gain;
+	}
+	if (next.StreamBufferMs != current.StreamBufferMs)
+	{
+		sampler.SetStreamBufferMs(next.StreamBufferMs);
+		appLog(Info) << "Config reload: StreamBufferMs " << current.StreamBufferMs << " -> " << sampler.GetStreamBufferMs();
+	}
+	if (next.LogLevel != current.LogLevel)
+	{
+		_____LOGGER::Logger::Level level;
+		ParseLogLevel(next.LogLevel, level);
+		APP_LOG_LEVEL(level);
+		appLog(Info) << "Config reload: Log level " << current.LogLevel << " -> " << next.LogLevel;
+	}
+	APP_LOG_ROTATION(next.LogRotation());
+
+	if (next.SerialPort != current.SerialPort || next.BaudRate != current.BaudRate || next.Device != current.Device
+		|| next.FileName != current.FileName || next.RealtimeEnabled != current.RealtimeEnabled || next.RawCaptureFile != current.RawCaptureFile
+		|| next.SerialRxBufferBytes != current.SerialRxBufferBytes || next.SerialTxBufferBytes != current.SerialTxBufferBytes
+		|| next.SerialReadIntervalMs != current.SerialReadIntervalMs || next.SerialFlowControl != current.SerialFlowControl
+		|| next.SerialFlowHighMs != current.SerialFlowHighMs || next.SerialFlowLowMs != current.SerialFlowLowMs)
+		appLog(Warning) << "Config reload: serial port, device, file name, raw capture and realtime changes require a restart.";
+
+	current.Gain = next.Gain;
+	current.StreamBufferMs = next.StreamBufferMs;
+	current.LogLevel = next.LogLevel;
+	current.LogMaxSizeMB = next.LogMaxSizeMB;
+	current.LogMaxAgeHours = next.LogMaxAgeHours;
+	current.LogRetention = next.LogRetention;
+	current.LogCompress = next.LogCompress;
+}
+
+// Optional consumers of the sampler's output, each enabled by its config section.
+// Declare before the sampler: its sink callbacks point in here.
+class SinkSet
+{
+private:
+	SpectrumAnalyzer	_analyzer;
+	CaptureArchive		_archive;
+	TriggerRecorder		_trigger;
+	BlackBoxRecorder	_blackBox;
+	RtpSender			_network;
+	ShmRingWriter		_sharedMemory;
+
+public:
+	// Starts the enabled sinks and feeds them the sampler's output. Call before sampling starts.
+	void Attach(SerialAudioSampler& sampler, const ConfigValues& settings)
+	{
+		const SamplingRate_t rate = sampler.GetSamplingRate();
+		const WORD channels = sampler.GetChannels();
+		if (_analyzer.Start(settings.Analysis(), rate))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _analyzer.Push(samples, count); });
+		if (_archive.Start(settings.Archive(), rate, channels))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _archive.Push(samples, count); });
+		if (_trigger.Start(settings.Trigger(), rate, channels))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _trigger.Push(samples, count); });
+		if (_blackBox.Start(settings.BlackBox(), rate, channels))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _blackBox.Push(samples, count); });
+		if (_network.Start(settings.Network(), rate, channels))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _network.Push(samples, count); });
+		if (_sharedMemory.Start(settings.SharedMemory(), rate, channels))
+			sampler.AddSink([this](const WaveSample16_t* samples, size_t count) { _sharedMemory.Push(reinterpret_cast<const int16_t*>(samples), count); });
+	}
+
+	// Lets every sink finish what it holds. Call once the sampler has stopped.
+	void Stop()
+	{
+		_analyzer.Stop();
+		_archive.Stop();
+		_trigger.Stop();
+		_blackBox.Stop();
+		_network.Stop();
+		_sharedMemory.Stop();
+	}
+
+	void Trigger()
+	{
+		_trigger.Trigger();
+	}
 };
 
-void ConfigResetDefaults(CConfigMgr& cmgr)
+// Runs a raw capture through the pipeline with the settings from config.cfg, into a WAV file or the audio device
+int RunReplay(const std::string& captureFile, const std::string& output, bool realtime)
+{
+	ConfigValues settings;
+	std::vector<std::string> errors;
+	if (!LoadSettings(settings, errors))
+	{
+		for (auto& err : errors)
+			appLog(Critical) << "Config: " << err;
+		return -1;
+	}
+
+	try
+	{
+		// Playback consumes samples at the device rate, so it always replays with the original timing
+		bool play = output == "play";
+		std::unique_ptr<SampleSource> source(new ReplaySource(captureFile, realtime || play));
+		SinkSet sinks;
+		SerialAudioSampler sampler(std::move(source), settings.SampleCalcDurationSec);
+		sampler.SetGain(settings.Gain);
+		sampler.SetActivityGate(settings.Activity());
+		sampler.SetWriteOverview(settings.WriteOverview);
+		sinks.Attach(sampler, settings);
+		if (play)
+			sampler.StartSamplingToWaveStream(settings.StreamBufferMs, settings.Device);
+		else
+			sampler.StartSamplingToFile(output);
+		sampler.Sync();
+		sinks.Stop();
+		_____METRICS::___Metrics.LogLatencies();
+	}
+	catch (const std::exception& ex)
+	{
+		appLog(Critical) << "Replay failed: " << ex.what();
+		return -1;
+	}
+	return 0;
+}
+
+// Reference consumer of the shared-memory ring: writes what a running sampler publishes to a WAV file
+int RunShmReader(const std::string& name, const std::string& output, int durationSec)
 {
-	cmgr.SetValue_Str("SerialPort",		"Name",						"COM1");
-	cmgr.SetValue_Num("SerialPort",		"BaudRate",					115200);
+	ShmRingReader reader;
+	if (!reader.Attach(name) || !reader.IsWriterRunning())
+	{
+		appLog(Warning) << "Shared memory: no sampler is publishing " << name;
+		return -1;
+	}
+	WaveFileWriter wave;
+	if (!wave.Open(output, reader.GetChannels(), reader.GetSamplingRate(), 16))
+	{
+		appLog(Warning) << "Shared memory: cannot create " << output;
+		return -1;
+	}
 
-	cmgr.SetValue_Num("Audio",			"Device",					0);
-	cmgr.SetValue_Num("Audio",			"SampleCalcDurationSec",	5);
-	cmgr.SetValue_Num("Audio",			"StreamBufferMs",			50);
-	cmgr.SetValue_Str("Audio",			"FileName",					"result.wav");
+	uint64_t samples = 0, reads = 0, torn = 0;
+	double handoffSumUs = 0.0, handoffMaxUs = 0.0;
+	std::vector<int16_t> buffer(65536);
+	int64_t endMs = durationSec > 0 ? Clock::NowMs() + int64_t(durationSec) * 1000 : 0;
+	while (reader.IsWriterRunning() && !(GetKeyState(VK_F12) & 0x8000) && (!endMs || Clock::NowMs() < endMs))
+	{
+		const int16_t* data = nullptr;
+		size_t count = reader.Acquire(data, buffer.size(), 100);
+		if (!count)
+			continue;
+		double handoffUs = reader.GetHandoffUs();
+		handoffSumUs += handoffUs;
+		handoffMaxUs = (std::max)(handoffMaxUs, handoffUs);
+		reads++;
 
-	cmgr.Save();
-	cmgr.SaveAs(CONFIG_FILE_NAME);
+		// Only samples still valid after Release go to the file
+		memcpy(buffer.data(), data, count * sizeof(int16_t));
+		if (!reader.Release())
+		{
+			torn++;
+			continue;
+		}
+		wave.Write(buffer.data(), count * sizeof(int16_t));
+		samples += count;
+	}
+
+	bool ok = wave.Close();
+	appLog(Info) << "Shared memory: read " << samples << " samples in " << reads << " reads, overrun " << reader.GetOverrunSamples()
+		<< " samples, " << torn << " reads overwritten while in use, handoff mean "
+		<< (reads ? handoffSumUs / reads : 0.0) << " us, max " << handoffMaxUs << " us";
+	return ok && samples ? 0 : -1;
 }
 
-ConfigValues GetSettings(CConfigMgr& cmgr)
+// Offline tools: SerialAudioSampler.exe <tool> <args...>
+bool RunTool(int argc, char* argv[], int& exitCode)
 {
-	ConfigValues cvals;
-	cvals.SerialPort = cmgr.GetValue_Str("SerialPort", "Name", "COM1");
-	cvals.BaudRate = cmgr.GetValue_Num("SerialPort", "BaudRate", 115200);
+	if (argc < 2)
+		return false;
 
-	cvals.Device = cmgr.GetValue_Num("Audio", "Device", 0);
-	cvals.SampleCalcDurationSec = cmgr.GetValue_Num("Audio", "SampleCalcDurationSec", 5);
-	cvals.StreamBufferMs = cmgr.GetValue_Num("Audio", "StreamBufferMs", 50);
-	cvals.FileName = cmgr.GetValue_Str("Audio", "FileName", "result.wav");
+	APP_LOG_START();	// Tools keep the default log rotation, main stops the writer
+	std::string tool = argv[1];
+	if (tool == "--decode-trace" && argc >= 4)
+	{
+		exitCode = _____TRACE::TraceLog::Decode(argv[2], argv[3]) ? 0 : -1;
+		std::cout << (exitCode == 0 ? "Trace decoded to " : "Failed to decode trace into ") << argv[3] << std::endl;
+		return true;
+	}
+	if (tool == "--bench" && argc >= 3)
+	{
+		Benchmark::Options opt = { argv[2], "", "", "", 115200, 5 };
+		for (int i = 3; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--filter" && i + 1 < argc)
+				opt.filter = argv[++i];
+			else if (arg == "--loopback" && i + 2 < argc)
+			{
+				opt.loopbackTx = argv[++i];
+				opt.loopbackRx = argv[++i];
+			}
+			else if (arg == "--baud" && i + 1 < argc)
+				opt.baudRate = std::stoul(argv[++i]);
+			else if (arg == "--repeats" && i + 1 < argc)
+				opt.repeats = (std::max)(std::stoi(argv[++i]), 1);
+		}
+		exitCode = Benchmark::Run(opt) ? 0 : -1;
+		std::cout << (exitCode == 0 ? "Benchmark results saved to " : "Failed to save benchmark results to ") << opt.outputFile << std::endl;
+		return true;
+	}
 
-	cmgr.Save();
-	cmgr.SaveAs(CONFIG_FILE_NAME);	// This will fix broken config file if it's broken
+	if (tool == "--replay" && argc >= 4)
+	{
+		bool realtime = argc >= 5 && std::string(argv[4]) == "--realtime";
+		exitCode = RunReplay(argv[2], argv[3], realtime);
+		std::cout << (exitCode == 0 ? "Replay finished: " : "Replay failed: ") << argv[2] << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
+
+	if (tool == "--extract" && argc >= 6)
+	{
+		ArchiveReader reader;
+		bool unixTime = argc >= 7 && std::string(argv[6]) == "--unix";
+		if (!reader.Open(argv[2]))
+			exitCode = -1;
+		else if (unixTime)
+			exitCode = reader.Extract(reader.MonoFromUnixMs(int64_t(std::stod(argv[3]) * 1000)), reader.MonoFromUnixMs(int64_t(std::stod(argv[4]) * 1000)), argv[5]) ? 0 : -1;
+		else
+			exitCode = reader.Extract(reader.MonoFromOffsetSec(std::stod(argv[3])), reader.MonoFromOffsetSec(std::stod(argv[4])), argv[5]) ? 0 : -1;
+		std::cout << (exitCode == 0 ? "Extracted to " : "Nothing extracted to ") << argv[5] << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
 
-	return cvals;
+	if (tool == "--blackbox" && argc >= 6)
+	{
+		BlackBoxReader reader;
+		bool unixTime = argc >= 7 && std::string(argv[6]) == "--unix";
+		if (!reader.Open(argv[2]))
+			exitCode = -1;
+		else
+		{
+			int64_t newestMs = reader.UnixMsOfFrame(reader.NewestFrame());
+			int64_t fromMs = int64_t(std::stod(argv[3]) * 1000);
+			int64_t toMs = int64_t(std::stod(argv[4]) * 1000);
+			if (!unixTime)
+			{
+				fromMs = newestMs - fromMs;
+				toMs = newestMs - toMs;
+			}
+			exitCode = reader.Export(fromMs, toMs, argv[5]) ? 0 : -1;
+		}
+		std::cout << (exitCode == 0 ? "Exported to " : "Nothing exported to ") << argv[5] << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
+
+	if (tool == "--receive" && argc >= 4)
+	{
+		RtpReceiver::Options opt = RtpReceiver::DefaultOptions();
+		opt.port = std::stoi(argv[2]);
+		opt.output = argv[3];
+		for (int i = 4; i + 1 < argc; i += 2)
+		{
+			std::string arg = argv[i];
+			std::string val = argv[i + 1];
+			if (arg == "--group")
+				opt.group = val;
+			else if (arg == "--seconds")
+				opt.durationSec = std::stoi(val);
+			else if (arg == "--rate")
+				opt.samplingRate = std::stoul(val);
+			else if (arg == "--channels")
+				opt.channels = std::stoi(val);
+			else if (arg == "--buffer-ms")
+				opt.playBufferMs = std::stoi(val);
+		}
+
+		if (opt.durationSec == 0)
+			std::cout << "Receiving, press F12 to stop..." << std::endl;
+		RtpReceiver::Report report;
+		exitCode = RtpReceiver::Run(opt, report);
+		std::cout << "Received " << report.packets << " packets, lost " << report.lost << " of " << report.expected
+			<< ", late " << report.late << ", jitter " << report.jitterMs << " ms" << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
+
+	if (tool == "--shm-read" && argc >= 4)
+	{
+		int seconds = argc >= 6 && std::string(argv[4]) == "--seconds" ? std::stoi(argv[5]) : 0;
+		if (seconds == 0)
+			std::cout << "Reading, press F12 to stop..." << std::endl;
+		exitCode = RunShmReader(argv[2], argv[3], seconds);
+		std::cout << (exitCode == 0 ? "Shared memory read to " : "Nothing read to ") << argv[3] << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
+
+	if (tool == "--soak" && argc >= 4)
+	{
+		SoakTest::Options opt = SoakTest::DefaultOptions();
+		opt.generatorPort = argv[2];
+		opt.samplerPort = argv[3];
+		for (int i = 4; i + 1 < argc; i += 2)
+		{
+			std::string arg = argv[i];
+			std::string val = argv[i + 1];
+			if (arg == "--baud")
+				opt.baudRate = std::stoul(val);
+			else if (arg == "--rate")
+				opt.sampleRate = std::stoul(val);
+			else if (arg == "--speed")
+				opt.speed = (std::max)(std::stod(val), 0.01);
+			else if (arg == "--duration")
+				opt.durationSec = std::stoi(val);
+			else if (arg == "--block-ms")
+				opt.blockMs = std::stoi(val);
+			else if (arg == "--report")
+				opt.reportFile = val;
+			else if (arg == "--max-drops")
+				opt.maxDroppedSamples = std::stoull(val);
+			else if (arg == "--max-mismatches")
+				opt.maxMismatchedSamples = std::stoull(val);
+			else if (arg == "--max-rss-growth-mb")
+				opt.maxRssGrowthMB = std::stod(val);
+			else if (arg == "--max-cpu-ms")
+				opt.maxCpuMsPerAudioSec = std::stod(val);
+			else if (arg == "--max-p99-ms")
+				opt.maxP99LatencyMs = std::stod(val);
+		}
+
+		SoakTest::Report report;
+		exitCode = SoakTest::Run(opt, report);
+		if (!opt.reportFile.empty())
+			SoakTest::SaveReport(opt.reportFile, opt, report);
+		std::cout << "Soak " << (exitCode == 0 ? "passed" : "FAILED") << ": " << report.audioSec << " s of audio, dropped " << report.droppedSamples
+			<< ", mismatched " << report.mismatchedSamples << ", p99 latency " << report.latencyP99Ms << " ms" << std::endl;
+		for (auto& failure : report.failures)
+			std::cout << "  " << failure << std::endl;
+		APP_LOG_FLUSH();
+		return true;
+	}
+
+	std::cout << "Usage:" << std::endl
+		<< "  " << argv[0] << "                                  Interactive capture" << std::endl
+		<< "  " << argv[0] << " --decode-trace <trace.bin> <out.csv>" << std::endl
+		<< "  " << argv[0] << " --bench <out.json|out.csv> [--filter name] [--loopback COMx COMy] [--baud N] [--repeats N]" << std::endl
+		<< "  " << argv[0] << " --replay <capture.raw> <out.wav|play> [--realtime]" << std::endl
+		<< "  " << argv[0] << " --extract <archive run dir> <from> <to> <out.wav> [--unix]   Seconds since the run started, or Unix seconds" << std::endl
+		<< "  " << argv[0] << " --blackbox <file> <from> <to> <out.wav> [--unix]              Seconds before the newest sample, or Unix seconds" << std::endl
+		<< "  " << argv[0] << " --receive <udp port> <out.wav|play> [--group addr] [--seconds N] [--rate Hz] [--channels N] [--buffer-ms N]" << std::endl
+		<< "  " << argv[0] << " --shm-read <name> <out.wav> [--seconds N]" << std::endl
+		<< "  " << argv[0] << " --soak <generatorPort> <samplerPort> [--baud N] [--rate Hz] [--speed X] [--duration sec] [--block-ms N]" << std::endl
+		<< "        [--report soak.json] [--max-drops N] [--max-mismatches N] [--max-rss-growth-mb N] [--max-cpu-ms N] [--max-p99-ms N]" << std::endl;
+	exitCode = -1;
+	return true;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	int exitCode = 0;
+	if (RunTool(argc, argv, exitCode))
+	{
+		APP_LOG_STOP();
+		return exitCode;
+	}
+
 	APP_LOG_LEVEL(LOGLVL(Debug));
 
-	CConfigMgr cmgr;
-	if (!Utils::fileExists(CONFIG_FILE_NAME))
-		ConfigResetDefaults(cmgr);
-	else
-		Utils::RemoveBOMFromFile(CONFIG_FILE_NAME);
-	cmgr.Load(CONFIG_FILE_NAME);
-	auto settings = GetSettings(cmgr);
+	ConfigValues settings;
+	std::vector<std::string> errors;
+	if (!LoadSettings(settings, errors))
+	{
+		for (auto& err : errors)
+			appLog(Critical) << "Config: " << err;
+		APP_LOG_STOP();
+		return -1;
+	}
+
+	_____LOGGER::Logger::Level logLevel;
+	ParseLogLevel(settings.LogLevel, logLevel);
+	APP_LOG_LEVEL(logLevel);
+	APP_LOG_ROTATION(settings.LogRotation());
+	// All globals exist and the retention is known; the writer must be stopped again before main returns
+	APP_LOG_START();
 	appLog(Info) << "Config loaded.";
+	appLog(Info) << "Clock: " << Clock::Describe();
+
+	if (settings.TraceEnabled)
+		_____TRACE::___Trace.Open(settings.TraceFileName, settings.TraceRecords);
+	if (settings.TraceZonesEnabled)
+		_____PROFILER::___Profiler.Start(settings.TraceZoneEventsPerThread);
+	if (settings.MetricsEnabled)
+		_____METRICS::___Metrics.Start(settings.Metrics());
 
 	try
 	{
@@ -74,29 +717,48 @@ int main()
 			std::cin >> mode;
 		appLog(Debug) << "Mode " << mode;
 
-		SerialAudioSampler sampler(settings.SerialPort, settings.BaudRate, settings.SampleCalcDurationSec);
+		SinkSet sinks;
+		SerialAudioSampler sampler(settings.Serial(), settings.SampleCalcDurationSec, settings.RawCaptureFile);
+		sampler.SetRealtimeMode(settings.Realtime());
+		sampler.SetGain(settings.Gain);
+		sampler.SetActivityGate(settings.Activity());
+		sampler.SetWriteOverview(settings.WriteOverview);
+		sinks.Attach(sampler, settings);
 
 		if (mode == 0)
 			sampler.StartSamplingToFile(settings.FileName);
 		else
 			sampler.StartSamplingToWaveStream(settings.StreamBufferMs, settings.Device);
 
-		std::cout << "Press F12 to stop..." << std::endl;
-		while (!(GetKeyState(VK_F12) & 0x8000))
+		ConfigWatcher watcher(CONFIG_FILE_NAME, [&]() { ReloadSettings(sampler, settings); });
+
+		std::cout << "Press F12 to stop, F11 to log latency percentiles, F10 to dump the trigger buffer..." << std::endl;
+		while (sampler.IsSampling() && !(GetKeyState(VK_F12) & 0x8000))
+		{
+			if (GetKeyState(VK_F11) & 0x8000)
+				_____METRICS::___Metrics.LogLatencies();
+			if (GetKeyState(VK_F10) & 0x8000)
+				sinks.Trigger();
 			Sleep(500);
+		}
 		
 		sampler.Stop();
 		sampler.Sync();
+		sinks.Stop();
+		_____METRICS::___Metrics.LogLatencies();
+		if (settings.TraceZonesEnabled)
+		{
+			_____PROFILER::___Profiler.Stop();
+			_____PROFILER::___Profiler.Dump(settings.TraceZonesFile);
+		}
 	}
 	catch (const std::exception& ex)
 	{
 		appLog(Critical) << "Error occured: " << ex.what();
+		APP_LOG_STOP();
 		return -1;
 	}
 
-
-
+	APP_LOG_STOP();
 	return 0;
-}
-
-
+}
\ No newline at end of file